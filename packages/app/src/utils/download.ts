@@ -2,9 +2,18 @@ import { tinyassert } from "@hiogawa/utils";
 import { range } from "lodash";
 import { fetchDownload } from "../routes/api/download.api";
 import {
+  getMetadataCache,
+  metadataCacheKey,
+  putMetadataCache,
+} from "./metadata-cache";
+import {
+  createRangeParser,
+  deleteRangeParser,
   extractWebmInfo,
   findContainingRange,
-  remuxWebm,
+  pushRange,
+  remuxRange,
+  serializeWebmMetadata,
 } from "./worker-client-libwebm";
 import type { VideoInfo } from "./youtube-utils";
 
@@ -32,8 +41,10 @@ export function downloadFastSeek(
   tinyassert(filesize);
 
   let cancelled = false;
-  let metadataBuffer: Uint8Array;
-  let frameBuffer: Uint8Array;
+  let metadataCache: Uint8Array | undefined;
+  // frames are parsed in worker while chunks arrive without reassembly copy
+  let rangeParserId: number | undefined;
+  const pushed: Promise<void>[] = [];
   let i = 0;
   let chunkRanges: [number, number][];
   let total = 0;
@@ -41,21 +52,31 @@ export function downloadFastSeek(
 
   return new ReadableStream({
     async start() {
-      // fetch only first 0.1% or 1KB which is expected to include all "Cue" data
-      const res = await fetchDownload({
-        id: videoInfo.id,
-        format_id,
-        start: 0,
-        end: Math.max(Math.ceil(filesize * 0.001), 2 ** 10),
-      });
+      // reuse parsed metadata of the same source
+      const cacheKey = metadataCacheKey(videoInfo.id, format_id, filesize);
+      metadataCache = await getMetadataCache(cacheKey);
       if (cancelled) return;
 
-      tinyassert(res.ok);
-      metadataBuffer = new Uint8Array(await res.arrayBuffer());
-      if (cancelled) return;
+      if (!metadataCache) {
+        // fetch only first 0.1% or 1KB which is expected to include all "Cue" data
+        const res = await fetchDownload({
+          id: videoInfo.id,
+          format_id,
+          start: 0,
+          end: Math.max(Math.ceil(filesize * 0.001), 2 ** 10),
+        });
+        if (cancelled) return;
+
+        tinyassert(res.ok);
+        const metadataBuffer = new Uint8Array(await res.arrayBuffer());
+        if (cancelled) return;
 
-      // parse webm for metadata
-      const metadata = await extractWebmInfo(metadataBuffer);
+        // parse webm for metadata
+        metadataCache = await serializeWebmMetadata(metadataBuffer, filesize);
+        if (cancelled) return;
+        await putMetadataCache(cacheKey, metadataCache);
+      }
+      const metadata = await extractWebmInfo(metadataCache);
       if (cancelled) return;
 
       // compute necessary chunk ranges
@@ -63,7 +84,8 @@ export function downloadFastSeek(
       const start = byteRange.start;
       const end = byteRange.end ?? filesize;
       total = end - start;
-      frameBuffer = new Uint8Array(total);
+      rangeParserId = await createRangeParser(total);
+      if (cancelled) return;
       chunkRanges = range(Math.ceil(total / CHUNK_SIZE)).map((i) => {
         return [
           start + CHUNK_SIZE * i,
@@ -80,7 +102,11 @@ export function downloadFastSeek(
       //
       if (i >= chunkRanges.length) {
         // remux
-        const result = await remuxWebm(metadataBuffer, frameBuffer);
+        tinyassert(metadataCache);
+        tinyassert(rangeParserId !== undefined);
+        await Promise.all(pushed);
+        const result = await remuxRange(rangeParserId, metadataCache);
+        rangeParserId = undefined;
         if (cancelled) return;
 
         // enqueue result and close
@@ -118,8 +144,11 @@ export function downloadFastSeek(
         if (done) {
           break;
         }
-        frameBuffer.set(value, offset);
+        // pushed chunk is parsed as soon as preceding range is available
+        tinyassert(rangeParserId !== undefined);
+        const chunkOffset = offset;
         offset += value.length;
+        pushed.push(pushRange(rangeParserId, chunkOffset, value));
         controller.enqueue({
           offset,
           total,
@@ -129,6 +158,9 @@ export function downloadFastSeek(
     },
     cancel() {
       cancelled = true;
+      if (rangeParserId !== undefined) {
+        deleteRangeParser(rangeParserId);
+      }
     },
   });
 }
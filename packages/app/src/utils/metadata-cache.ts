@@ -0,0 +1,98 @@
+// IndexedDB store of serialized webm metadata (cf. serializeWebmMetadata)
+// so that clipping the same source again skips metadata download and parse.
+// any IndexedDB failure is treated as cache miss.
+
+const DB_NAME = "webm-metadata-cache";
+const DB_VERSION = 1;
+const STORE_NAME = "entries";
+
+// keep recently used entries only
+const MAX_ENTRIES = 200;
+
+interface CacheEntry {
+  key: string;
+  data: Uint8Array;
+  accessedAt: number;
+}
+
+let dbPromise: Promise<IDBDatabase> | undefined;
+
+function openDb(): Promise<IDBDatabase> {
+  dbPromise ??= new Promise((resolve, reject) => {
+    const req = indexedDB.open(DB_NAME, DB_VERSION);
+    req.onupgradeneeded = () => {
+      const store = req.result.createObjectStore(STORE_NAME, {
+        keyPath: "key",
+      });
+      store.createIndex("accessedAt", "accessedAt");
+    };
+    req.onsuccess = () => resolve(req.result);
+    req.onerror = () => reject(req.error);
+  });
+  return dbPromise;
+}
+
+function promisifyRequest<T>(req: IDBRequest<T>): Promise<T> {
+  return new Promise((resolve, reject) => {
+    req.onsuccess = () => resolve(req.result);
+    req.onerror = () => reject(req.error);
+  });
+}
+
+export function metadataCacheKey(
+  id: string,
+  format_id: string,
+  filesize: number
+): string {
+  return [id, format_id, filesize].join(":");
+}
+
+export async function getMetadataCache(
+  key: string
+): Promise<Uint8Array | undefined> {
+  try {
+    const db = await openDb();
+    const store = db
+      .transaction(STORE_NAME, "readwrite")
+      .objectStore(STORE_NAME);
+    const entry: CacheEntry | undefined = await promisifyRequest(
+      store.get(key)
+    );
+    if (!entry) {
+      return;
+    }
+    entry.accessedAt = Date.now();
+    await promisifyRequest(store.put(entry));
+    return entry.data;
+  } catch (e) {
+    console.error(e);
+    return;
+  }
+}
+
+export async function putMetadataCache(
+  key: string,
+  data: Uint8Array
+): Promise<void> {
+  try {
+    const db = await openDb();
+    const store = db
+      .transaction(STORE_NAME, "readwrite")
+      .objectStore(STORE_NAME);
+    const entry: CacheEntry = { key, data, accessedAt: Date.now() };
+    await promisifyRequest(store.put(entry));
+
+    // evict least recently used
+    const count = await promisifyRequest(store.count());
+    if (count > MAX_ENTRIES) {
+      const keys = await promisifyRequest(
+        store.index("accessedAt").getAllKeys(null, count - MAX_ENTRIES)
+      );
+      for (const key of keys) {
+        store.delete(key);
+      }
+    }
+  } catch (e) {
+    console.error(e);
+  }
+}
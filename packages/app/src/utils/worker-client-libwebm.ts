@@ -19,26 +19,65 @@ const getWorker = once(async () => {
   return workerImpl;
 });
 
+export async function serializeWebmMetadata(
+  webmMetadataBuffer: Uint8Array,
+  fileSize: number
+): Promise<Uint8Array> {
+  const workerImpl = await getWorker();
+  const output = await workerImpl.serializeWebmMetadata(
+    webmMetadataBuffer,
+    fileSize
+  );
+  return output;
+}
+
 export async function extractWebmInfo(
-  webmMetadataBuffer: Uint8Array
+  metadataCache: Uint8Array
 ): Promise<SimpleMetadata> {
   const workerImpl = await getWorker();
-  const output = await workerImpl.extractWebmInfo(webmMetadataBuffer);
+  const output = await workerImpl.extractWebmInfo(metadataCache);
   return output;
 }
 
 export async function remuxWebm(
-  webmMetadataBuffer: Uint8Array,
+  metadataCache: Uint8Array,
   webmFrameBuffer: Uint8Array
 ): Promise<Uint8Array> {
   const workerImpl = await getWorker();
   const output = await workerImpl.remux(
-    webmMetadataBuffer,
+    metadataCache,
     transfer(webmFrameBuffer, [webmFrameBuffer.buffer])
   );
   return output;
 }
 
+export async function createRangeParser(size: number): Promise<number> {
+  const workerImpl = await getWorker();
+  return workerImpl.createRangeParser(size);
+}
+
+export async function pushRange(
+  id: number,
+  offset: number,
+  chunk: Uint8Array
+): Promise<void> {
+  const workerImpl = await getWorker();
+  await workerImpl.pushRange(id, offset, transfer(chunk, [chunk.buffer]));
+}
+
+export async function remuxRange(
+  id: number,
+  metadataCache: Uint8Array
+): Promise<Uint8Array> {
+  const workerImpl = await getWorker();
+  return workerImpl.remuxRange(id, metadataCache);
+}
+
+export async function deleteRangeParser(id: number): Promise<void> {
+  const workerImpl = await getWorker();
+  await workerImpl.deleteRangeParser(id);
+}
+
 // copied from packages/ffmpeg/src/cpp/ex01-emscripten-cli.ts
 
 interface ContainingRange {
@@ -55,22 +94,25 @@ export function findContainingRange(
   tinyassert(metadata.segment_body_start);
   tinyassert(metadata.track_entries.length === 1);
 
-  interface StrictCuePont {
-    time: number;
-    cluster_position: number;
+  // cue index of last cue at or before `startTime` and first cue after `endTime`
+  const times = metadata.cue_time;
+  const positions = metadata.cue_cluster_position;
+  let startIndex = startTime ? -1 : 0;
+  let endIndex = -1;
+  for (let i = 0; i < times.length; i++) {
+    const time = times[i] / 1000;
+    tinyassert(!Number.isNaN(time));
+    if (startTime && time <= startTime) {
+      startIndex = i;
+    }
+    if (endTime && endIndex === -1 && time > endTime) {
+      endIndex = i;
+    }
   }
-  const cuePoints: StrictCuePont[] = metadata.cue_points.map((c) => {
-    const { time, cluster_position } = c;
-    tinyassert(typeof time === "number");
-    tinyassert(typeof cluster_position === "number");
-    return { time: time / 1000, cluster_position };
-  });
-
-  const startCue = startTime
-    ? [...cuePoints].reverse().find((c) => c.time <= startTime)
-    : cuePoints[0];
-  const endCue = endTime && cuePoints.find((c) => c.time > endTime);
-  tinyassert(startCue);
+  tinyassert(0 <= startIndex && startIndex < times.length);
+  const startCue = { cluster_position: positions[startIndex] };
+  const endCue = endIndex >= 0 && { cluster_position: positions[endIndex] };
+  tinyassert(!Number.isNaN(startCue.cluster_position));
 
   return {
     start: startCue.cluster_position + metadata.segment_body_start,
@@ -1,4 +1,5 @@
 import type {
+  EmbindConvertOptions,
   EmbindVector,
   EmscriptenInit,
   EmscriptenModule,
@@ -19,6 +20,8 @@ class FFmpegWorker {
     const init: EmscriptenInit = (self as any)["Module"];
     tinyassert(init);
     Module = await init({ locateFile: () => wasmUrl });
+    // worker runs one operation after another on the same heap
+    Module.embind_setArena(true);
   }
 
   async webmToOpus(
@@ -48,7 +51,8 @@ class FFmpegWorker {
       "opus",
       metadataMap,
       startTime ? parseTimestamp(startTime) : -1,
-      endTime ? parseTimestamp(endTime) : -1
+      endTime ? parseTimestamp(endTime) : -1,
+      DEFAULT_CONVERT_OPTIONS
     );
     return outData.view();
   }
@@ -60,14 +64,14 @@ class FFmpegWorker {
       "mjpeg",
       new Module.embind_StringMap(),
       -1,
-      -1
+      -1,
+      DEFAULT_CONVERT_OPTIONS
     );
     return outData.view();
   }
 
   async extractMetadata(opus: Uint8Array): Promise<Metadata> {
-    const outData = Module.embind_extractMetadata(arrayToVector(opus));
-    return JSON.parse(outData);
+    return Module.embind_extractMetadata(arrayToVector(opus));
   }
 }
 
@@ -75,6 +79,17 @@ class FFmpegWorker {
 // utils
 //
 
+const DEFAULT_CONVERT_OPTIONS: EmbindConvertOptions = {
+  loudness_gain: false,
+  num_threads: 0,
+  transcode: false,
+  bit_rate: 0,
+  seek_index_interval: 0,
+  auto_trim: false,
+  silence_threshold: -50,
+  auto_trim_window: 10,
+};
+
 function arrayToVector(data: Uint8Array): EmbindVector {
   const vector = new Module.embind_Vector();
   vector.resize(data.length, 0);
@@ -1,44 +1,118 @@
 import type {
+  EmbindRangeFrameParser,
   EmbindVector,
   EmscriptenInit,
   EmscriptenModule,
   SimpleMetadata,
 } from "@hiogawa/ffmpeg/build/tsc/cpp/ex01-emscripten-types";
 import { tinyassert } from "@hiogawa/utils";
-import { expose } from "comlink";
+import { expose, transfer } from "comlink";
 
 export type { LibwebmWorker };
 
 let Module: EmscriptenModule;
 
+// cf. RangeFrameParser in utils-webm.hpp
+const rangeParsers = new Map<number, EmbindRangeFrameParser>();
+let nextRangeParserId = 0;
+
 class LibwebmWorker {
   async initialize(moduleUrl: string, wasmUrl: string): Promise<void> {
     importScripts(moduleUrl);
     const init: EmscriptenInit = (self as any)["Module"];
     tinyassert(init);
     Module = await init({ locateFile: () => wasmUrl });
+    // worker runs one operation after another on the same heap
+    Module.embind_setArena(true);
+  }
+
+  // parse partial webm data into cache entry (cf. utils-webm-cache.hpp)
+  serializeWebmMetadata(
+    webmMetadataBuffer: Uint8Array, // partial webm data
+    fileSize: number
+  ): Uint8Array {
+    tinyassert(Module);
+    const outData = Module.embind_serializeMetadata(
+      arrayToVector(webmMetadataBuffer),
+      fileSize
+    );
+    return outData.view().slice();
   }
 
-  extractWebmInfo(
-    webmMetadataBuffer: Uint8Array // partial webm data
-  ): SimpleMetadata {
+  extractWebmInfo(metadataCache: Uint8Array): SimpleMetadata {
     tinyassert(Module);
 
-    const metadataString = Module.embind_parseMetadataWrapper(
-      arrayToVector(webmMetadataBuffer)
+    // copy cue columns out of wasm memory once and transfer them as is
+    const parsed = Module.embind_ParsedMetadata.fromCache(
+      arrayToVector(metadataCache)
     );
-    const metadata: SimpleMetadata = JSON.parse(metadataString);
-    return metadata;
+    try {
+      const segmentBodyStart = parsed.segmentBodyStart();
+      const metadata: SimpleMetadata = {
+        segment_body_start:
+          segmentBodyStart >= 0 ? segmentBodyStart : undefined,
+        track_entries: parsed.trackEntries(),
+        cue_time: parsed.cueTime().slice(),
+        cue_cluster_position: parsed.cueClusterPosition().slice(),
+      };
+      return transfer(metadata, [
+        metadata.cue_time.buffer,
+        metadata.cue_cluster_position.buffer,
+      ]);
+    } finally {
+      parsed.delete();
+    }
   }
 
-  remux(
-    webmMetadataBuffer: Uint8Array,
-    webmFrameBuffer: Uint8Array
-  ): Uint8Array {
-    const outData = Module.embind_remuxWrapper(
-      arrayToVector(webmMetadataBuffer),
+  createRangeParser(size: number): number {
+    tinyassert(Module);
+    const id = nextRangeParserId++;
+    rangeParsers.set(
+      id,
+      new Module.embind_RangeFrameParser(size, -1 /* all tracks */)
+    );
+    return id;
+  }
+
+  // chunks can be pushed in any order as each fetch resolves
+  pushRange(id: number, offset: number, chunk: Uint8Array): void {
+    const parser = rangeParsers.get(id);
+    tinyassert(parser);
+    const vector = arrayToVector(chunk);
+    try {
+      parser.push(offset, vector);
+    } finally {
+      vector.delete();
+    }
+  }
+
+  remuxRange(id: number, metadataCache: Uint8Array): Uint8Array {
+    const parser = rangeParsers.get(id);
+    tinyassert(parser);
+    try {
+      tinyassert(parser.done(), "missing range");
+      const outData = Module.embind_remuxCachedRange(
+        arrayToVector(metadataCache),
+        parser,
+        false /* fix_timestamp */
+      );
+      return outData.view();
+    } finally {
+      this.deleteRangeParser(id);
+    }
+  }
+
+  deleteRangeParser(id: number): void {
+    rangeParsers.get(id)?.delete();
+    rangeParsers.delete(id);
+  }
+
+  remux(metadataCache: Uint8Array, webmFrameBuffer: Uint8Array): Uint8Array {
+    const outData = Module.embind_remuxCached(
+      arrayToVector(metadataCache),
       arrayToVector(webmFrameBuffer),
-      false /* fix_timestamp */
+      false /* fix_timestamp */,
+      -1 /* all tracks */
     );
     return outData.view();
   }
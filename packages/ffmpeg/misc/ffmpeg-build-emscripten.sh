@@ -7,6 +7,13 @@ set -eu -o pipefail
 
 build_dir="/app/build/emscripten/ffmpeg"
 
+# av_malloc calls utils_av_malloc etc... which are defined by utils-memory.hpp
+# for our examples and by misc/ffmpeg-malloc-prefix.c for ffmpeg cli (built
+# with pthreads)
+echo ":: [malloc-prefix]"
+mkdir -p "$build_dir"
+/emsdk/upstream/emscripten/emcc -O2 -pthread -c misc/ffmpeg-malloc-prefix.c -o "$build_dir/malloc-prefix.o"
+
 echo ":: [configure]"
 bash misc/ffmpeg-configure.sh "$build_dir" --prefix="$build_dir/prefix" \
   --enable-cross-compile \
@@ -18,12 +25,13 @@ bash misc/ffmpeg-configure.sh "$build_dir" --prefix="$build_dir/prefix" \
   --ranlib=/emsdk/upstream/emscripten/emranlib \
   --extra-ldflags='-s USE_PTHREADS=1 -s PROXY_TO_PTHREAD=1 -s PTHREAD_POOL_SIZE_STRICT=0 -s EXPORT_NAME=ffmpeg -s ALLOW_MEMORY_GROWTH=1 -s MODULARIZE=1 --minify 0 -s FILESYSTEM=1 -s EXPORTED_RUNTIME_METHODS=["callMain","FS"]' \
   --target-os=none --arch=x86_32 \
+  --malloc-prefix=utils_av_ --extra-libs="$build_dir/malloc-prefix.o" \
   --disable-autodetect --disable-everything --disable-asm --disable-doc --disable-stripping \
   --enable-protocol=file \
-  --enable-demuxer=webm_dash_manifest,ogg,mjpeg \
-  --enable-muxer=opus,mjpeg \
+  --enable-demuxer=webm_dash_manifest,ogg,mjpeg,mov \
+  --enable-muxer=opus,mjpeg,webm,matroska,mp4 \
   --enable-encoder=opus,mjpeg \
-  --enable-decoder=opus,mjpeg
+  --enable-decoder=opus,aac,mjpeg,vp8,vp9
 
 echo ":: [make]"
 make -j -C "$build_dir" install EXESUF=.js
@@ -0,0 +1,25 @@
+// plain allocator for ffmpeg cli built with --malloc-prefix=utils_av_
+// (examples replace it with accounted allocator of utils-memory.hpp)
+
+#include <malloc.h>
+#include <stdlib.h>
+
+void* utils_av_malloc(size_t size) {
+  return malloc(size);
+}
+
+void* utils_av_realloc(void* ptr, size_t size) {
+  return realloc(ptr, size);
+}
+
+void utils_av_free(void* ptr) {
+  free(ptr);
+}
+
+int utils_av_posix_memalign(void** ptr, size_t align, size_t size) {
+  return posix_memalign(ptr, align, size);
+}
+
+void* utils_av_memalign(size_t align, size_t size) {
+  return memalign(align, size);
+}
@@ -27,11 +27,30 @@ const convert = tinycli(
     artist: z.string().optional(),
     startTime: z.preprocess(Number, z.number()).default(-1),
     endTime: z.preprocess(Number, z.number()).default(-1),
+    loudnessGain: z.enum(["true", "false"]).default("false"),
+    transcode: z.enum(["true", "false"]).default("false"),
+    bitRate: z.preprocess(Number, z.number().int()).default(0),
+    seekIndexInterval: z.preprocess(Number, z.number()).default(0),
+    autoTrim: z.enum(["true", "false"]).default("false"),
+    silenceThreshold: z.preprocess(Number, z.number()).default(-50),
+    autoTrimWindow: z.preprocess(Number, z.number()).default(10),
+    memoryBudget: z.preprocess(Number, z.number().int()).default(0),
+    arena: z.enum(["true", "false"]).default("false"),
+    deadline: z.preprocess(Number, z.number()).default(0),
+    progress: z.enum(["true", "false"]).default("false"),
   }),
   async (args) => {
     // initialize emscritpen module
     const init: EmscriptenInit = require(path.resolve(args.module));
     const Module: EmscriptenModule = await init();
+    Module.embind_setMemoryBudget(args.memoryBudget);
+    Module.embind_setArena(args.arena === "true");
+    Module.embind_setDeadline(args.deadline);
+    if (args.progress === "true") {
+      Module.embind_setProgressCallback((progress) => {
+        console.error(progress);
+      });
+    }
 
     // media data
     const inData = new Module.embind_Vector();
@@ -58,12 +77,221 @@ const convert = tinycli(
       args.outFormat,
       metadata,
       args.startTime,
+      args.endTime,
+      {
+        loudness_gain: args.loudnessGain === "true",
+        num_threads: 0,
+        transcode: args.transcode === "true",
+        bit_rate: args.bitRate,
+        seek_index_interval: args.seekIndexInterval,
+        auto_trim: args.autoTrim === "true",
+        silence_threshold: args.silenceThreshold,
+        auto_trim_window: args.autoTrimWindow,
+      }
+    );
+    console.log(Module.embind_lastMemoryStats());
+    await fs.promises.writeFile(args.out, outData.view());
+  }
+);
+
+//
+// split
+//
+
+const TRACKS_SCHEMA = z.array(
+  z.object({
+    out: z.string(),
+    startTime: z.number().default(-1),
+    endTime: z.number().default(-1),
+    thumbnail: z.string().optional(),
+    title: z.string().optional(),
+    artist: z.string().optional(),
+  })
+);
+
+const split = tinycli(
+  z.object({
+    module: z.string().default(DEFAULT_MODULE_PATH),
+    in: z.string(),
+    outFormat: z.string(),
+    tracks: z.string(), // json file of TRACKS_SCHEMA
+    loudnessGain: z.enum(["true", "false"]).default("false"),
+    seekIndexInterval: z.preprocess(Number, z.number()).default(0),
+    autoTrim: z.enum(["true", "false"]).default("false"),
+    silenceThreshold: z.preprocess(Number, z.number()).default(-50),
+    autoTrimWindow: z.preprocess(Number, z.number()).default(10),
+  }),
+  async (args) => {
+    // initialize emscritpen module
+    const init: EmscriptenInit = require(path.resolve(args.module));
+    const Module: EmscriptenModule = await init();
+
+    // media data
+    const inData = new Module.embind_Vector();
+    await readFileToVector(inData, args.in);
+
+    // entries
+    const tracks = TRACKS_SCHEMA.parse(
+      JSON.parse(await fs.promises.readFile(args.tracks, "utf-8"))
+    );
+    const entries = new Module.embind_SplitEntryVector();
+    for (const track of tracks) {
+      const metadata = new Module.embind_StringMap();
+      for (const [k, v] of Object.entries({
+        title: track.title,
+        artist: track.artist,
+      })) {
+        if (v) {
+          metadata.set(k, v);
+        }
+      }
+      if (track.thumbnail) {
+        const thumbnailData = await fs.promises.readFile(track.thumbnail);
+        metadata.set(METADATA_BLOCK_PICTURE, encode(thumbnailData));
+      }
+      entries.push_back({
+        start_time: track.startTime,
+        end_time: track.endTime,
+        metadata,
+      });
+    }
+
+    const outputs = Module.embind_split(inData, args.outFormat, entries, {
+      loudness_gain: args.loudnessGain === "true",
+      num_threads: 0,
+      transcode: false,
+      bit_rate: 0,
+      seek_index_interval: args.seekIndexInterval,
+      auto_trim: args.autoTrim === "true",
+      silence_threshold: args.silenceThreshold,
+      auto_trim_window: args.autoTrimWindow,
+    });
+    for (let i = 0; i < tracks.length; i++) {
+      await fs.promises.writeFile(tracks[i].out, outputs.get(i).view());
+    }
+  }
+);
+
+//
+// merge
+//
+
+const merge = tinycli(
+  z.object({
+    module: z.string().default(DEFAULT_MODULE_PATH),
+    video: z.string(),
+    audio: z.string(),
+    out: z.string(),
+    outFormat: z.string(),
+    title: z.string().optional(),
+    artist: z.string().optional(),
+    startTime: z.preprocess(Number, z.number()).default(-1),
+    endTime: z.preprocess(Number, z.number()).default(-1),
+  }),
+  async (args) => {
+    // initialize emscritpen module
+    const init: EmscriptenInit = require(path.resolve(args.module));
+    const Module: EmscriptenModule = await init();
+
+    // read data
+    const videoData = new Module.embind_Vector();
+    await readFileToVector(videoData, args.video);
+    const audioData = new Module.embind_Vector();
+    await readFileToVector(audioData, args.audio);
+
+    // metadata
+    const metadata = new Module.embind_StringMap();
+    for (const [k, v] of Object.entries({
+      title: args.title,
+      artist: args.artist,
+    })) {
+      if (v) {
+        metadata.set(k, v);
+      }
+    }
+
+    // process
+    const outData = Module.embind_merge(
+      videoData,
+      audioData,
+      args.outFormat,
+      metadata,
+      args.startTime,
       args.endTime
     );
     await fs.promises.writeFile(args.out, outData.view());
   }
 );
 
+//
+// concat
+//
+
+const concat = tinycli(
+  z.object({
+    module: z.string().default(DEFAULT_MODULE_PATH),
+    in: z.string(), // comma separated files
+    out: z.string(),
+    outFormat: z.string(),
+    title: z.string().optional(),
+    artist: z.string().optional(),
+  }),
+  async (args) => {
+    // initialize emscritpen module
+    const init: EmscriptenInit = require(path.resolve(args.module));
+    const Module: EmscriptenModule = await init();
+
+    // read data
+    const inputs = new Module.embind_VectorVector();
+    for (const file of args.in.split(",")) {
+      const inData = new Module.embind_Vector();
+      await readFileToVector(inData, file);
+      inputs.push_back(inData);
+    }
+
+    // metadata
+    const metadata = new Module.embind_StringMap();
+    for (const [k, v] of Object.entries({
+      title: args.title,
+      artist: args.artist,
+    })) {
+      if (v) {
+        metadata.set(k, v);
+      }
+    }
+
+    // process
+    const outData = Module.embind_concat(inputs, args.outFormat, metadata);
+    await fs.promises.writeFile(args.out, outData.view());
+  }
+);
+
+//
+// waveform
+//
+
+const waveform = tinycli(
+  z.object({
+    module: z.string().default(DEFAULT_MODULE_PATH),
+    in: z.string(),
+    out: z.string(),
+    samplesPerBucket: z.preprocess(Number, z.number().int()).default(4800),
+  }),
+  async (args) => {
+    // initialize emscritpen module
+    const init: EmscriptenInit = require(path.resolve(args.module));
+    const Module: EmscriptenModule = await init();
+
+    // read data
+    const inData = new Module.embind_Vector();
+    await readFileToVector(inData, args.in);
+
+    // process
+    const outData = Module.embind_waveform(inData, args.samplesPerBucket);
+    await fs.promises.writeFile(args.out, outData.view());
+  }
+);
+
 //
 // extractMetadata
 //
@@ -88,6 +316,49 @@ const extractMetadata = tinycli(
   }
 );
 
+//
+// updateTags
+//
+
+const updateTags = tinycli(
+  z.object({
+    module: z.string().default(DEFAULT_MODULE_PATH),
+    in: z.string(),
+    out: z.string(),
+    thumbnail: z.string().optional(),
+    title: z.string().optional(),
+    artist: z.string().optional(),
+  }),
+  async (args) => {
+    // initialize emscritpen module
+    const init: EmscriptenInit = require(path.resolve(args.module));
+    const Module: EmscriptenModule = await init();
+
+    // read data
+    const inData = new Module.embind_Vector();
+    await readFileToVector(inData, args.in);
+
+    // metadata (empty string removes key)
+    const metadata = new Module.embind_StringMap();
+    for (const [k, v] of Object.entries({
+      title: args.title,
+      artist: args.artist,
+    })) {
+      if (typeof v === "string") {
+        metadata.set(k, v);
+      }
+    }
+    if (args.thumbnail) {
+      const thumbnailData = await fs.promises.readFile(args.thumbnail);
+      metadata.set(METADATA_BLOCK_PICTURE, encode(thumbnailData));
+    }
+
+    // process
+    const outData = Module.embind_updateTags(inData, metadata);
+    await fs.promises.writeFile(args.out, outData.view());
+  }
+);
+
 //
 // utils
 //
@@ -102,7 +373,15 @@ async function readFileToVector(
 }
 
 function main() {
-  const cli = tinycliMulti({ convert, extractMetadata });
+  const cli = tinycliMulti({
+    convert,
+    split,
+    merge,
+    concat,
+    waveform,
+    extractMetadata,
+    updateTags,
+  });
   const args = process.argv.slice(2);
   return cli(args);
 }
@@ -3,33 +3,129 @@ export interface EmbindVector {
   view(): Uint8Array;
 }
 
+export interface EmbindVectorVector {
+  size(): number;
+  get(i: number): EmbindVector;
+  push_back(v: EmbindVector): void;
+}
+
 export interface EmbindStringMap {
   set(k: string, v: string): void;
 }
 
+export interface EmbindConvertOptions {
+  loudness_gain: boolean; // embed R128_TRACK_GAIN and R128_ALBUM_GAIN
+  num_threads: number; // 0 to use all available cores
+  transcode: boolean; // re-encode to opus (only for embind_convert)
+  bit_rate: number; // of re-encoded opus (0 for encoder default)
+  seek_index_interval: number; // of ogg skeleton keypoints (0 to disable)
+  auto_trim: boolean; // trim leading and trailing silence (opus only)
+  silence_threshold: number; // dBFS of 10ms block RMS regarded as silence
+  auto_trim_window: number; // seconds decoded at each end for auto_trim
+}
+
+export interface EmbindSplitEntry {
+  start_time: number; // -1 to indicate no value
+  end_time: number;
+  metadata: EmbindStringMap;
+}
+
+export interface EmbindSplitEntryVector {
+  push_back(entry: EmbindSplitEntry): void;
+}
+
+export interface EmbindMemoryStats {
+  peak: number; // maximum bytes in use during last operation
+  current: number; // bytes still in use after last operation (e.g. result)
+  allocated: number; // sum of all allocation sizes
+  allocations: number;
+  process_peak: number; // including buffers allocated outside operation
+  heap_size: number; // wasm heap size
+  arena_size: number; // bytes reserved by arena chunks
+}
+
+export interface EmbindProgress {
+  time: number; // processed media time in seconds
+  bytes: number; // processed input bytes
+  total_time: number; // 0 if unknown
+  total_bytes: number; // 0 if unknown
+  elapsed: number; // seconds since operation started
+  throughput: number; // bytes per second
+  eta: number; // estimated seconds to completion (-1 if unknown)
+}
+
 export interface Metadata {
   bit_rate: number;
   duration: number;
   format_name: string; // e.g. ogg
   metadata: Record<string, string>;
   streams: {
-    type: string; // e.g. audio, video
-    codec: string; // e.g. opus
+    type: string | null; // e.g. audio, video
+    codec: string | null; // e.g. opus
     metadata: Record<string, string>;
   }[];
 }
 
+// thrown by embind functions on failure (cf. utils-embind.hpp)
+export interface EmbindError extends Error {
+  code: string; // e.g. assert, av, cancelled, deadline, memory_budget
+}
+
 export interface EmscriptenModule {
   embind_Vector: new () => EmbindVector;
+  embind_VectorVector: new () => EmbindVectorVector;
   embind_StringMap: new () => EmbindStringMap;
+  embind_SplitEntryVector: new () => EmbindSplitEntryVector;
   embind_convert: (
     in_data: EmbindVector,
     out_format: string,
     metadata: EmbindStringMap,
     start_time: number,
+    end_time: number,
+    options: EmbindConvertOptions
+  ) => EmbindVector;
+  embind_split: (
+    in_data: EmbindVector,
+    out_format: string,
+    entries: EmbindSplitEntryVector,
+    options: EmbindConvertOptions
+  ) => EmbindVectorVector;
+  // stream copy of video and audio into single container (e.g. webm, mp4)
+  embind_merge: (
+    video_data: EmbindVector,
+    audio_data: EmbindVector,
+    out_format: string,
+    metadata: EmbindStringMap,
+    start_time: number, // moved back to video key frame
     end_time: number
   ) => EmbindVector;
-  embind_extractMetadata: (in_data: EmbindVector) => string; // stringified Metadata
+  // stream copy of inputs with same codec parameters in sequence
+  embind_concat: (
+    inputs: EmbindVectorVector,
+    out_format: string,
+    metadata: EmbindStringMap
+  ) => EmbindVector;
+  embind_waveform: (
+    in_data: EmbindVector,
+    samples_per_bucket: number
+  ) => EmbindVector; // int16 (min, max, rms) per bucket
+  embind_extractMetadata: (in_data: EmbindVector) => Metadata;
+  // ogg opus only (audio pages are copied as is, empty value removes key)
+  embind_updateTags: (
+    in_data: EmbindVector,
+    metadata: EmbindStringMap
+  ) => EmbindVector;
+  embind_setMemoryBudget: (budget: number) => void; // 0 to disable
+  // serve small allocations from arena reused across operations
+  embind_setArena: (enabled: boolean) => void;
+  embind_lastMemoryStats: () => EmbindMemoryStats;
+  // return false from callback to cancel (wasm runs synchronously so that
+  // cancellation requested elsewhere has to be observed by the callback)
+  embind_setProgressCallback: (
+    callback: ((progress: EmbindProgress) => boolean | void) | null
+  ) => void;
+  embind_setDeadline: (seconds: number) => void; // 0 to disable
+  embind_cancel: () => void;
 }
 
 export type EmscriptenInit = (options?: {
@@ -4,20 +4,127 @@
 #include <cstring>
 #include <optional>
 #include "ex00-impl.hpp"
+#include "utils-embind.hpp"
+#include "utils-memory.hpp"
+#include "utils-ogg.hpp"
+#include "utils-progress.hpp"
 #include "utils.hpp"
 
 using namespace emscripten;
+using utils_embind::guard;
 
 template <typename T>
 val vector_view(const std::vector<T>& self) {
   return val(typed_memory_view(self.size(), self.data()));
 }
 
+//
+// embind_extractMetadata
+//
+
+val map_to_val(const std::map<std::string, std::string>& map) {
+  auto result = val::object();
+  for (auto& [k, v] : map) {
+    result.set(k, v);
+  }
+  return result;
+}
+
+val optional_to_val(const std::optional<std::string>& v) {
+  return v ? val(v.value()) : val::null();
+}
+
+// same shape as `extractMetadata` json without stringify/parse round trip
+utils::Result<val> extractMetadata(const std::vector<uint8_t>& in_data) {
+  TRY_ASSIGN(auto info, ex00_impl::extractFormatInfo(in_data));
+  auto result = val::object();
+  result.set("format_name", info.format_name);
+  result.set("duration", static_cast<double>(info.duration));
+  result.set("bit_rate", static_cast<double>(info.bit_rate));
+  result.set("metadata", map_to_val(info.metadata));
+  auto streams = val::array();
+  for (auto& stream_info : info.streams) {
+    auto stream = val::object();
+    stream.set("type", optional_to_val(stream_info.type));
+    stream.set("codec", optional_to_val(stream_info.codec));
+    stream.set("metadata", map_to_val(stream_info.metadata));
+    streams.call<void>("push", stream);
+  }
+  result.set("streams", streams);
+  return result;
+}
+
+//
+// embind_setProgressCallback
+//
+
+// js callback returning false cancels running operation
+void setProgressCallback(val callback) {
+  if (callback.isNull() || callback.isUndefined()) {
+    utils_progress::setCallback(nullptr);
+    return;
+  }
+  utils_progress::setCallback(
+      [callback](const utils_progress::Progress& progress) {
+        return !callback(progress).isFalse();
+      });
+}
+
 EMSCRIPTEN_BINDINGS(ex_00) {
   register_vector<uint8_t>("embind_Vector")
       .function("view", &vector_view<uint8_t>);
+  register_vector<std::vector<uint8_t>>("embind_VectorVector");
   register_map<std::string, std::string>("embind_StringMap");
 
-  function("embind_convert", &ex00_impl::convert);
-  function("embind_extractMetadata", &ex00_impl::extractMetadata);
+  value_object<utils_memory::Stats>("embind_MemoryStats")
+      .field("peak", &utils_memory::Stats::peak)
+      .field("current", &utils_memory::Stats::current)
+      .field("allocated", &utils_memory::Stats::allocated)
+      .field("allocations", &utils_memory::Stats::allocations)
+      .field("process_peak", &utils_memory::Stats::process_peak)
+      .field("heap_size", &utils_memory::Stats::heap_size)
+      .field("arena_size", &utils_memory::Stats::arena_size);
+  function("embind_setMemoryBudget", &utils_memory::setBudget);
+  function("embind_setArena", &utils_memory::setArena);
+  function("embind_lastMemoryStats", &utils_memory::lastStats);
+
+  value_object<utils_progress::Progress>("embind_Progress")
+      .field("time", &utils_progress::Progress::time)
+      .field("bytes", &utils_progress::Progress::bytes)
+      .field("total_time", &utils_progress::Progress::total_time)
+      .field("total_bytes", &utils_progress::Progress::total_bytes)
+      .field("elapsed", &utils_progress::Progress::elapsed)
+      .field("throughput", &utils_progress::Progress::throughput)
+      .field("eta", &utils_progress::Progress::eta);
+  function("embind_setProgressCallback", &setProgressCallback);
+  function("embind_setDeadline", &utils_progress::setDeadline);
+  function("embind_cancel", &utils_progress::cancel);
+
+  value_object<ex00_impl::ConvertOptions>("embind_ConvertOptions")
+      .field("loudness_gain", &ex00_impl::ConvertOptions::loudness_gain)
+      .field("num_threads", &ex00_impl::ConvertOptions::num_threads)
+      .field("transcode", &ex00_impl::ConvertOptions::transcode)
+      .field("bit_rate", &ex00_impl::ConvertOptions::bit_rate)
+      .field("seek_index_interval",
+             &ex00_impl::ConvertOptions::seek_index_interval)
+      .field("auto_trim", &ex00_impl::ConvertOptions::auto_trim)
+      .field("silence_threshold",
+             &ex00_impl::ConvertOptions::silence_threshold)
+      .field("auto_trim_window",
+             &ex00_impl::ConvertOptions::auto_trim_window);
+
+  value_object<ex00_impl::SplitEntry>("embind_SplitEntry")
+      .field("start_time", &ex00_impl::SplitEntry::start_time)
+      .field("end_time", &ex00_impl::SplitEntry::end_time)
+      .field("metadata", &ex00_impl::SplitEntry::metadata);
+  register_vector<ex00_impl::SplitEntry>("embind_SplitEntryVector");
+
+  // failure is thrown as js Error with `code` (cf. utils-embind.hpp)
+  function("embind_convert", &guard<&ex00_impl::convert>::call);
+  function("embind_split", &guard<&ex00_impl::split>::call);
+  function("embind_merge", &guard<&ex00_impl::merge>::call);
+  function("embind_concat", &guard<&ex00_impl::concat>::call);
+  function("embind_waveform", &guard<&ex00_impl::waveform>::call);
+  function("embind_extractMetadata", &guard<&extractMetadata>::call);
+  function("embind_updateTags", &guard<&utils_ogg::updateTags>::call);
 }
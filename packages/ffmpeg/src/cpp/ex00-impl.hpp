@@ -4,11 +4,31 @@
 // - [x] embed thumbnail
 // - [x] extract metadata
 // - [x] extract thumbnail
+// - [x] split into multiple time ranges in single pass
+// - [x] embed R128 loudness gain
+// - [x] waveform peaks
+// - [x] memory accounting and budget
+// - [x] progress, cancellation and deadline
+// - [x] merge separate video and audio by stream copy
+// - [x] transcode to opus in parallel segments
+// - [x] gapless concatenation of inputs by stream copy
+// - [x] seek index (ogg skeleton) of opus output
+// - [x] auto trim of leading and trailing silence
 
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <cstring>
+#include <memory>
 #include <nlohmann/json.hpp>
 #include <optional>
 #include "utils-ffmpeg.hpp"
+#include "utils-loudness.hpp"
+#include "utils-memory.hpp"
+#include "utils-ogg.hpp"
+#include "utils-peaks.hpp"
+#include "utils-progress.hpp"
+#include "utils-simd.hpp"
 #include "utils.hpp"
 
 extern "C" {
@@ -16,6 +36,7 @@ extern "C" {
 #include <libavformat/avformat.h>
 #include <libavformat/avio.h>
 #include <libavutil/avutil.h>
+#include <libavutil/intreadwrite.h>
 }
 
 namespace ex00_impl {
@@ -23,19 +44,496 @@ namespace ex00_impl {
 using utils_ffmpeg::BufferInput;
 using utils_ffmpeg::BufferOutput;
 
-// demux to single stream
-std::vector<uint8_t> convert(const std::vector<uint8_t>& in_data,
-                             const std::string& out_format,
-                             const std::map<std::string, std::string>& metadata,
-                             double start_time,  // -1 to indicate no value
-                             double end_time) {
-  // validate timestamp
-  if (start_time >= 0 && end_time >= 0) {
-    ASSERT(start_time <= end_time);
+struct ConvertOptions {
+  // decode audio to embed R128_TRACK_GAIN and R128_ALBUM_GAIN tags
+  bool loudness_gain = false;
+  // 0 to use all available cores
+  int num_threads = 0;
+  // re-encode to opus (e.g. from aac or to lower bit rate) instead of copy
+  bool transcode = false;
+  // bits per second of re-encoded opus (0 for encoder default)
+  int bit_rate = 0;
+  // seconds between keypoints of ogg skeleton index written into opus output
+  // (0 to disable since some players don't expect skeleton track)
+  double seek_index_interval = 0;
+  // trim leading and trailing silence by decoding only first and last
+  // `auto_trim_window` seconds of each range (opus only)
+  bool auto_trim = false;
+  // RMS level (dBFS) of 10ms block up to which audio is regarded as silence
+  double silence_threshold = -50;
+  double auto_trim_window = 10;
+};
+
+// time range (in seconds) and metadata of single output
+struct SplitEntry {
+  double start_time;  // -1 to indicate no value
+  double end_time;
+  std::map<std::string, std::string> metadata;
+};
+
+// samples discarded from the end of packet (cf. AV_PKT_DATA_SKIP_SAMPLES)
+int64_t discardPadding(const AVPacket* pkt) {
+  size_t size = 0;
+  auto data = av_packet_get_side_data(pkt, AV_PKT_DATA_SKIP_SAMPLES, &size);
+  return data && size >= 10 ? AV_RL32(data + 4) : 0;
+}
+
+void clearDiscardPadding(AVPacket* pkt) {
+  size_t size = 0;
+  auto data = av_packet_get_side_data(pkt, AV_PKT_DATA_SKIP_SAMPLES, &size);
+  if (data && size >= 10) {
+    AV_WL32(data + 4, 0);
+  }
+}
+
+utils::Result<void> setDiscardPadding(AVPacket* pkt, int64_t padding) {
+  size_t size = 0;
+  auto data = av_packet_get_side_data(pkt, AV_PKT_DATA_SKIP_SAMPLES, &size);
+  if (!data || size < 10) {
+    data = av_packet_new_side_data(pkt, AV_PKT_DATA_SKIP_SAMPLES, 10);
+    ASSERT(data);
+    std::memset(data, 0, 10);
+  }
+  AV_WL32(data + 4, padding);
+  return {};
+}
+
+// time range (in seconds) within which audio is audible (-1 for the side
+// without silence to trim)
+struct AudibleRange {
+  double start_time = -1;
+  double end_time = -1;
+};
+
+// decoder warm-up kept before trimmed start and discarded by pre-skip
+// (cf. RFC 7845 section 4.6)
+constexpr double OPUS_PREROLL = 0.08;
+
+// output muxer covering single SplitEntry
+struct SplitOutput {
+  const SplitEntry& entry_;
+  BufferOutput output_;
+  AVFormatContext* ofmt_ctx_ = nullptr;
+  AVStream* out_stream_ = nullptr;
+  // Skeleton index of ogg opus (cf. seek_index_interval)
+  std::optional<utils_ogg::SkeletonIndexer> indexer_;
+  // in "time base" unit of input stream (-1 to indicate no value)
+  int64_t start_time_tb_ = -1;
+  int64_t end_time_tb_ = -1;
+  // sample accurate bounds within packets of the range (cf. trim)
+  int64_t trim_start_tb_ = -1;
+  int64_t trim_end_tb_ = -1;
+  // subtracted from timestamps of output
+  int64_t offset_tb_ = -1;
+  bool started_ = false;
+  bool finished_ = false;
+
+  SplitOutput(const SplitEntry& entry) : entry_{entry} {}
+
+  ~SplitOutput() {
+    if (ofmt_ctx_) {
+      avformat_free_context(ofmt_ctx_);
+    }
+  }
+
+  utils::Result<void> initialize(const std::string& out_format,
+                                 const AVStream* in_stream,
+                                 double seek_index_interval) {
+    TRY(output_.initialize());
+    if (seek_index_interval > 0) {
+      TRY(indexer_.emplace().initialize(seek_index_interval));
+      output_.on_write_ = [this](auto& data) { indexer_->scan(data); };
+    }
+    avformat_alloc_output_context2(&ofmt_ctx_, NULL, out_format.c_str(), NULL);
+    ASSERT(ofmt_ctx_);
+    ofmt_ctx_->pb = output_.avio_ctx_;
+
+    // write metadata
+    for (auto [k, v] : entry_.metadata) {
+      av_dict_set(&ofmt_ctx_->metadata, k.c_str(), v.c_str(), 0);
+    }
+
+    // output stream
+    out_stream_ = avformat_new_stream(ofmt_ctx_, nullptr);
+    ASSERT(out_stream_);
+    ASSERT(avcodec_parameters_copy(out_stream_->codecpar,
+                                   in_stream->codecpar) >= 0);
+    out_stream_->time_base = in_stream->time_base;
+
+    // convert to "time base" unit
+    start_time_tb_ = toTimeBase(entry_.start_time, in_stream->time_base);
+    end_time_tb_ = toTimeBase(entry_.end_time, in_stream->time_base);
+    return {};
+  }
+
+  static int64_t toTimeBase(double time, AVRational time_base) {
+    if (time < 0) {
+      return -1;
+    }
+    return av_rescale_q(static_cast<int64_t>(time * AV_TIME_BASE),
+                        AV_TIME_BASE_Q, time_base);
+  }
+
+  // narrow range to `range` by stream copy. packets are cut from
+  // OPUS_PREROLL before the audible start and the samples up to it are
+  // discarded by pre-skip, while the last packet is shortened by discard
+  // padding (matroska) and by its duration (granule of ogg).
+  void trim(const AudibleRange& range, AVRational time_base) {
+    // too short to cut before the first packet (pre-skip is kept as is)
+    if (range.start_time >= OPUS_PREROLL) {
+      trim_start_tb_ = toTimeBase(range.start_time, time_base);
+      start_time_tb_ =
+          toTimeBase(range.start_time - OPUS_PREROLL, time_base);
+    }
+    if (range.end_time >= 0) {
+      trim_end_tb_ = toTimeBase(range.end_time, time_base);
+      end_time_tb_ = trim_end_tb_;
+    }
+  }
+
+  // write header lazily when the first packet within the range arrives
+  utils::Result<void> start(int64_t first_pts = AV_NOPTS_VALUE) {
+    ASSERT(!started_);
+    offset_tb_ = start_time_tb_;
+    if (trim_start_tb_ >= 0 && first_pts != AV_NOPTS_VALUE) {
+      // audible start becomes 0 and preceding samples have negative
+      // timestamp as muxers expect for pre-skip (cf. initial_padding)
+      auto codecpar = out_stream_->codecpar;
+      auto pre_skip =
+          av_rescale_q(std::max<int64_t>(trim_start_tb_ - first_pts, 0),
+                       out_stream_->time_base, {1, codecpar->sample_rate});
+      ASSERT(pre_skip <= UINT16_MAX);
+      codecpar->initial_padding = pre_skip;
+      // OpusHead is written as is by both ogg and matroska
+      if (codecpar->extradata_size >= 19 &&
+          std::memcmp(codecpar->extradata, "OpusHead", 8) == 0) {
+        AV_WL16(codecpar->extradata + 10, pre_skip);
+      }
+      offset_tb_ = trim_start_tb_;
+    }
+    ASSERT(avformat_write_header(ofmt_ctx_, nullptr) >= 0);
+    started_ = true;
+    return {};
+  }
+
+  utils::Result<void> finish() {
+    ASSERT(!finished_);
+    if (!started_) {
+      TRY(start());
+    }
+    ASSERT(av_interleaved_write_frame(ofmt_ctx_, nullptr) == 0);
+    av_write_trailer(ofmt_ctx_);
+    if (indexer_) {
+      TRY(indexer_->finish(output_.output_));
+    }
+    finished_ = true;
+    return {};
+  }
+
+  // take new reference of `pkt` and rebase its timestamp
+  utils::Result<void> writePacket(const AVPacket* pkt,
+                                  AVRational in_time_base) {
+    AVPacket* out_pkt = av_packet_clone(pkt);
+    ASSERT(out_pkt);
+    DEFER {
+      av_packet_free(&out_pkt);
+    };
+    if (trim_end_tb_ >= 0 && out_pkt->duration > 0 &&
+        out_pkt->pts + out_pkt->duration > trim_end_tb_) {
+      auto excess = out_pkt->pts + out_pkt->duration - trim_end_tb_;
+      auto padding = av_rescale_q(excess, in_time_base,
+                                  {1, out_stream_->codecpar->sample_rate});
+      TRY(setDiscardPadding(out_pkt,
+                            std::max(padding, discardPadding(out_pkt))));
+      out_pkt->duration -= excess;
+    }
+    if (offset_tb_ >= 0) {
+      out_pkt->pts -= offset_tb_;
+      out_pkt->dts -= offset_tb_;
+    }
+    out_pkt->stream_index = out_stream_->index;
+    av_packet_rescale_ts(out_pkt, in_time_base, out_stream_->time_base);
+    ASSERT(av_interleaved_write_frame(ofmt_ctx_, out_pkt) == 0);
+    return {};
+  }
+};
+
+//
+// loudness analysis
+//
+
+// decode packets [begin, end) split into independent segments in parallel.
+// each segment starts decoding from earlier packets to warm up decoder and
+// K-weighting filter before accumulating its own range.
+utils::Result<utils_loudness::Subblocks> analyzeLoudness(
+    const AVStream* in_stream,
+    const std::vector<AVPacket*>& packets,
+    size_t begin,
+    size_t end,
+    int num_threads) {
+  utils_loudness::Subblocks result;
+  if (begin >= end) {
+    return result;
+  }
+  for (size_t i = begin; i < end; i++) {
+    ASSERT(packets[i]->pts != AV_NOPTS_VALUE);
+  }
+
+  auto sample_rate = in_stream->codecpar->sample_rate;
+  auto num_channels = in_stream->codecpar->ch_layout.nb_channels;
+  ASSERT(num_channels > 0);
+  AVRational sample_tb{1, sample_rate};
+  int64_t start_pts = packets[begin]->pts;
+
+  // at least 0.5 sec (or codec's pre-roll if longer) to warm up
+  int64_t preroll = av_rescale_q(
+      std::max(in_stream->codecpar->seek_preroll, sample_rate / 2), sample_tb,
+      in_stream->time_base);
+
+  size_t num_segments =
+      std::min(utils::resolveNumThreads(num_threads), end - begin);
+  std::vector<utils_loudness::Subblocks> segments(num_segments);
+
+  auto analyze_segment = [&](size_t k) -> utils::Result<void> {
+    size_t segment_begin = begin + (end - begin) * k / num_segments;
+    size_t segment_end = begin + (end - begin) * (k + 1) / num_segments;
+    int64_t segment_pts = packets[segment_begin]->pts;
+    size_t warmup = segment_begin;
+    while (warmup > 0 && packets[warmup - 1]->pts != AV_NOPTS_VALUE &&
+           segment_pts - packets[warmup - 1]->pts <= preroll) {
+      warmup--;
+    }
+
+    int64_t segment_position =
+        av_rescale_q(segment_pts - start_pts, in_stream->time_base, sample_tb);
+    int64_t next_position = 0;
+    utils_ffmpeg::Decoder decoder;
+    TRY(decoder.initialize(in_stream));
+    utils_loudness::Analyzer analyzer{sample_rate, num_channels};
+
+    auto on_frame = [&](AVFrame* frame) -> utils::Result<void> {
+      ASSERT(frame->format == AV_SAMPLE_FMT_FLTP);
+      ASSERT(frame->ch_layout.nb_channels == num_channels);
+      int64_t position = next_position;
+      if (frame->best_effort_timestamp != AV_NOPTS_VALUE) {
+        position = av_rescale_q(frame->best_effort_timestamp - start_pts,
+                                in_stream->time_base, sample_tb);
+      }
+      next_position = position + frame->nb_samples;
+      return analyzer.process(
+          reinterpret_cast<const float* const*>(frame->data),
+          frame->nb_samples, position, position >= segment_position);
+    };
+    for (size_t i = warmup; i < segment_end; i++) {
+      TRY(utils_progress::check());
+      TRY(decoder.decode(packets[i], on_frame));
+    }
+    TRY(decoder.decode(nullptr, on_frame));
+    segments[k] = std::move(analyzer.subblocks_);
+    return {};
+  };
+  TRY(utils::parallelFor(num_segments, num_threads, analyze_segment));
+
+  for (auto& segment : segments) {
+    TRY(result.merge(segment));
+  }
+  return result;
+}
+
+// packets [begin, end) written to `output` (cf. copy loop in `split`)
+std::pair<size_t, size_t> findPacketRange(const std::vector<AVPacket*>& packets,
+                                          const SplitOutput& output) {
+  size_t begin = 0;
+  while (begin < packets.size() && output.start_time_tb_ >= 0 &&
+         packets[begin]->pts < output.start_time_tb_) {
+    begin++;
+  }
+  size_t end = begin;
+  while (end < packets.size() && !(output.end_time_tb_ >= 0 &&
+                                   packets[end]->pts >= output.end_time_tb_)) {
+    end++;
+  }
+  return {begin, end};
+}
+
+// treat all outputs as single album
+utils::Result<void> embedLoudnessGain(
+    const AVStream* in_stream,
+    const std::vector<AVPacket*>& packets,
+    const std::vector<std::unique_ptr<SplitOutput>>& outputs,
+    int num_threads) {
+  std::vector<utils_loudness::Subblocks> tracks;
+  for (auto& output : outputs) {
+    auto [begin, end] = findPacketRange(packets, *output);
+    TRY_ASSIGN(auto track,
+               analyzeLoudness(in_stream, packets, begin, end, num_threads));
+    tracks.push_back(std::move(track));
+  }
+
+  auto subblock_size = static_cast<uint32_t>(std::lround(
+      in_stream->codecpar->sample_rate * utils_loudness::SUBBLOCK_DURATION));
+  std::vector<const utils_loudness::Subblocks*> album;
+  for (auto& track : tracks) {
+    album.push_back(&track);
+  }
+  auto album_gain = utils_loudness::toR128Gain(
+      utils_loudness::integratedLoudness(album, subblock_size));
+
+  for (size_t i = 0; i < outputs.size(); i++) {
+    auto track_gain = utils_loudness::toR128Gain(
+        utils_loudness::integratedLoudness({&tracks[i]}, subblock_size));
+    auto& metadata = outputs[i]->ofmt_ctx_->metadata;
+    av_dict_set(&metadata, "R128_TRACK_GAIN",
+                std::to_string(track_gain).c_str(), 0);
+    av_dict_set(&metadata, "R128_ALBUM_GAIN",
+                std::to_string(album_gain).c_str(), 0);
+  }
+  return {};
+}
+
+//
+// auto trim
+//
+
+constexpr double SILENCE_BLOCK_DURATION = 0.01;  // seconds
+
+// first and last audible block of scanned window (in seconds)
+struct SilenceScan {
+  std::optional<double> first_audible;  // start of the first audible block
+  std::optional<double> last_audible;   // end of the last audible block
+};
+
+// seek to `begin` (less pre-roll for decoder to converge) and decode up to
+// `end`. blocks are aligned to the stream's sample position and each block is
+// audible when mean square of all channels exceeds `threshold` (dBFS).
+utils::Result<SilenceScan> scanSilence(AVFormatContext* ifmt_ctx,
+                                       AVStream* in_stream,
+                                       double begin,
+                                       double end,
+                                       double threshold) {
+  SilenceScan result;
+  if (begin >= end) {
+    return result;
   }
+  auto time_base = in_stream->time_base;
+  auto sample_rate = in_stream->codecpar->sample_rate;
+  auto num_channels = in_stream->codecpar->ch_layout.nb_channels;
+  AVRational sample_tb{1, sample_rate};
+  int64_t block_size =
+      std::max<int64_t>(std::lround(sample_rate * SILENCE_BLOCK_DURATION), 1);
+  int64_t begin_sample = std::llround(begin * sample_rate);
+  int64_t end_sample = std::llround(end * sample_rate);
+  double threshold_sq = std::pow(10.0, threshold / 10);
+
+  // webm seeks by cue points and ogg by bisection
+  double preroll =
+      std::max(static_cast<double>(in_stream->codecpar->seek_preroll) /
+                   sample_rate,
+               OPUS_PREROLL);
+  auto seek_tb = SplitOutput::toTimeBase(std::max(begin - preroll, 0.0),
+                                         time_base);
+  ASSERT(av_seek_frame(ifmt_ctx, in_stream->index, seek_tb,
+                       AVSEEK_FLAG_BACKWARD) >= 0);
+
+  int64_t block = -1;
+  double block_sum_sq = 0;
+  int64_t block_count = 0;  // samples of all channels
+  auto flush_block = [&]() {
+    if (block_count > 0 && block_sum_sq > threshold_sq * block_count) {
+      if (!result.first_audible) {
+        result.first_audible =
+            static_cast<double>(std::max(block * block_size, begin_sample)) /
+            sample_rate;
+      }
+      result.last_audible =
+          static_cast<double>(
+              std::min((block + 1) * block_size, end_sample)) /
+          sample_rate;
+    }
+    block_sum_sq = 0;
+    block_count = 0;
+  };
+
+  int64_t next_position = AV_NOPTS_VALUE;
+  auto on_frame = [&](AVFrame* frame) -> utils::Result<void> {
+    ASSERT(frame->format == AV_SAMPLE_FMT_FLTP);
+    ASSERT(frame->ch_layout.nb_channels == num_channels);
+    int64_t position = next_position;
+    if (frame->best_effort_timestamp != AV_NOPTS_VALUE) {
+      position = av_rescale_q(frame->best_effort_timestamp, time_base,
+                              sample_tb);
+    }
+    if (position == AV_NOPTS_VALUE) {
+      return {};
+    }
+    next_position = position + frame->nb_samples;
+
+    // split the part within the window at block boundaries
+    int64_t i = std::max<int64_t>(begin_sample - position, 0);
+    int64_t n = std::min<int64_t>(end_sample - position, frame->nb_samples);
+    while (i < n) {
+      int64_t sample_block = (position + i) / block_size;
+      if (sample_block != block) {
+        flush_block();
+        block = sample_block;
+      }
+      int64_t count =
+          std::min((sample_block + 1) * block_size - position, n) - i;
+      for (int c = 0; c < num_channels; c++) {
+        auto data = reinterpret_cast<const float*>(frame->extended_data[c]);
+        block_sum_sq += utils_simd::reduceMinMaxSquare(data + i, count).sum_sq;
+      }
+      block_count += count * num_channels;
+      i += count;
+    }
+    return {};
+  };
+
+  AVPacket* pkt = av_packet_alloc();
+  ASSERT(pkt);
+  DEFER {
+    av_packet_free(&pkt);
+  };
+  int64_t end_tb = av_rescale_q(end_sample, sample_tb, time_base);
+  utils_ffmpeg::Decoder decoder;
+  TRY(decoder.initialize(in_stream));
+  while (av_read_frame(ifmt_ctx, pkt) >= 0) {
+    DEFER {
+      av_packet_unref(pkt);
+    };
+    if (pkt->stream_index != in_stream->index) {
+      continue;
+    }
+    if (pkt->pts != AV_NOPTS_VALUE) {
+      if (pkt->pts >= end_tb) {
+        break;
+      }
+      if (next_position == AV_NOPTS_VALUE) {
+        next_position = av_rescale_q(pkt->pts, time_base, sample_tb);
+      }
+    }
+    TRY(decoder.decode(pkt, on_frame));
+  }
+  TRY(utils_progress::check());
+  TRY(decoder.decode(nullptr, on_frame));
+  flush_block();
+  return result;
+}
+
+// audible range within [start_time, end_time) found from its first and last
+// `auto_trim_window` seconds, so that trimming costs a few seconds of decode
+// regardless of input duration. the input is demuxed separately from the one
+// being copied so that seeking doesn't disturb it.
+utils::Result<AudibleRange> detectAudibleRange(
+    const std::vector<uint8_t>& in_data,
+    double start_time,  // -1 to indicate no value
+    double end_time,
+    const ConvertOptions& options) {
+  ASSERT(options.auto_trim_window > 0);
 
   // input context
-  BufferInput input_{in_data};
+  BufferInput input_;
+  TRY(input_.initialize(in_data));
   AVFormatContext* ifmt_ctx_ = avformat_alloc_context();
   ASSERT(ifmt_ctx_);
   DEFER {
@@ -43,45 +541,140 @@ std::vector<uint8_t> convert(const std::vector<uint8_t>& in_data,
   };
   ifmt_ctx_->pb = input_.avio_ctx_;
   ifmt_ctx_->flags |= AVFMT_FLAG_CUSTOM_IO;
+  ifmt_ctx_->interrupt_callback = {utils_progress::interruptCallback, nullptr};
 
   ASSERT(avformat_open_input(&ifmt_ctx_, NULL, NULL, NULL) == 0);
   ASSERT(avformat_find_stream_info(ifmt_ctx_, NULL) == 0);
 
-  // output context
-  BufferOutput output_;
-  AVFormatContext* ofmt_ctx_;
-  avformat_alloc_output_context2(&ofmt_ctx_, NULL, out_format.c_str(), NULL);
-  ASSERT(ofmt_ctx_);
+  // input stream
+  auto stream_index =
+      av_find_best_stream(ifmt_ctx_, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+  ASSERT(stream_index >= 0);
+  utils_ffmpeg::discardOtherStreams(ifmt_ctx_, stream_index);
+  AVStream* in_stream = ifmt_ctx_->streams[stream_index];
+  ASSERT(in_stream);
+
+  // range to scan (tail is kept when duration is unknown)
+  double range_start = std::max(start_time, 0.0);
+  double range_end = end_time;
+  if (range_end < 0 && ifmt_ctx_->duration > 0) {
+    range_end = static_cast<double>(ifmt_ctx_->duration) / AV_TIME_BASE;
+  }
+  double window = options.auto_trim_window;
+  double head_end =
+      range_end >= 0 ? std::min(range_start + window, range_end)
+                     : range_start + window;
+
+  // the whole window is trimmed when nothing is audible
+  AudibleRange result;
+  TRY_ASSIGN(auto head, scanSilence(ifmt_ctx_, in_stream, range_start,
+                                    head_end, options.silence_threshold));
+  double audible_start = head.first_audible.value_or(head_end);
+  if (audible_start > range_start) {
+    result.start_time = audible_start;
+  }
+  if (range_end >= 0) {
+    double tail_start = std::max(range_end - window, range_start);
+    TRY_ASSIGN(auto tail, scanSilence(ifmt_ctx_, in_stream, tail_start,
+                                      range_end, options.silence_threshold));
+    double audible_end = tail.last_audible.value_or(tail_start);
+    if (audible_end < range_end) {
+      result.end_time = audible_end;
+    }
+  }
+
+  // keep silent input as is
+  double trimmed_start = std::max(result.start_time, range_start);
+  double trimmed_end = result.end_time >= 0 ? result.end_time : range_end;
+  if (trimmed_end >= 0 && trimmed_end <= trimmed_start) {
+    return AudibleRange{};
+  }
+  return result;
+}
+
+// demux once and write each (possibly overlapping) time range to its own
+// single stream output
+utils::Result<std::vector<std::vector<uint8_t>>> split(
+    const std::vector<uint8_t>& in_data,
+    const std::string& out_format,
+    const std::vector<SplitEntry>& entries,
+    const ConvertOptions& options) {
+  utils_memory::Scope memory_scope;
+  utils_progress::Scope progress_scope;
+  ASSERT(!options.transcode);  // only supported by single range `convert`
+  if (options.seek_index_interval > 0) {
+    ASSERT(out_format == "opus");
+  }
+
+  // validate timestamp
+  for (auto& entry : entries) {
+    if (entry.start_time >= 0 && entry.end_time >= 0) {
+      ASSERT(entry.start_time <= entry.end_time);
+    }
+  }
+
+  // input context
+  BufferInput input_;
+  TRY(input_.initialize(in_data));
+  AVFormatContext* ifmt_ctx_ = avformat_alloc_context();
+  ASSERT(ifmt_ctx_);
   DEFER {
-    avformat_free_context(ofmt_ctx_);
+    avformat_close_input(&ifmt_ctx_);
   };
-  ofmt_ctx_->pb = output_.avio_ctx_;
+  ifmt_ctx_->pb = input_.avio_ctx_;
+  ifmt_ctx_->flags |= AVFMT_FLAG_CUSTOM_IO;
+  ifmt_ctx_->interrupt_callback = {utils_progress::interruptCallback, nullptr};
 
-  // for now only allow single media type container (e.g. opus, mjpeg)
-  ASSERT(ofmt_ctx_->oformat->audio_codec == AV_CODEC_ID_NONE ||
-         ofmt_ctx_->oformat->video_codec == AV_CODEC_ID_NONE);
-  AVMediaType out_media_type =
-      ofmt_ctx_->oformat->video_codec == AV_CODEC_ID_NONE ? AVMEDIA_TYPE_AUDIO
-                                                          : AVMEDIA_TYPE_VIDEO;
+  ASSERT(avformat_open_input(&ifmt_ctx_, NULL, NULL, NULL) == 0);
+  ASSERT(avformat_find_stream_info(ifmt_ctx_, NULL) == 0);
 
-  // write metadata
-  for (auto [k, v] : metadata) {
-    av_dict_set(&ofmt_ctx_->metadata, k.c_str(), v.c_str(), 0);
-  }
+  // for now only allow single media type container (e.g. opus, mjpeg)
+  auto oformat = av_guess_format(out_format.c_str(), NULL, NULL);
+  ASSERT(oformat);
+  ASSERT(oformat->audio_codec == AV_CODEC_ID_NONE ||
+         oformat->video_codec == AV_CODEC_ID_NONE);
+  AVMediaType out_media_type = oformat->video_codec == AV_CODEC_ID_NONE
+                                   ? AVMEDIA_TYPE_AUDIO
+                                   : AVMEDIA_TYPE_VIDEO;
 
   // input stream
   auto stream_index =
       av_find_best_stream(ifmt_ctx_, out_media_type, -1, -1, NULL, 0);
   ASSERT(stream_index >= 0);
+  utils_ffmpeg::discardOtherStreams(ifmt_ctx_, stream_index);
   AVStream* in_stream = ifmt_ctx_->streams[stream_index];
   ASSERT(in_stream);
 
-  // output stream
-  AVStream* out_stream = avformat_new_stream(ofmt_ctx_, nullptr);
-  ASSERT(out_stream);
-  ASSERT(avcodec_parameters_copy(out_stream->codecpar, in_stream->codecpar) >=
-         0);
-  out_stream->time_base = in_stream->time_base;
+  // output context for each entry
+  std::vector<std::unique_ptr<SplitOutput>> outputs;
+  for (auto& entry : entries) {
+    auto& output = outputs.emplace_back(std::make_unique<SplitOutput>(entry));
+    TRY(output->initialize(out_format, in_stream,
+                           options.seek_index_interval));
+  }
+
+  // narrow each range to its audible part
+  if (options.auto_trim) {
+    ASSERT(in_stream->codecpar->codec_id == AV_CODEC_ID_OPUS);
+    for (auto& output : outputs) {
+      TRY_ASSIGN(auto range,
+                 detectAudibleRange(in_data, output->entry_.start_time,
+                                    output->entry_.end_time, options));
+      output->trim(range, in_stream->time_base);
+    }
+  }
+
+  // open outputs in the order of start time so that each packet only visits
+  // outputs whose range can cover it
+  std::vector<SplitOutput*> pending;
+  for (auto& output : outputs) {
+    pending.push_back(output.get());
+  }
+  std::sort(pending.begin(), pending.end(), [](auto* l, auto* r) {
+    return l->start_time_tb_ < r->start_time_tb_;
+  });
+  size_t next_pending = 0;
+  std::vector<SplitOutput*> active;
 
   // allocate AVPacket
   AVPacket* pkt = av_packet_alloc();
@@ -90,59 +683,994 @@ std::vector<uint8_t> convert(const std::vector<uint8_t>& in_data,
     av_packet_free(&pkt);
   };
 
-  // write header
-  ASSERT(avformat_write_header(ofmt_ctx_, nullptr) >= 0);
+  // report by time up to the last end time when every range is bounded
+  // (whole input is read when packets are buffered)
+  bool use_buffer = options.loudness_gain;
+  double total_time = 0;
+  if (ifmt_ctx_->duration > 0) {
+    total_time = static_cast<double>(ifmt_ctx_->duration) / AV_TIME_BASE;
+  }
+  if (!use_buffer && std::all_of(entries.begin(), entries.end(),
+                                 [](auto& e) { return e.end_time >= 0; })) {
+    total_time = 0;
+    for (auto& entry : entries) {
+      total_time = std::max(total_time, entry.end_time);
+    }
+  }
+  utils_progress::setTotal(total_time, in_data.size());
+  double last_time = 0;
+  auto update_progress = [&]() {
+    if (pkt->pts != AV_NOPTS_VALUE) {
+      last_time = pkt->pts * av_q2d(in_stream->time_base);
+    }
+    return utils_progress::update(last_time, input_.input_pos_);
+  };
 
-  // convert to "time base" unit
-  int64_t start_time_tb =
-      start_time >= 0
-          ? av_rescale_q(static_cast<int64_t>(start_time * AV_TIME_BASE),
-                         AV_TIME_BASE_Q, in_stream->time_base)
-          : -1;
-  int64_t end_time_tb =
-      end_time >= 0
-          ? av_rescale_q(static_cast<int64_t>(end_time * AV_TIME_BASE),
-                         AV_TIME_BASE_Q, in_stream->time_base)
-          : -1;
+  // buffer all packets upfront when header depends on them
+  std::vector<AVPacket*> buffer;
+  DEFER {
+    for (auto& buffered : buffer) {
+      av_packet_free(&buffered);
+    }
+  };
+  utils_memory::Reservation buffer_reservation;
+  if (use_buffer) {
+    while (av_read_frame(ifmt_ctx_, pkt) >= 0) {
+      DEFER {
+        av_packet_unref(pkt);
+      };
+      if (pkt->stream_index == stream_index) {
+        TRY(update_progress());
+        TRY(buffer_reservation.add(pkt->size));
+        buffer.push_back(av_packet_alloc());
+        ASSERT(buffer.back());
+        av_packet_move_ref(buffer.back(), pkt);
+      }
+    }
+    // read error due to interruption is not end of input
+    TRY(utils_progress::check());
+  }
+
+  // loudness gain tags
+  if (options.loudness_gain) {
+    ASSERT(out_media_type == AVMEDIA_TYPE_AUDIO);
+    TRY(embedLoudnessGain(in_stream, buffer, outputs, options.num_threads));
+  }
+
+  // next packet of selected stream
+  size_t buffer_pos = 0;
+  auto read_packet = [&]() -> utils::Result<bool> {
+    if (use_buffer) {
+      if (buffer_pos >= buffer.size()) {
+        return false;
+      }
+      ASSERT(av_packet_ref(pkt, buffer[buffer_pos++]) == 0);
+      return true;
+    }
+    while (av_read_frame(ifmt_ctx_, pkt) >= 0) {
+      if (pkt->stream_index == stream_index) {
+        TRY(update_progress());
+        return true;
+      }
+      av_packet_unref(pkt);
+    }
+    TRY(utils_progress::check());
+    return false;
+  };
 
   // copy packets with timestamp filtering
-  std::vector<uint8_t> result;
+  while (next_pending < pending.size() || !active.empty()) {
+    TRY_ASSIGN(bool has_packet, read_packet());
+    if (!has_packet) {
+      break;
+    }
+    DEFER {
+      av_packet_unref(pkt);
+    };
+
+    // open outputs starting at or before this packet
+    while (next_pending < pending.size() &&
+           (pending[next_pending]->start_time_tb_ < 0 ||
+            pending[next_pending]->start_time_tb_ <= pkt->pts)) {
+      auto output = pending[next_pending++];
+      TRY(output->start(pkt->pts));
+      active.push_back(output);
+    }
+
+    // write to outputs covering this packet and close the ended ones
+    for (auto output : active) {
+      if (output->end_time_tb_ >= 0 && pkt->pts >= output->end_time_tb_) {
+        TRY(output->finish());
+        continue;
+      }
+      TRY(output->writePacket(pkt, in_stream->time_base));
+    }
+    active.erase(std::remove_if(active.begin(), active.end(),
+                                [](auto* output) { return output->finished_; }),
+                 active.end());
+  }
+
+  // flush outputs reaching the end of input
+  std::vector<std::vector<uint8_t>> result;
+  for (auto& output : outputs) {
+    if (!output->finished_) {
+      TRY(output->finish());
+    }
+    result.push_back(std::move(output->output_.output_));
+  }
+  return result;
+}
+
+//
+// transcode
+//
+
+// encoder prefers libopus when ffmpeg is built with it
+utils::Result<const AVCodec*> findOpusEncoder() {
+  auto codec = avcodec_find_encoder_by_name("libopus");
+  if (!codec) {
+    codec = avcodec_find_encoder(AV_CODEC_ID_OPUS);
+  }
+  ASSERT(codec);
+  return codec;
+}
+
+// decode, resample and encode to ogg opus. long input is split into segments
+// at frame boundaries and each segment is encoded independently in parallel.
+// segments feed extra audio before and after their range to warm up decoder
+// and encoder, then keep only packets whose timestamp falls in their range.
+// since every encoder delays output by the same `initial_padding`, kept
+// packets join into single stream with continuous timestamps (i.e. granule
+// position) and pre-skip of the first segment.
+utils::Result<std::vector<uint8_t>> transcode(
+    const std::vector<uint8_t>& in_data,
+    const std::map<std::string, std::string>& metadata,
+    double start_time,  // -1 to indicate no value
+    double end_time,
+    const ConvertOptions& options) {
+  utils_memory::Scope memory_scope;
+  utils_progress::Scope progress_scope;
+  if (start_time >= 0 && end_time >= 0) {
+    ASSERT(start_time <= end_time);
+  }
+
+  // input context
+  BufferInput input_;
+  TRY(input_.initialize(in_data));
+  AVFormatContext* ifmt_ctx_ = avformat_alloc_context();
+  ASSERT(ifmt_ctx_);
+  DEFER {
+    avformat_close_input(&ifmt_ctx_);
+  };
+  ifmt_ctx_->pb = input_.avio_ctx_;
+  ifmt_ctx_->flags |= AVFMT_FLAG_CUSTOM_IO;
+  ifmt_ctx_->interrupt_callback = {utils_progress::interruptCallback, nullptr};
+
+  ASSERT(avformat_open_input(&ifmt_ctx_, NULL, NULL, NULL) == 0);
+  ASSERT(avformat_find_stream_info(ifmt_ctx_, NULL) == 0);
+
+  // input stream
+  auto stream_index =
+      av_find_best_stream(ifmt_ctx_, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+  ASSERT(stream_index >= 0);
+  utils_ffmpeg::discardOtherStreams(ifmt_ctx_, stream_index);
+  AVStream* in_stream = ifmt_ctx_->streams[stream_index];
+  ASSERT(in_stream);
+  auto in_time_base = in_stream->time_base;
+
+  // encoder parameters shared by segments
+  TRY_ASSIGN(auto codec, findOpusEncoder());
+  auto configure = [&](AVCodecContext* codec_ctx) {
+    codec_ctx->sample_rate = 48000;
+    codec_ctx->time_base = {1, 48000};
+    codec_ctx->sample_fmt =
+        codec->sample_fmts ? codec->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
+    av_channel_layout_default(
+        &codec_ctx->ch_layout,
+        std::min(in_stream->codecpar->ch_layout.nb_channels, 2));
+    if (options.bit_rate > 0) {
+      codec_ctx->bit_rate = options.bit_rate;
+    }
+    // for native encoder
+    codec_ctx->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+  };
+  utils_ffmpeg::Encoder header_encoder;
+  TRY(header_encoder.initialize(codec, configure));
+  int64_t frame_size = header_encoder.codec_ctx_->frame_size;
+  int64_t padding = header_encoder.codec_ctx_->initial_padding;
+  ASSERT(frame_size > 0);
+  AVRational sample_tb = header_encoder.codec_ctx_->time_base;
+
+  // at least 0.5 sec (or codec's pre-roll if longer) to warm up decoder
+  auto in_sample_rate = in_stream->codecpar->sample_rate;
+  int64_t preroll = av_rescale_q(
+      std::max(in_stream->codecpar->seek_preroll, in_sample_rate / 2),
+      {1, in_sample_rate}, in_time_base);
+  int64_t start_time_tb = SplitOutput::toTimeBase(start_time, in_time_base);
+  int64_t end_time_tb = SplitOutput::toTimeBase(end_time, in_time_base);
+
+  // allocate AVPacket
+  AVPacket* pkt = av_packet_alloc();
+  ASSERT(pkt);
+  DEFER {
+    av_packet_free(&pkt);
+  };
+
+  // buffer packets of the range including decoder warm up
+  std::vector<AVPacket*> packets;
+  DEFER {
+    for (auto& packet : packets) {
+      av_packet_free(&packet);
+    }
+  };
+  utils_memory::Reservation packets_reservation;
+  utils_progress::setTotal(
+      end_time >= 0 ? end_time
+                    : std::max<double>(ifmt_ctx_->duration, 0) / AV_TIME_BASE,
+      in_data.size());
   while (av_read_frame(ifmt_ctx_, pkt) >= 0) {
-    if (pkt->stream_index != stream_index) {
+    DEFER {
       av_packet_unref(pkt);
+    };
+    if (pkt->stream_index != stream_index) {
       continue;
     }
-    if (end_time >= 0) {
-      if (pkt->pts >= end_time_tb) {
-        av_packet_unref(pkt);
+    ASSERT(pkt->pts != AV_NOPTS_VALUE);
+    TRY(utils_progress::update(pkt->pts * av_q2d(in_time_base),
+                               input_.input_pos_));
+    if (start_time_tb >= 0 && pkt->pts + preroll < start_time_tb) {
+      continue;
+    }
+    if (end_time_tb >= 0 && pkt->pts >= end_time_tb) {
+      break;
+    }
+    TRY(packets_reservation.add(pkt->size));
+    packets.push_back(av_packet_alloc());
+    ASSERT(packets.back());
+    av_packet_move_ref(packets.back(), pkt);
+  }
+  TRY(utils_progress::check());
+  ASSERT(!packets.empty());
+
+  // sample position (in encoder's time base) relative to output start, which
+  // is not before the first packet so that every segment shares frame grid
+  int64_t start_pts = std::max(start_time_tb, packets[0]->pts);
+  auto to_position = [&](int64_t pts) {
+    return av_rescale_q(pts - start_pts, in_time_base, sample_tb);
+  };
+  auto to_pts = [&](int64_t position) {
+    return start_pts + av_rescale_q(position, sample_tb, in_time_base);
+  };
+  auto& last_packet = packets.back();
+  int64_t num_samples =
+      to_position(end_time_tb >= 0 ? end_time_tb
+                                   : last_packet->pts + last_packet->duration);
+  ASSERT(num_samples > 0);
+
+  // segments of at least 10 sec with 0.5 sec of warm up on each side
+  constexpr int64_t MIN_SEGMENT_SECONDS = 10;
+  int64_t warmup = (sample_tb.den / 2 / frame_size + 1) * frame_size;
+  int64_t num_frames = (num_samples + frame_size - 1) / frame_size;
+  int64_t num_segments = std::clamp<int64_t>(
+      num_samples / (MIN_SEGMENT_SECONDS * sample_tb.den), 1,
+      utils::resolveNumThreads(options.num_threads));
+  auto boundary = [&](int64_t k) {
+    return num_frames * k / num_segments * frame_size;
+  };
+  bool single_thread =
+      num_segments == 1 || utils::resolveNumThreads(options.num_threads) == 1;
+
+  std::vector<std::vector<AVPacket*>> segments(num_segments);
+  DEFER {
+    for (auto& segment : segments) {
+      for (auto& packet : segment) {
+        av_packet_free(&packet);
+      }
+    }
+  };
+  auto encode_segment = [&](size_t k) -> utils::Result<void> {
+    bool is_last = k + 1 == segments.size();
+    int64_t segment_begin = boundary(k);
+    int64_t segment_end = boundary(k + 1);
+    int64_t feed_begin = std::max<int64_t>(segment_begin - warmup, 0);
+    int64_t feed_end = is_last ? num_samples : segment_end + warmup;
+
+    // packets covering [feed_begin, feed_end) after decoder warm up
+    auto compare = [](const AVPacket* packet, int64_t pts) {
+      return packet->pts < pts;
+    };
+    size_t packet_begin =
+        std::lower_bound(packets.begin(), packets.end(),
+                         to_pts(feed_begin) - preroll, compare) -
+        packets.begin();
+    size_t packet_end = std::lower_bound(packets.begin(), packets.end(),
+                                         to_pts(feed_end), compare) -
+                        packets.begin();
+    if (packet_begin > 0) {
+      packet_begin--;
+    }
+    if (packet_end < packets.size()) {
+      packet_end++;
+    }
+
+    utils_ffmpeg::Decoder decoder;
+    TRY(decoder.initialize(in_stream));
+    utils_ffmpeg::Encoder encoder;
+    TRY(encoder.initialize(codec, configure));
+    std::optional<utils_ffmpeg::Resampler> resampler;
+    int64_t position = 0;  // of the first queued sample
+
+    auto on_packet = [&](AVPacket* packet) -> utils::Result<void> {
+      ASSERT(packet->pts != AV_NOPTS_VALUE);
+      if (packet->pts < segment_begin - padding ||
+          (!is_last && packet->pts >= segment_end - padding)) {
+        return {};
+      }
+      segments[k].push_back(av_packet_clone(packet));
+      ASSERT(segments[k].back());
+      return {};
+    };
+
+    // pass queued samples within [feed_begin, feed_end) to encoder
+    auto encode_queued = [&](bool flush) -> utils::Result<void> {
+      if (position < feed_begin) {
+        auto skip = std::min<int64_t>(feed_begin - position, resampler->size());
+        TRY(resampler->drain(skip));
+        position += skip;
+      }
+      while (position < feed_end) {
+        int64_t size = std::min(frame_size, feed_end - position);
+        if (resampler->size() < size) {
+          if (!flush || resampler->size() == 0) {
+            break;
+          }
+          size = resampler->size();
+        }
+        TRY_ASSIGN(auto frame, resampler->read(size));
+        frame->pts = position;
+        position += size;
+        TRY(encoder.encode(frame, on_packet));
+      }
+      return {};
+    };
+
+    auto on_frame = [&](AVFrame* frame) -> utils::Result<void> {
+      if (!resampler) {
+        TRY(resampler.emplace().initialize(frame, encoder.codec_ctx_));
+        position = frame->best_effort_timestamp != AV_NOPTS_VALUE
+                       ? to_position(frame->best_effort_timestamp)
+                       : to_position(packets[packet_begin]->pts);
+      }
+      TRY(resampler->write(frame));
+      return encode_queued(false);
+    };
+
+    for (size_t i = packet_begin; i < packet_end && position < feed_end; i++) {
+      if (single_thread) {
+        TRY(utils_progress::update(
+            (start_pts * av_q2d(in_time_base)) +
+                static_cast<double>(position) / sample_tb.den,
+            input_.input_pos_));
+      } else {
+        TRY(utils_progress::check());
+      }
+      TRY(decoder.decode(packets[i], on_frame));
+    }
+    TRY(decoder.decode(nullptr, on_frame));
+    if (resampler) {
+      TRY(resampler->write(nullptr));
+      TRY(encode_queued(true));
+    }
+    TRY(encoder.encode(nullptr, on_packet));
+    return {};
+  };
+  TRY(utils::parallelFor(num_segments, options.num_threads, encode_segment));
+
+  // output context
+  BufferOutput output;
+  TRY(output.initialize());
+  std::optional<utils_ogg::SkeletonIndexer> indexer;
+  if (options.seek_index_interval > 0) {
+    TRY(indexer.emplace().initialize(options.seek_index_interval));
+    output.on_write_ = [&](auto& data) { indexer->scan(data); };
+  }
+  AVFormatContext* ofmt_ctx = nullptr;
+  avformat_alloc_output_context2(&ofmt_ctx, NULL, "opus", NULL);
+  ASSERT(ofmt_ctx);
+  DEFER {
+    avformat_free_context(ofmt_ctx);
+  };
+  ofmt_ctx->pb = output.avio_ctx_;
+  for (auto& [k, v] : metadata) {
+    av_dict_set(&ofmt_ctx->metadata, k.c_str(), v.c_str(), 0);
+  }
+  if (options.loudness_gain) {
+    // gain of source audio within the range (re-encoding barely changes it)
+    size_t begin = std::lower_bound(packets.begin(), packets.end(), start_pts,
+                                    [](const AVPacket* packet, int64_t pts) {
+                                      return packet->pts < pts;
+                                    }) -
+                   packets.begin();
+    TRY_ASSIGN(auto track, analyzeLoudness(in_stream, packets, begin,
+                                           packets.size(),
+                                           options.num_threads));
+    auto subblock_size = static_cast<uint32_t>(std::lround(
+        in_sample_rate * utils_loudness::SUBBLOCK_DURATION));
+    auto gain = std::to_string(utils_loudness::toR128Gain(
+        utils_loudness::integratedLoudness({&track}, subblock_size)));
+    av_dict_set(&ofmt_ctx->metadata, "R128_TRACK_GAIN", gain.c_str(), 0);
+    av_dict_set(&ofmt_ctx->metadata, "R128_ALBUM_GAIN", gain.c_str(), 0);
+  }
+
+  // output stream
+  AVStream* out_stream = avformat_new_stream(ofmt_ctx, nullptr);
+  ASSERT(out_stream);
+  ASSERT_AV(avcodec_parameters_from_context(out_stream->codecpar,
+                                            header_encoder.codec_ctx_));
+  out_stream->time_base = sample_tb;
+
+  // stitch segments
+  ASSERT(avformat_write_header(ofmt_ctx, nullptr) >= 0);
+  for (auto& segment : segments) {
+    for (auto& packet : segment) {
+      packet->stream_index = out_stream->index;
+      av_packet_rescale_ts(packet, sample_tb, out_stream->time_base);
+      ASSERT(av_interleaved_write_frame(ofmt_ctx, packet) == 0);
+    }
+  }
+  ASSERT(av_interleaved_write_frame(ofmt_ctx, nullptr) == 0);
+  av_write_trailer(ofmt_ctx);
+  if (indexer) {
+    TRY(indexer->finish(output.output_));
+  }
+  return std::move(output.output_);
+}
+
+// demux to single stream
+utils::Result<std::vector<uint8_t>> convert(
+    const std::vector<uint8_t>& in_data,
+    const std::string& out_format,
+    const std::map<std::string, std::string>& metadata,
+    double start_time,  // -1 to indicate no value
+    double end_time,
+    const ConvertOptions& options) {
+  utils_memory::Scope memory_scope;
+  utils_progress::Scope progress_scope;
+  if (options.transcode) {
+    ASSERT(out_format == "opus");
+    // re-encoding cuts at any sample so that only the range is narrowed
+    if (options.auto_trim) {
+      TRY_ASSIGN(auto range,
+                 detectAudibleRange(in_data, start_time, end_time, options));
+      if (range.start_time >= 0) {
+        start_time = range.start_time;
+      }
+      if (range.end_time >= 0) {
+        end_time = range.end_time;
+      }
+    }
+    return transcode(in_data, metadata, start_time, end_time, options);
+  }
+  TRY_ASSIGN(auto outputs,
+             split(in_data, out_format,
+                   {SplitEntry{start_time, end_time, metadata}}, options));
+  return std::move(outputs[0]);
+}
+
+//
+// merge
+//
+
+// demuxer of single stream for merge and concat
+struct MergeInput {
+  BufferInput input_;
+  AVFormatContext* ifmt_ctx_ = nullptr;
+  AVStream* in_stream_ = nullptr;
+  AVStream* out_stream_ = nullptr;
+  AVPacket* pkt_ = nullptr;
+  bool has_packet_ = false;
+  // in "time base" unit of input stream (-1 to indicate no value)
+  int64_t start_time_tb_ = -1;
+  int64_t end_time_tb_ = -1;
+
+  ~MergeInput() {
+    av_packet_free(&pkt_);
+    avformat_close_input(&ifmt_ctx_);
+  }
+
+  // opened after construction so that destructor releases partially opened
+  // state on failure
+  utils::Result<void> initialize(const std::vector<uint8_t>& in_data,
+                                 AVMediaType media_type) {
+    TRY(input_.initialize(in_data));
+    ifmt_ctx_ = avformat_alloc_context();
+    ASSERT(ifmt_ctx_);
+    ifmt_ctx_->pb = input_.avio_ctx_;
+    ifmt_ctx_->flags |= AVFMT_FLAG_CUSTOM_IO;
+    ifmt_ctx_->interrupt_callback = {utils_progress::interruptCallback,
+                                     nullptr};
+    ASSERT(avformat_open_input(&ifmt_ctx_, NULL, NULL, NULL) == 0);
+    ASSERT(avformat_find_stream_info(ifmt_ctx_, NULL) == 0);
+    pkt_ = av_packet_alloc();
+    ASSERT(pkt_);
+    auto stream_index =
+        av_find_best_stream(ifmt_ctx_, media_type, -1, -1, NULL, 0);
+    ASSERT(stream_index >= 0);
+    utils_ffmpeg::discardOtherStreams(ifmt_ctx_, stream_index);
+    in_stream_ = ifmt_ctx_->streams[stream_index];
+    return {};
+  }
+
+  utils::Result<void> addOutputStream(AVFormatContext* ofmt_ctx) {
+    out_stream_ = avformat_new_stream(ofmt_ctx, nullptr);
+    ASSERT(out_stream_);
+    ASSERT(avcodec_parameters_copy(out_stream_->codecpar,
+                                   in_stream_->codecpar) >= 0);
+    // let muxer choose tag (e.g. matroska to mp4)
+    out_stream_->codecpar->codec_tag = 0;
+    out_stream_->time_base = in_stream_->time_base;
+    return {};
+  }
+
+  // seek to key frame at or before `time`
+  utils::Result<void> seek(double time) {
+    auto time_tb = SplitOutput::toTimeBase(time, in_stream_->time_base);
+    ASSERT_AV(av_seek_frame(ifmt_ctx_, in_stream_->index, time_tb,
+                            AVSEEK_FLAG_BACKWARD));
+    return {};
+  }
+
+  // read next packet of selected stream within the range into `pkt_`
+  utils::Result<bool> next() {
+    ASSERT(!has_packet_);
+    while (av_read_frame(ifmt_ctx_, pkt_) >= 0) {
+      if (pkt_->stream_index != in_stream_->index ||
+          (start_time_tb_ >= 0 && pkt_->pts != AV_NOPTS_VALUE &&
+           pkt_->pts < start_time_tb_)) {
+        av_packet_unref(pkt_);
+        continue;
+      }
+      if (end_time_tb_ >= 0 && pkt_->pts != AV_NOPTS_VALUE &&
+          pkt_->pts >= end_time_tb_) {
+        av_packet_unref(pkt_);
         break;
       }
+      has_packet_ = true;
+      return true;
+    }
+    // read error due to interruption is not end of input
+    TRY(utils_progress::check());
+    return false;
+  }
+
+  int64_t dts() const {
+    return pkt_->dts != AV_NOPTS_VALUE ? pkt_->dts : pkt_->pts;
+  }
+
+  double time() const {
+    auto ts = dts();
+    return ts == AV_NOPTS_VALUE ? 0 : ts * av_q2d(in_stream_->time_base);
+  }
+
+  // rebase timestamp and hand over packet to muxer
+  utils::Result<void> write(AVFormatContext* ofmt_ctx) {
+    ASSERT(has_packet_);
+    has_packet_ = false;
+    if (start_time_tb_ >= 0) {
+      if (pkt_->pts != AV_NOPTS_VALUE) {
+        pkt_->pts -= start_time_tb_;
+      }
+      if (pkt_->dts != AV_NOPTS_VALUE) {
+        pkt_->dts -= start_time_tb_;
+      }
     }
-    if (start_time >= 0) {
-      if (pkt->pts < start_time_tb) {
+    pkt_->stream_index = out_stream_->index;
+    pkt_->pos = -1;
+    av_packet_rescale_ts(pkt_, in_stream_->time_base, out_stream_->time_base);
+    // takes ownership of packet data and resets `pkt_`
+    ASSERT(av_interleaved_write_frame(ofmt_ctx, pkt_) == 0);
+    return {};
+  }
+};
+
+// mux video stream of `video_data` and audio stream of `audio_data` (e.g.
+// separate DASH representations) into single container without re-encoding.
+// start time is moved back to the key frame so that the output starts with
+// decodable video.
+utils::Result<std::vector<uint8_t>> merge(
+    const std::vector<uint8_t>& video_data,
+    const std::vector<uint8_t>& audio_data,
+    const std::string& out_format,
+    const std::map<std::string, std::string>& metadata,
+    double start_time,  // -1 to indicate no value
+    double end_time) {
+  utils_memory::Scope memory_scope;
+  utils_progress::Scope progress_scope;
+  if (start_time >= 0 && end_time >= 0) {
+    ASSERT(start_time <= end_time);
+  }
+
+  // inputs
+  MergeInput video;
+  MergeInput audio;
+  TRY(video.initialize(video_data, AVMEDIA_TYPE_VIDEO));
+  TRY(audio.initialize(audio_data, AVMEDIA_TYPE_AUDIO));
+  std::array<MergeInput*, 2> inputs = {&video, &audio};
+
+  // output context
+  auto oformat = av_guess_format(out_format.c_str(), NULL, NULL);
+  ASSERT(oformat);
+  ASSERT(oformat->audio_codec != AV_CODEC_ID_NONE &&
+         oformat->video_codec != AV_CODEC_ID_NONE);
+  BufferOutput output;
+  TRY(output.initialize());
+  AVFormatContext* ofmt_ctx = nullptr;
+  avformat_alloc_output_context2(&ofmt_ctx, oformat, NULL, NULL);
+  ASSERT(ofmt_ctx);
+  DEFER {
+    avformat_free_context(ofmt_ctx);
+  };
+  ofmt_ctx->pb = output.avio_ctx_;
+  for (auto& [k, v] : metadata) {
+    av_dict_set(&ofmt_ctx->metadata, k.c_str(), v.c_str(), 0);
+  }
+  for (auto input : inputs) {
+    TRY(input->addOutputStream(ofmt_ctx));
+  }
+
+  for (auto input : inputs) {
+    input->end_time_tb_ =
+        SplitOutput::toTimeBase(end_time, input->in_stream_->time_base);
+  }
+
+  // resolve start time from the first video key frame after seeking
+  if (start_time >= 0) {
+    TRY(video.seek(start_time));
+  }
+  while (true) {
+    TRY_ASSIGN(bool has_packet, video.next());
+    if (!has_packet || (video.pkt_->flags & AV_PKT_FLAG_KEY)) {
+      break;
+    }
+    av_packet_unref(video.pkt_);
+    video.has_packet_ = false;
+  }
+  if (start_time >= 0) {
+    if (video.has_packet_ && video.pkt_->pts != AV_NOPTS_VALUE) {
+      start_time = video.pkt_->pts * av_q2d(video.in_stream_->time_base);
+    }
+    TRY(audio.seek(start_time));
+    for (auto input : inputs) {
+      input->start_time_tb_ =
+          SplitOutput::toTimeBase(start_time, input->in_stream_->time_base);
+    }
+  }
+  TRY(audio.next());
+
+  // progress by output time and bytes of both inputs
+  double offset = std::max(start_time, 0.0);
+  double total_time =
+      std::max<int64_t>(video.ifmt_ctx_->duration, audio.ifmt_ctx_->duration);
+  total_time = std::max(total_time, 0.0) / AV_TIME_BASE;
+  if (end_time >= 0) {
+    total_time = end_time;
+  }
+  utils_progress::setTotal(std::max(total_time - offset, 0.0),
+                           video_data.size() + audio_data.size());
+
+  // interleave by dts so that muxer only holds a few packets
+  ASSERT(avformat_write_header(ofmt_ctx, nullptr) >= 0);
+  while (video.has_packet_ || audio.has_packet_) {
+    MergeInput* input = &video;
+    if (!video.has_packet_ ||
+        (audio.has_packet_ &&
+         av_compare_ts(audio.dts(), audio.in_stream_->time_base, video.dts(),
+                       video.in_stream_->time_base) < 0)) {
+      input = &audio;
+    }
+    TRY(utils_progress::update(
+        std::max(input->time() - offset, 0.0),
+        video.input_.input_pos_ + audio.input_.input_pos_));
+    TRY(input->write(ofmt_ctx));
+    TRY(input->next());
+  }
+  ASSERT(av_interleaved_write_frame(ofmt_ctx, nullptr) == 0);
+  ASSERT(av_write_trailer(ofmt_ctx) == 0);
+  return std::move(output.output_);
+}
+
+//
+// concat
+//
+
+// ogg family muxers whose outputs can be chained (cf. utils_ogg::Chain)
+bool isOggFormat(const AVOutputFormat* oformat) {
+  for (auto name : {"ogg", "oga", "opus", "spx"}) {
+    if (std::strcmp(oformat->name, name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// samples of `pkt` before discard padding. opus is counted from its TOC
+// since demuxer may already shorten duration of the last packet (e.g. ogg).
+int64_t packetSamples(const AVPacket* pkt, const AVCodecParameters* codecpar) {
+  if (codecpar->codec_id == AV_CODEC_ID_OPUS &&
+      codecpar->sample_rate == 48000) {
+    auto samples = utils_ogg::opusPacketSamples(pkt->data, pkt->size);
+    if (samples > 0) {
+      return samples;
+    }
+  }
+  return pkt->duration;
+}
+
+// muxer of concat output (or of each link of chained ogg)
+struct ConcatOutput {
+  BufferOutput output_;
+  AVFormatContext* ofmt_ctx_ = nullptr;
+  AVStream* out_stream_ = nullptr;
+
+  ~ConcatOutput() {
+    if (ofmt_ctx_) {
+      avformat_free_context(ofmt_ctx_);
+    }
+  }
+
+  // header (e.g. pre-skip) from `codecpar`
+  utils::Result<void> initialize(
+      const AVOutputFormat* oformat,
+      const AVCodecParameters* codecpar,
+      const std::map<std::string, std::string>& metadata) {
+    TRY(output_.initialize());
+    avformat_alloc_output_context2(&ofmt_ctx_, oformat, NULL, NULL);
+    ASSERT(ofmt_ctx_);
+    ofmt_ctx_->pb = output_.avio_ctx_;
+    for (auto& [k, v] : metadata) {
+      av_dict_set(&ofmt_ctx_->metadata, k.c_str(), v.c_str(), 0);
+    }
+    out_stream_ = avformat_new_stream(ofmt_ctx_, nullptr);
+    ASSERT(out_stream_);
+    ASSERT(avcodec_parameters_copy(out_stream_->codecpar, codecpar) >= 0);
+    out_stream_->codecpar->codec_tag = 0;
+    out_stream_->time_base = {1, codecpar->sample_rate};
+    ASSERT(avformat_write_header(ofmt_ctx_, nullptr) >= 0);
+    return {};
+  }
+
+  utils::Result<std::vector<uint8_t>> finish() {
+    ASSERT(av_interleaved_write_frame(ofmt_ctx_, nullptr) == 0);
+    ASSERT(av_write_trailer(ofmt_ctx_) == 0);
+    return std::move(output_.output_);
+  }
+};
+
+// join audio of inputs with same codec parameters by stream copy without gap
+// or overlap at joins. each input starts with its own decoder priming (e.g.
+// 312 samples of opus pre-skip) and may end with trimmed samples, so that
+// ogg output chains one logical stream per input (cf. utils_ogg::Chain)
+// where each link keeps its own pre-skip and final granule position. other
+// containers share single timeline where each input is appended to the end
+// of the previous one. since it can only discard priming at the start of
+// whole stream, inner inputs with pre-skip are rejected, and so is their end
+// trimming unless carried as matroska DiscardPadding. metadata is merged in
+// input order with `metadata` taking precedence (written to every link).
+utils::Result<std::vector<uint8_t>> concat(
+    const std::vector<std::vector<uint8_t>>& inputs,
+    const std::string& out_format,
+    const std::map<std::string, std::string>& metadata) {
+  utils_memory::Scope memory_scope;
+  utils_progress::Scope progress_scope;
+  ASSERT(!inputs.empty());
+
+  // output format
+  auto oformat = av_guess_format(out_format.c_str(), NULL, NULL);
+  ASSERT(oformat);
+  ASSERT(oformat->audio_codec != AV_CODEC_ID_NONE);
+  bool chained = isOggFormat(oformat);
+  bool keep_discard_padding = std::strcmp(oformat->name, "webm") == 0 ||
+                              std::strcmp(oformat->name, "matroska") == 0;
+
+  // open every input upfront so that the first header has merged metadata
+  // (earlier input wins, including tags of ogg stream)
+  std::vector<std::unique_ptr<MergeInput>> opened;
+  auto merged = metadata;
+  for (auto& in_data : inputs) {
+    auto& input = opened.emplace_back(std::make_unique<MergeInput>());
+    TRY(input->initialize(in_data, AVMEDIA_TYPE_AUDIO));
+    auto in_stream = input->in_stream_;
+    for (auto dict : {input->ifmt_ctx_->metadata, in_stream->metadata}) {
+      for (auto& [k, v] : utils_ffmpeg::mapFromAVDictionary(dict)) {
+        if (k != "encoder") {
+          merged.emplace(k, v);
+        }
+      }
+    }
+    auto first = opened.front()->in_stream_->codecpar;
+    auto in_codecpar = in_stream->codecpar;
+    ASSERT(in_codecpar->codec_id == first->codec_id);
+    ASSERT(in_codecpar->sample_rate == first->sample_rate);
+    ASSERT(in_codecpar->ch_layout.nb_channels ==
+           first->ch_layout.nb_channels);
+    // priming of inner input is only discarded by pre-skip of its own link
+    ASSERT(chained || &input == &opened.front() ||
+           in_codecpar->initial_padding == 0);
+  }
+
+  size_t total_bytes = 0;
+  for (auto& in_data : inputs) {
+    total_bytes += in_data.size();
+  }
+  utils_progress::setTotal(0, total_bytes);
+  size_t read_bytes = 0;
+
+  std::optional<ConcatOutput> output;
+  utils_ogg::Chain chain;
+  AVRational sample_tb{1, opened.front()->in_stream_->codecpar->sample_rate};
+  // end of output timeline in `sample_tb`
+  int64_t offset = 0;
+  for (size_t i = 0; i < opened.size(); i++) {
+    auto& input = *opened[i];
+    auto in_stream = input.in_stream_;
+    bool is_last = i + 1 == opened.size();
+    // each link of chained ogg starts its own timeline
+    bool new_timeline = i == 0 || chained;
+    if (new_timeline) {
+      TRY(output.emplace().initialize(oformat, in_stream->codecpar, merged));
+    }
+
+    // rebase packets so that this input starts at the end of previous one
+    std::optional<int64_t> first_pts;
+    int64_t end = offset;
+    while (true) {
+      TRY_ASSIGN(bool has_packet, input.next());
+      if (!has_packet) {
+        break;
+      }
+      auto pkt = input.pkt_;
+      DEFER {
         av_packet_unref(pkt);
-        continue;
+        input.has_packet_ = false;
+      };
+      ASSERT(pkt->pts != AV_NOPTS_VALUE);
+      av_packet_rescale_ts(pkt, in_stream->time_base, sample_tb);
+      if (!first_pts) {
+        first_pts = pkt->pts;
+        // keep timeline of the link as is (e.g. negative pre-skip)
+        if (new_timeline) {
+          offset = end = pkt->pts;
+        }
       }
-      pkt->pts -= start_time_tb;
-      pkt->dts -= start_time_tb;
+      int64_t shift = offset - first_pts.value();
+      pkt->pts += shift;
+      if (pkt->dts != AV_NOPTS_VALUE) {
+        pkt->dts += shift;
+      }
+      int64_t samples = packetSamples(pkt, in_stream->codecpar);
+      int64_t padding = discardPadding(pkt);
+      if (padding > 0) {
+        // inner end trimming is kept by final granule of link (ogg) or
+        // DiscardPadding (matroska)
+        ASSERT(is_last || chained || keep_discard_padding);
+        if (chained) {
+          pkt->duration = std::max<int64_t>(samples - padding, 0);
+        }
+      }
+      end = std::max(end, pkt->pts + samples - padding);
+      TRY(utils_progress::update(
+          static_cast<double>(pkt->pts) / sample_tb.den,
+          read_bytes + input.input_.input_pos_));
+      pkt->stream_index = output->out_stream_->index;
+      pkt->pos = -1;
+      av_packet_rescale_ts(pkt, sample_tb, output->out_stream_->time_base);
+      ASSERT(av_interleaved_write_frame(output->ofmt_ctx_, pkt) == 0);
+    }
+    offset = end;
+    read_bytes += inputs[i].size();
+    if (chained) {
+      TRY_ASSIGN(auto link, output->finish());
+      TRY(chain.append(std::move(link)));
     }
-    pkt->stream_index = out_stream->index;
-    av_packet_rescale_ts(pkt, in_stream->time_base, out_stream->time_base);
-    ASSERT(av_interleaved_write_frame(ofmt_ctx_, pkt) == 0);
-    av_packet_unref(pkt);
   }
-  ASSERT(av_interleaved_write_frame(ofmt_ctx_, nullptr) == 0);
 
-  // write trailer
-  av_write_trailer(ofmt_ctx_);
+  if (chained) {
+    return std::move(chain.output_);
+  }
+  return output->finish();
+}
+
+// min/max/rms peaks of decoded audio (cf. utils_peaks::PeakBuilder)
+utils::Result<std::vector<uint8_t>> waveform(
+    const std::vector<uint8_t>& in_data,
+    uint32_t samples_per_bucket) {
+  utils_memory::Scope memory_scope;
+  utils_progress::Scope progress_scope;
+  ASSERT(samples_per_bucket > 0);
+
+  // input context
+  BufferInput input_;
+  TRY(input_.initialize(in_data));
+  AVFormatContext* ifmt_ctx_ = avformat_alloc_context();
+  ASSERT(ifmt_ctx_);
+  DEFER {
+    avformat_close_input(&ifmt_ctx_);
+  };
+  ifmt_ctx_->pb = input_.avio_ctx_;
+  ifmt_ctx_->flags |= AVFMT_FLAG_CUSTOM_IO;
+  ifmt_ctx_->interrupt_callback = {utils_progress::interruptCallback, nullptr};
+
+  ASSERT(avformat_open_input(&ifmt_ctx_, NULL, NULL, NULL) == 0);
+  ASSERT(avformat_find_stream_info(ifmt_ctx_, NULL) == 0);
 
-  // return vector
-  return output_.output_;
+  // input stream
+  auto stream_index =
+      av_find_best_stream(ifmt_ctx_, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+  ASSERT(stream_index >= 0);
+  utils_ffmpeg::discardOtherStreams(ifmt_ctx_, stream_index);
+  AVStream* in_stream = ifmt_ctx_->streams[stream_index];
+  ASSERT(in_stream);
+
+  // allocate AVPacket
+  AVPacket* pkt = av_packet_alloc();
+  ASSERT(pkt);
+  DEFER {
+    av_packet_free(&pkt);
+  };
+
+  // decode and reduce
+  utils_progress::setTotal(
+      std::max<double>(ifmt_ctx_->duration, 0) / AV_TIME_BASE, in_data.size());
+  double last_time = 0;
+  utils_ffmpeg::Decoder decoder;
+  TRY(decoder.initialize(in_stream));
+  utils_peaks::PeakBuilder builder{samples_per_bucket};
+  auto on_frame = [&](AVFrame* frame) -> utils::Result<void> {
+    ASSERT(frame->format == AV_SAMPLE_FMT_FLTP);
+    builder.process(reinterpret_cast<const float* const*>(frame->data),
+                    frame->ch_layout.nb_channels, frame->nb_samples);
+    return {};
+  };
+  while (av_read_frame(ifmt_ctx_, pkt) >= 0) {
+    DEFER {
+      av_packet_unref(pkt);
+    };
+    if (pkt->stream_index != stream_index) {
+      continue;
+    }
+    if (pkt->pts != AV_NOPTS_VALUE) {
+      last_time = pkt->pts * av_q2d(in_stream->time_base);
+    }
+    TRY(utils_progress::update(last_time, input_.input_pos_));
+    TRY(decoder.decode(pkt, on_frame));
+  }
+  TRY(utils_progress::check());
+  TRY(decoder.decode(nullptr, on_frame));
+  return builder.finish();
 }
 
-std::string extractMetadata(const std::vector<uint8_t>& in_data) {
+struct StreamInfo {
+  std::optional<std::string> type;  // e.g. audio, video
+  std::optional<std::string> codec;  // e.g. opus
+  std::map<std::string, std::string> metadata;
+};
+
+struct FormatInfo {
+  std::string format_name;  // e.g. ogg
+  int64_t duration;
+  int64_t bit_rate;
+  std::map<std::string, std::string> metadata;
+  std::vector<StreamInfo> streams;
+};
+
+utils::Result<FormatInfo> extractFormatInfo(
+    const std::vector<uint8_t>& in_data) {
+  utils_memory::Scope memory_scope;
+  utils_progress::Scope progress_scope;
+
   // input context
-  BufferInput input_{in_data};
+  BufferInput input_;
+  TRY(input_.initialize(in_data));
   AVFormatContext* ifmt_ctx_ = avformat_alloc_context();
   ASSERT(ifmt_ctx_);
   DEFER {
@@ -150,36 +1678,57 @@ std::string extractMetadata(const std::vector<uint8_t>& in_data) {
   };
   ifmt_ctx_->pb = input_.avio_ctx_;
   ifmt_ctx_->flags |= AVFMT_FLAG_CUSTOM_IO;
+  ifmt_ctx_->interrupt_callback = {utils_progress::interruptCallback, nullptr};
 
   ASSERT(avformat_open_input(&ifmt_ctx_, NULL, NULL, NULL) == 0);
   ASSERT(avformat_find_stream_info(ifmt_ctx_, NULL) == 0);
 
-  auto result = nlohmann::json::object(
-      {{"format_name", ifmt_ctx_->iformat->name},
-       {"duration", ifmt_ctx_->duration},
-       {"bit_rate", ifmt_ctx_->bit_rate},
-       {"metadata", utils_ffmpeg::mapFromAVDictionary(ifmt_ctx_->metadata)},
-       {"streams", nlohmann::json::array()}});
+  FormatInfo result;
+  result.format_name = ifmt_ctx_->iformat->name;
+  result.duration = ifmt_ctx_->duration;
+  result.bit_rate = ifmt_ctx_->bit_rate;
+  result.metadata = utils_ffmpeg::mapFromAVDictionary(ifmt_ctx_->metadata);
 
   for (unsigned int i = 0; i < ifmt_ctx_->nb_streams; i++) {
     auto stream = ifmt_ctx_->streams[i];
-    auto streamInfo = nlohmann::json::object(
-        {{"type", nullptr},
-         {"codec", nullptr},
-         {"metadata", utils_ffmpeg::mapFromAVDictionary(stream->metadata)}});
+    auto& stream_info = result.streams.emplace_back();
+    stream_info.metadata = utils_ffmpeg::mapFromAVDictionary(stream->metadata);
 
     const AVCodec* codec = avcodec_find_decoder(stream->codecpar->codec_id);
     if (codec) {
-      streamInfo["codec"] = codec->name;
-      auto type_string =
-          codec ? av_get_media_type_string(codec->type) : nullptr;
+      stream_info.codec = codec->name;
+      auto type_string = av_get_media_type_string(codec->type);
       if (type_string) {
-        streamInfo["type"] = type_string;
+        stream_info.type = type_string;
       }
     }
-    result["streams"].push_back(streamInfo);
   }
 
+  return result;
+}
+
+// json for cli (cf. embind_extractMetadata for js object)
+utils::Result<std::string> extractMetadata(
+    const std::vector<uint8_t>& in_data) {
+  TRY_ASSIGN(auto info, extractFormatInfo(in_data));
+  auto result = nlohmann::json::object({{"format_name", info.format_name},
+                                        {"duration", info.duration},
+                                        {"bit_rate", info.bit_rate},
+                                        {"metadata", info.metadata},
+                                        {"streams", nlohmann::json::array()}});
+  for (auto& stream_info : info.streams) {
+    auto stream = nlohmann::json::object(
+        {{"type", nullptr},
+         {"codec", nullptr},
+         {"metadata", stream_info.metadata}});
+    if (stream_info.type) {
+      stream["type"] = stream_info.type.value();
+    }
+    if (stream_info.codec) {
+      stream["codec"] = stream_info.codec.value();
+    }
+    result["streams"].push_back(stream);
+  }
   return result.dump(2);
 }
 
@@ -1,9 +1,39 @@
+#include <csignal>
 #include <cstring>
 #include <optional>
 #include "ex00-impl.hpp"
+#include "utils-memory.hpp"
+#include "utils-ogg.hpp"
+#include "utils-progress.hpp"
 #include "utils.hpp"
 
-int mainConvert(utils::Cli& cli) {
+utils::Result<std::string> encodeThumbnail(const std::string& filename) {
+  TRY_ASSIGN(auto encoded,
+             utils::Subprocess::checkOutput(
+                 "node ../flac-picture/bin/cli.js < " + filename));
+  return std::string(encoded.begin(), encoded.end());
+}
+
+ex00_impl::ConvertOptions parseConvertOptions(utils::Cli& cli) {
+  ex00_impl::ConvertOptions options;
+  options.loudness_gain =
+      cli.argument<std::string>("--loudness-gain").value_or("false") == "true";
+  options.num_threads = cli.argument<int>("--num-threads").value_or(0);
+  options.transcode =
+      cli.argument<std::string>("--transcode").value_or("false") == "true";
+  options.bit_rate = cli.argument<int>("--bit-rate").value_or(0);
+  options.seek_index_interval =
+      cli.argument<double>("--seek-index-interval").value_or(0);
+  options.auto_trim =
+      cli.argument<std::string>("--auto-trim").value_or("false") == "true";
+  options.silence_threshold =
+      cli.argument<double>("--silence-threshold").value_or(-50);
+  options.auto_trim_window =
+      cli.argument<double>("--auto-trim-window").value_or(10);
+  return options;
+}
+
+utils::Result<void> mainConvert(utils::Cli& cli) {
   auto in_file = cli.argument<std::string>("--in");
   auto out_file = cli.argument<std::string>("--out");
   auto out_format = cli.argument<std::string>("--out-format");
@@ -15,7 +45,7 @@ int mainConvert(utils::Cli& cli) {
   ASSERT(in_file && out_file && out_format);
 
   // read data
-  auto in_data = utils::readFile(in_file.value());
+  TRY_ASSIGN(auto in_data, utils::readFile(in_file.value()));
 
   // metadata
   std::map<std::string, std::string> metadata;
@@ -26,43 +56,271 @@ int mainConvert(utils::Cli& cli) {
     metadata["artist"] = artist.value();
   }
   if (thumbnail) {
-    auto encoded = utils::Subprocess::checkOutput(
-        "node ../flac-picture/bin/cli.js < test.jpg");
-    metadata["METADATA_BLOCK_PICTURE"] =
-        std::string(encoded.begin(), encoded.end());
+    TRY_ASSIGN(metadata["METADATA_BLOCK_PICTURE"],
+               encodeThumbnail(thumbnail.value()));
   }
 
   // process
-  auto output = ex00_impl::convert(in_data, out_format.value(), metadata,
-                                   start_time, end_time);
+  TRY_ASSIGN(auto output,
+             ex00_impl::convert(in_data, out_format.value(), metadata,
+                                start_time, end_time,
+                                parseConvertOptions(cli)));
 
   // write data
-  utils::writeFile(out_file.value(), output);
-  return 0;
+  TRY(utils::writeFile(out_file.value(), output));
+  return {};
+}
+
+// tracks file is a json array of
+//   { "out": string, "start_time"?: number, "end_time"?: number,
+//     "title"?: string, "artist"?: string, "thumbnail"?: string }
+utils::Result<void> mainSplit(utils::Cli& cli) {
+  auto in_file = cli.argument<std::string>("--in");
+  auto out_format = cli.argument<std::string>("--out-format");
+  auto tracks_file = cli.argument<std::string>("--tracks");
+  ASSERT(in_file && out_format && tracks_file);
+
+  // read data
+  TRY_ASSIGN(auto in_data, utils::readFile(in_file.value()));
+  TRY_ASSIGN(auto tracks_data, utils::readFile(tracks_file.value()));
+  // parsed without exceptions and validated before typed access
+  auto tracks = nlohmann::json::parse(tracks_data, nullptr, false);
+  ASSERT(!tracks.is_discarded() && tracks.is_array());
+
+  // entries
+  std::vector<std::string> out_files;
+  std::vector<ex00_impl::SplitEntry> entries;
+  for (auto& track : tracks) {
+    ASSERT(track.is_object());
+    ASSERT(track.contains("out") && track.at("out").is_string());
+    for (auto key : {"start_time", "end_time"}) {
+      ASSERT(!track.contains(key) || track.at(key).is_number());
+    }
+    for (auto key : {"title", "artist", "thumbnail"}) {
+      ASSERT(!track.contains(key) || track.at(key).is_string());
+    }
+    out_files.push_back(track.at("out").get<std::string>());
+    auto& entry = entries.emplace_back();
+    entry.start_time = track.value("start_time", -1.0);
+    entry.end_time = track.value("end_time", -1.0);
+    for (auto key : {"title", "artist"}) {
+      if (track.contains(key)) {
+        entry.metadata[key] = track.at(key).get<std::string>();
+      }
+    }
+    if (track.contains("thumbnail")) {
+      TRY_ASSIGN(entry.metadata["METADATA_BLOCK_PICTURE"],
+                 encodeThumbnail(track.at("thumbnail").get<std::string>()));
+    }
+  }
+
+  // process
+  TRY_ASSIGN(auto outputs,
+             ex00_impl::split(in_data, out_format.value(), entries,
+                              parseConvertOptions(cli)));
+
+  // write data
+  for (size_t i = 0; i < outputs.size(); i++) {
+    TRY(utils::writeFile(out_files[i], outputs[i]));
+  }
+  return {};
 }
 
-int mainExtractMetadata(utils::Cli& cli) {
+utils::Result<void> mainWaveform(utils::Cli& cli) {
+  auto in_file = cli.argument<std::string>("--in");
+  auto out_file = cli.argument<std::string>("--out");
+  auto samples_per_bucket =
+      cli.argument<uint32_t>("--samples-per-bucket").value_or(4800);
+  ASSERT(in_file && out_file);
+
+  // read data
+  TRY_ASSIGN(auto in_data, utils::readFile(in_file.value()));
+
+  // process
+  TRY_ASSIGN(auto output, ex00_impl::waveform(in_data, samples_per_bucket));
+
+  // write data
+  TRY(utils::writeFile(out_file.value(), output));
+  return {};
+}
+
+utils::Result<void> mainExtractMetadata(utils::Cli& cli) {
   auto in_file = cli.argument<std::string>("--in");
   ASSERT(in_file);
 
   // read data
-  auto in_data = utils::readFile(in_file.value());
+  TRY_ASSIGN(auto in_data, utils::readFile(in_file.value()));
 
   // process
-  auto metadata = ex00_impl::extractMetadata(in_data);
+  TRY_ASSIGN(auto metadata, ex00_impl::extractMetadata(in_data));
   std::cout << metadata << std::endl;
-  return 0;
+  return {};
 }
 
-int main(int argc, const char* argv[]) {
-  utils::Cli cli{argc, argv};
-  ASSERT(argc >= 2);
-  std::string command(argv[1]);
+// e.g. video-only and audio-only webm into single webm
+utils::Result<void> mainMerge(utils::Cli& cli) {
+  auto video_file = cli.argument<std::string>("--video");
+  auto audio_file = cli.argument<std::string>("--audio");
+  auto out_file = cli.argument<std::string>("--out");
+  auto out_format = cli.argument<std::string>("--out-format");
+  auto title = cli.argument<std::string>("--title");
+  auto artist = cli.argument<std::string>("--artist");
+  auto start_time = cli.argument<double>("--start-time").value_or(-1);
+  auto end_time = cli.argument<double>("--end-time").value_or(-1);
+  ASSERT(video_file && audio_file && out_file && out_format);
+
+  // read data
+  TRY_ASSIGN(auto video_data, utils::readFile(video_file.value()));
+  TRY_ASSIGN(auto audio_data, utils::readFile(audio_file.value()));
+
+  // metadata
+  std::map<std::string, std::string> metadata;
+  if (title) {
+    metadata["title"] = title.value();
+  }
+  if (artist) {
+    metadata["artist"] = artist.value();
+  }
+
+  // process
+  TRY_ASSIGN(auto output,
+             ex00_impl::merge(video_data, audio_data, out_format.value(),
+                              metadata, start_time, end_time));
+
+  // write data
+  TRY(utils::writeFile(out_file.value(), output));
+  return {};
+}
+
+// e.g. --in 01.opus --in 02.opus --in 03.opus
+utils::Result<void> mainConcat(utils::Cli& cli) {
+  auto in_files = cli.arguments<std::string>("--in");
+  auto out_file = cli.argument<std::string>("--out");
+  auto out_format = cli.argument<std::string>("--out-format");
+  auto title = cli.argument<std::string>("--title");
+  auto artist = cli.argument<std::string>("--artist");
+  ASSERT(!in_files.empty() && out_file && out_format);
+
+  // read data
+  std::vector<std::vector<uint8_t>> inputs;
+  for (auto& in_file : in_files) {
+    TRY_ASSIGN(auto in_data, utils::readFile(in_file));
+    inputs.push_back(std::move(in_data));
+  }
+
+  // metadata
+  std::map<std::string, std::string> metadata;
+  if (title) {
+    metadata["title"] = title.value();
+  }
+  if (artist) {
+    metadata["artist"] = artist.value();
+  }
+
+  // process
+  TRY_ASSIGN(auto output,
+             ex00_impl::concat(inputs, out_format.value(), metadata));
+
+  // write data
+  TRY(utils::writeFile(out_file.value(), output));
+  return {};
+}
+
+// rewrite tags of ogg opus without re-encoding (empty value removes key)
+utils::Result<void> mainUpdateTags(utils::Cli& cli) {
+  auto in_file = cli.argument<std::string>("--in");
+  auto out_file = cli.argument<std::string>("--out");
+  auto thumbnail = cli.argument<std::string>("--thumbnail");
+  auto title = cli.argument<std::string>("--title");
+  auto artist = cli.argument<std::string>("--artist");
+  ASSERT(in_file && out_file);
+
+  // read data
+  TRY_ASSIGN(auto in_data, utils::readFile(in_file.value()));
+
+  // metadata
+  std::map<std::string, std::string> metadata;
+  if (title) {
+    metadata["title"] = title.value();
+  }
+  if (artist) {
+    metadata["artist"] = artist.value();
+  }
+  if (thumbnail) {
+    TRY_ASSIGN(metadata["METADATA_BLOCK_PICTURE"],
+               encodeThumbnail(thumbnail.value()));
+  }
+
+  // process
+  TRY_ASSIGN(auto output, utils_ogg::updateTags(in_data, metadata));
+
+  // write data
+  TRY(utils::writeFile(out_file.value(), output));
+  return {};
+}
+
+utils::Result<void> mainCommand(utils::Cli& cli,
+                                const std::string& command) {
   if (command == "convert") {
     return mainConvert(cli);
   }
+  if (command == "split") {
+    return mainSplit(cli);
+  }
+  if (command == "waveform") {
+    return mainWaveform(cli);
+  }
   if (command == "extract-metadata") {
     return mainExtractMetadata(cli);
   }
-  return -1;
+  if (command == "merge") {
+    return mainMerge(cli);
+  }
+  if (command == "concat") {
+    return mainConcat(cli);
+  }
+  if (command == "update-tags") {
+    return mainUpdateTags(cli);
+  }
+  return utils::Error{"cli", "unknown command: " + command};
+}
+
+int main(int argc, const char* argv[]) {
+  utils::Cli cli{argc, argv};
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " <command> [--flag value]..."
+              << std::endl;
+    return 1;
+  }
+  std::string command(argv[1]);
+
+  // e.g. --memory-budget $((64 << 20)) --memory-stats true --arena true
+  utils_memory::setBudget(cli.argument<size_t>("--memory-budget").value_or(0));
+  utils_memory::setArena(
+      cli.argument<std::string>("--arena").value_or("false") == "true");
+  // e.g. --deadline 10 --progress true (SIGINT cancels running operation)
+  utils_progress::setDeadline(cli.argument<double>("--deadline").value_or(0));
+  if (cli.argument<std::string>("--progress").value_or("false") == "true") {
+    utils_progress::setCallback([](const utils_progress::Progress& progress) {
+      std::cerr << utils_progress::formatProgress(progress) << std::endl;
+      return true;
+    });
+  }
+  utils_progress::cancelOnSignal(SIGINT);
+  auto result = mainCommand(cli, command);
+  // e.g. memory budget exceeded after the operation's last check
+  auto failure = utils_progress::takeFailure();
+  if (result.ok() && !failure.ok()) {
+    result = failure;
+  }
+  if (cli.argument<std::string>("--memory-stats").value_or("false") ==
+      "true") {
+    std::cerr << utils_memory::formatStats(utils_memory::lastStats())
+              << std::endl;
+  }
+  if (!result.ok()) {
+    std::cerr << utils::formatError(result.error()) << std::endl;
+    return 1;
+  }
+  return 0;
 }
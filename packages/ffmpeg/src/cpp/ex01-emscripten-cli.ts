@@ -36,8 +36,7 @@ const parseMetadata = tinycli(
     }
 
     // process
-    const outData = Module.embind_parseMetadataWrapper(inData);
-    const metadata: SimpleMetadata = JSON.parse(outData);
+    const metadata = parseSimpleMetadata(inData);
     console.log(metadata);
   }
 );
@@ -50,14 +49,27 @@ const remux = tinycli(
     startTime: z.preprocess(Number, z.number()).optional(),
     endTime: z.preprocess(Number, z.number()).optional(),
     fixTimestamp: z.enum(["true", "false"]).default("true"),
+    // payload of other tracks is skipped (-1 for all tracks)
+    trackNumber: z.preprocess(Number, z.number().int()).default(-1),
+    memoryBudget: z.preprocess(Number, z.number().int()).default(0),
+    arena: z.enum(["true", "false"]).default("false"),
+    deadline: z.preprocess(Number, z.number()).default(0),
+    progress: z.enum(["true", "false"]).default("false"),
   }),
   async (args) => {
     await initModule(args.module);
+    Module.embind_setMemoryBudget(args.memoryBudget);
+    Module.embind_setArena(args.arena === "true");
+    Module.embind_setDeadline(args.deadline);
+    if (args.progress === "true") {
+      Module.embind_setProgressCallback((progress) => {
+        console.error(progress);
+      });
+    }
 
     // read metadata
     const inData = await readFile(args.in);
-    const outData = Module.embind_parseMetadataWrapper(inData);
-    const metadata: SimpleMetadata = JSON.parse(outData);
+    const metadata = parseSimpleMetadata(inData);
 
     // compute containing range
     const cueRange = findContainingRange(
@@ -78,7 +90,86 @@ const remux = tinycli(
     const output = Module.embind_remuxWrapper(
       inData,
       frameData,
-      args.fixTimestamp === "true"
+      args.fixTimestamp === "true",
+      args.trackNumber
+    );
+    console.log(Module.embind_lastMemoryStats());
+    await fs.promises.writeFile(args.out, output.view());
+  }
+);
+
+const waveform = tinycli(
+  z.object({
+    module: z.string().default(DEFAULT_MODULE_PATH),
+    in: z.string(),
+    out: z.string(),
+    startTime: z.preprocess(Number, z.number()).optional(),
+    endTime: z.preprocess(Number, z.number()).optional(),
+    samplesPerBucket: z.preprocess(Number, z.number().int()).default(4800),
+  }),
+  async (args) => {
+    await initModule(args.module);
+
+    // read metadata
+    const inData = await readFile(args.in);
+    const metadata = parseSimpleMetadata(inData);
+
+    // push only clusters covering the range
+    const cueRange = findContainingRange(
+      metadata,
+      args.startTime,
+      args.endTime
+    );
+    const builder = new Module.embind_WaveformBuilder(
+      inData,
+      args.samplesPerBucket
+    );
+    const frameData = new Module.embind_Vector();
+    const sliceArray = inData
+      .view()
+      .slice(cueRange.startByte, cueRange.endByte);
+    frameData.resize(sliceArray.length, 0);
+    frameData.view().set(sliceArray);
+    builder.push(frameData);
+
+    // process
+    const output = builder.finish();
+    console.log({ startTime: builder.startTime() });
+    await fs.promises.writeFile(args.out, output.view());
+  }
+);
+
+const thumbnail = tinycli(
+  z.object({
+    module: z.string().default(DEFAULT_MODULE_PATH),
+    in: z.string(),
+    out: z.string(),
+    time: z.preprocess(Number, z.number()).default(0),
+    width: z.preprocess(Number, z.number().int()).default(0),
+  }),
+  async (args) => {
+    await initModule(args.module);
+
+    // read metadata and slice single cluster
+    const inData = await readFile(args.in);
+    const range = Module.embind_findThumbnailCluster(inData, args.time);
+    console.log(range);
+    const clusterData = new Module.embind_Vector();
+    const sliceArray = inData
+      .view()
+      .slice(
+        range.start_byte,
+        range.end_byte >= 0 ? range.end_byte : undefined
+      );
+    clusterData.resize(sliceArray.length, 0);
+    clusterData.view().set(sliceArray);
+
+    // process
+    const output = Module.embind_extractThumbnail(
+      inData,
+      clusterData,
+      args.time,
+      args.width
     );
     await fs.promises.writeFile(args.out, output.view());
   }
@@ -96,6 +187,22 @@ async function readFile(filename: string): Promise<EmbindVector> {
   return vector;
 }
 
+// copy cue columns out of wasm memory
+function parseSimpleMetadata(data: EmbindVector): SimpleMetadata {
+  const parsed = new Module.embind_ParsedMetadata(data);
+  try {
+    const segmentBodyStart = parsed.segmentBodyStart();
+    return {
+      segment_body_start: segmentBodyStart >= 0 ? segmentBodyStart : undefined,
+      track_entries: parsed.trackEntries(),
+      cue_time: parsed.cueTime().slice(),
+      cue_cluster_position: parsed.cueClusterPosition().slice(),
+    };
+  } finally {
+    parsed.delete();
+  }
+}
+
 interface ContainingRange {
   // byte offset of containing clusters
   startByte: number;
@@ -112,22 +219,28 @@ function findContainingRange(
   tinyassert(metadata.segment_body_start);
   tinyassert(metadata.track_entries.length === 1);
 
-  interface StrictCuePont {
-    time: number;
-    cluster_position: number;
+  // cue index of last cue at or before `startTime` and first cue after `endTime`
+  const times = metadata.cue_time;
+  const positions = metadata.cue_cluster_position;
+  let startIndex = startTime ? -1 : 0;
+  let endIndex = -1;
+  for (let i = 0; i < times.length; i++) {
+    const time = times[i] / 1000;
+    tinyassert(!Number.isNaN(time));
+    if (startTime && time <= startTime) {
+      startIndex = i;
+    }
+    if (endTime && endIndex === -1 && time > endTime) {
+      endIndex = i;
+    }
   }
-  const cuePoints: StrictCuePont[] = metadata.cue_points.map((c) => {
-    const { time, cluster_position } = c;
-    tinyassert(typeof time === "number");
-    tinyassert(typeof cluster_position === "number");
-    return { time: time / 1000, cluster_position };
-  });
-
-  const startCue = startTime
-    ? [...cuePoints].reverse().find((c) => c.time <= startTime)
-    : cuePoints[0];
-  const endCue = endTime && cuePoints.find((c) => c.time > endTime);
-  tinyassert(startCue);
+  tinyassert(0 <= startIndex && startIndex < times.length);
+  const startCue = {
+    time: times[startIndex] / 1000,
+    cluster_position: positions[startIndex],
+  };
+  const endCue = endIndex >= 0 && { cluster_position: positions[endIndex] };
+  tinyassert(!Number.isNaN(startCue.cluster_position));
 
   return {
     startByte: startCue.cluster_position + metadata.segment_body_start,
@@ -143,7 +256,7 @@ function findContainingRange(
 //
 
 function main() {
-  const cli = tinycliMulti({ parseMetadata, remux });
+  const cli = tinycliMulti({ parseMetadata, remux, waveform, thumbnail });
   const args = process.argv.slice(2);
   return cli(args);
 }
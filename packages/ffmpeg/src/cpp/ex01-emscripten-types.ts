@@ -1,37 +1,159 @@
 export interface EmbindVector {
   resize: (length: number, defaultValue: number) => void;
   view(): Uint8Array;
+  delete(): void;
 }
 
 export interface SimpleTrackEntry {
-  track_number?: number;
-  track_type?: number;
-  codec_id?: number;
+  track_number: number | null;
+  track_type: number | null;
+  codec_id: string | null;
 }
 
-export interface SimpleCuePoint {
-  time?: number;
-  track?: number;
-  duration?: number;
-  cluster_position?: number;
+// cue columns are views into wasm memory (NaN for missing value).
+// they are invalidated by `delete()` or memory growth, so `slice()` to keep.
+export interface EmbindParsedMetadata {
+  segmentBodyStart(): number; // -1 if not found
+  timecodeScale(): number;
+  duration(): number;
+  trackEntries(): SimpleTrackEntry[];
+  cueTime(): Float64Array;
+  cueTrack(): Float64Array;
+  cueDuration(): Float64Array;
+  cueClusterPosition(): Float64Array;
+  delete(): void;
 }
 
+// plain object copied out of EmbindParsedMetadata (e.g. to transfer from worker)
 export interface SimpleMetadata {
   segment_body_start?: number;
   track_entries: SimpleTrackEntry[];
-  cue_points: SimpleCuePoint[];
+  cue_time: Float64Array;
+  cue_cluster_position: Float64Array;
+}
+
+export interface EmbindMemoryStats {
+  peak: number; // maximum bytes in use during last operation
+  current: number; // bytes still in use after last operation (e.g. result)
+  allocated: number; // sum of all allocation sizes
+  allocations: number;
+  process_peak: number; // including buffers allocated outside operation
+  heap_size: number; // wasm heap size
+  arena_size: number; // bytes reserved by arena chunks
+}
+
+export interface EmbindProgress {
+  time: number; // processed media time in seconds
+  bytes: number; // processed input bytes
+  total_time: number; // 0 if unknown
+  total_bytes: number; // 0 if unknown
+  elapsed: number; // seconds since operation started
+  throughput: number; // bytes per second
+  eta: number; // estimated seconds to completion (-1 if unknown)
+}
+
+export interface EmbindWaveformBuilder {
+  push(frame_buffer: EmbindVector): void;
+  finish(): EmbindVector; // int16 (min, max, rms) per bucket
+  startTime(): number;
+}
+
+export interface EmbindClusterRange {
+  start_byte: number;
+  end_byte: number; // -1 when reaching the end of file
+  time: number; // of cue point in seconds
+}
+
+// frames of range starting at cluster parsed while chunks arrive in any order
+export interface EmbindRangeFrameParser {
+  push(offset: number, chunk: EmbindVector): void; // chunk is emptied
+  done(): boolean; // false while waiting for missing range
+  missing(): [number, number][]; // [begin, end) not received yet
+  delete(): void;
+}
+
+export interface ClusterHeader {
+  offset: number; // of Cluster ID within given buffer
+  end: number; // -1 if size is unknown
+  timecode: number;
+}
+
+// thrown by embind functions on failure (cf. utils-embind.hpp)
+export interface EmbindError extends Error {
+  code: string; // e.g. assert, av, cancelled, deadline, memory_budget
 }
 
 export interface EmscriptenModule {
   embind_Vector: new () => EmbindVector;
+  embind_WaveformBuilder: new (
+    metadata_buffer: EmbindVector,
+    samples_per_bucket: number
+  ) => EmbindWaveformBuilder;
 
-  embind_parseMetadataWrapper: (metadata_buffer: EmbindVector) => string; // stringified SimpleMetadata
+  embind_ParsedMetadata: {
+    new (metadata_buffer: EmbindVector): EmbindParsedMetadata;
+    fromCache(cache_buffer: EmbindVector): EmbindParsedMetadata;
+  };
 
-  embind_remuxWrapper: (
+  // versioned binary cache entry of parsed metadata (e.g. for IndexedDB)
+  embind_serializeMetadata: (
     metadata_buffer: EmbindVector,
+    file_size: number
+  ) => EmbindVector;
+
+  // payload of other tracks than `track_number` (-1 for all) is skipped
+  embind_remuxCached: (
+    cache_buffer: EmbindVector,
     frame_buffer: EmbindVector,
+    fix_timestamp: boolean,
+    track_number: number
+  ) => EmbindVector;
+
+  embind_RangeFrameParser: new (
+    size: number,
+    track_number: number // -1 for all tracks
+  ) => EmbindRangeFrameParser;
+
+  embind_remuxCachedRange: (
+    cache_buffer: EmbindVector,
+    parser: EmbindRangeFrameParser,
     fix_timestamp: boolean
   ) => EmbindVector;
+
+  embind_remuxWrapper: (
+    metadata_buffer: EmbindVector,
+    frame_buffer: EmbindVector,
+    fix_timestamp: boolean,
+    track_number: number
+  ) => EmbindVector;
+
+  // verified clusters of buffer starting at arbitrary byte
+  embind_findClusters: (buffer: EmbindVector) => ClusterHeader[];
+
+  // cluster to download for video key frame at or before `time`
+  embind_findThumbnailCluster: (
+    metadata_buffer: EmbindVector,
+    time: number
+  ) => EmbindClusterRange;
+
+  embind_extractThumbnail: (
+    metadata_buffer: EmbindVector,
+    cluster_buffer: EmbindVector,
+    time: number,
+    width: number // 0 to keep original size
+  ) => EmbindVector; // jpeg
+
+  embind_setMemoryBudget: (budget: number) => void; // 0 to disable
+  // serve small allocations from arena reused across operations
+  embind_setArena: (enabled: boolean) => void;
+  embind_lastMemoryStats: () => EmbindMemoryStats;
+  // return false from callback to cancel (wasm runs synchronously so that
+  // cancellation requested elsewhere has to be observed by the callback)
+  embind_setProgressCallback: (
+    callback: ((progress: EmbindProgress) => boolean | void) | null
+  ) => void;
+  embind_setDeadline: (seconds: number) => void; // 0 to disable
+  embind_cancel: () => void;
 }
 
 export type EmscriptenInit = (options?: {
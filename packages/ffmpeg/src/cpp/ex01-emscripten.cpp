@@ -1,19 +1,232 @@
 #include <emscripten.h>
 #include <emscripten/bind.h>
 #include <emscripten/val.h>
+#include "utils-embind.hpp"
+#include "utils-memory.hpp"
+#include "utils-progress.hpp"
+#include "utils-webm-cache.hpp"
+#include "utils-webm-codec.hpp"
 #include "utils-webm.hpp"
 
 using namespace emscripten;
+using utils_embind::guard;
 
 template <typename T>
 val vector_view(const std::vector<T>& self) {
   return val(typed_memory_view(self.size(), self.data()));
 }
 
+//
+// embind_findClusters
+//
+
+// array of { offset, end, timecode } (end is -1 if size is unknown)
+val findClusters(const std::vector<uint8_t>& buffer) {
+  auto result = val::array();
+  for (auto& cluster : utils_webm::findClusters(buffer.data(), buffer.size())) {
+    auto item = val::object();
+    item.set("offset", static_cast<double>(cluster.offset));
+    item.set("end", static_cast<double>(cluster.end));
+    item.set("timecode", static_cast<double>(cluster.timecode));
+    result.call<void>("push", item);
+  }
+  return result;
+}
+
+//
+// embind_findThumbnailCluster
+//
+
+// { start_byte, end_byte, time } as js numbers (end_byte is -1 when reaching
+// the end of file)
+utils::Result<val> findThumbnailCluster(
+    const std::vector<uint8_t>& metadata_buffer,
+    double time) {
+  TRY_ASSIGN(auto range, utils_webm_codec::findThumbnailClusterWrapper(
+                             metadata_buffer, time));
+  auto result = val::object();
+  result.set("start_byte", static_cast<double>(range.start));
+  result.set("end_byte",
+             range.end ? static_cast<double>(range.end.value()) : -1.0);
+  result.set("time", range.start_time);
+  return result;
+}
+
+//
+// embind_ParsedMetadata
+//
+
+using utils_webm::ParsedMetadata;
+
+// uint64_t as js number
+val optional_to_val(const std::optional<uint64_t>& v) {
+  return v ? val(static_cast<double>(v.value())) : val::null();
+}
+
+val optional_to_val(const std::optional<std::string>& v) {
+  return v ? val(v.value()) : val::null();
+}
+
+double metadata_segmentBodyStart(const ParsedMetadata& self) {
+  auto& v = self.metadata_.segment_body_start;
+  return v ? static_cast<double>(v.value()) : -1;
+}
+
+double metadata_timecodeScale(const ParsedMetadata& self) {
+  return static_cast<double>(self.metadata_.timecode_scale);
+}
+
+double metadata_duration(const ParsedMetadata& self) {
+  return self.metadata_.duration;
+}
+
+val metadata_trackEntries(const ParsedMetadata& self) {
+  auto result = val::array();
+  for (auto& track_entry : self.metadata_.track_entries) {
+    auto entry = val::object();
+    entry.set("track_number", optional_to_val(track_entry.track_number));
+    entry.set("track_type", optional_to_val(track_entry.track_type));
+    entry.set("codec_id", optional_to_val(track_entry.codec_id));
+    result.call<void>("push", entry);
+  }
+  return result;
+}
+
+// views into wasm memory valid until `delete()` or memory growth
+val metadata_cueTime(const ParsedMetadata& self) {
+  return vector_view(self.cues_.time);
+}
+
+val metadata_cueTrack(const ParsedMetadata& self) {
+  return vector_view(self.cues_.track);
+}
+
+val metadata_cueDuration(const ParsedMetadata& self) {
+  return vector_view(self.cues_.duration);
+}
+
+val metadata_cueClusterPosition(const ParsedMetadata& self) {
+  return vector_view(self.cues_.cluster_position);
+}
+
+//
+// embind_RangeFrameParser
+//
+
+using utils_webm::RangeFrameParser;
+
+// track_number -1 for all tracks
+RangeFrameParser* rangeParser_new(double size, int track_number) {
+  return new RangeFrameParser(static_cast<uint64_t>(size),
+                              utils_webm::trackFilter(track_number));
+}
+
+// content of `chunk` is moved into parser (i.e. given vector becomes empty)
+utils::Result<void> rangeParser_push(RangeFrameParser& self,
+                                     double offset,
+                                     std::vector<uint8_t>& chunk) {
+  return self.push(static_cast<uint64_t>(offset), std::move(chunk));
+}
+
+// array of [begin, end) byte ranges not received yet
+val rangeParser_missing(const RangeFrameParser& self) {
+  auto result = val::array();
+  for (auto& [begin, end] : self.reader_.missing()) {
+    auto item = val::array();
+    item.call<void>("push", static_cast<double>(begin));
+    item.call<void>("push", static_cast<double>(end));
+    result.call<void>("push", item);
+  }
+  return result;
+}
+
+//
+// embind_setProgressCallback
+//
+
+// js callback returning false cancels running operation
+void setProgressCallback(val callback) {
+  if (callback.isNull() || callback.isUndefined()) {
+    utils_progress::setCallback(nullptr);
+    return;
+  }
+  utils_progress::setCallback(
+      [callback](const utils_progress::Progress& progress) {
+        return !callback(progress).isFalse();
+      });
+}
+
 EMSCRIPTEN_BINDINGS(ex01) {
   register_vector<uint8_t>("embind_Vector")
       .function("view", &vector_view<uint8_t>);
 
-  function("embind_parseMetadataWrapper", &utils_webm::parseMetadataWrapper);
-  function("embind_remuxWrapper", &utils_webm::remuxWrapper);
+  value_object<utils_memory::Stats>("embind_MemoryStats")
+      .field("peak", &utils_memory::Stats::peak)
+      .field("current", &utils_memory::Stats::current)
+      .field("allocated", &utils_memory::Stats::allocated)
+      .field("allocations", &utils_memory::Stats::allocations)
+      .field("process_peak", &utils_memory::Stats::process_peak)
+      .field("heap_size", &utils_memory::Stats::heap_size)
+      .field("arena_size", &utils_memory::Stats::arena_size);
+  function("embind_setMemoryBudget", &utils_memory::setBudget);
+  function("embind_setArena", &utils_memory::setArena);
+  function("embind_lastMemoryStats", &utils_memory::lastStats);
+
+  value_object<utils_progress::Progress>("embind_Progress")
+      .field("time", &utils_progress::Progress::time)
+      .field("bytes", &utils_progress::Progress::bytes)
+      .field("total_time", &utils_progress::Progress::total_time)
+      .field("total_bytes", &utils_progress::Progress::total_bytes)
+      .field("elapsed", &utils_progress::Progress::elapsed)
+      .field("throughput", &utils_progress::Progress::throughput)
+      .field("eta", &utils_progress::Progress::eta);
+  function("embind_setProgressCallback", &setProgressCallback);
+  function("embind_setDeadline", &utils_progress::setDeadline);
+  function("embind_cancel", &utils_progress::cancel);
+
+  // failure is thrown as js Error with `code` (cf. utils-embind.hpp)
+  class_<ParsedMetadata>("embind_ParsedMetadata")
+      .constructor(&utils_embind::construct<ParsedMetadata,
+                                            const std::vector<uint8_t>&>,
+                   allow_raw_pointers())
+      .function("segmentBodyStart", &metadata_segmentBodyStart)
+      .function("timecodeScale", &metadata_timecodeScale)
+      .function("duration", &metadata_duration)
+      .function("trackEntries", &metadata_trackEntries)
+      .function("cueTime", &metadata_cueTime)
+      .function("cueTrack", &metadata_cueTrack)
+      .function("cueDuration", &metadata_cueDuration)
+      .function("cueClusterPosition", &metadata_cueClusterPosition)
+      .class_function(
+          "fromCache",
+          &guard<&utils_webm_cache::deserializeMetadataWrapper>::call);
+  function("embind_serializeMetadata",
+           &guard<&utils_webm_cache::serializeMetadataWrapper>::call);
+  function("embind_remuxCached",
+           &guard<&utils_webm_cache::remuxCachedWrapper>::call);
+
+  class_<RangeFrameParser>("embind_RangeFrameParser")
+      .constructor(&guard<&rangeParser_new>::call, allow_raw_pointers())
+      .function("push", &guard<&rangeParser_push>::call)
+      .function("done", &RangeFrameParser::done)
+      .function("missing", &rangeParser_missing);
+  function("embind_remuxCachedRange",
+           &guard<&utils_webm_cache::remuxCachedRange>::call);
+
+  function("embind_remuxWrapper", &guard<&utils_webm::remuxWrapper>::call);
+  function("embind_findClusters", &guard<&findClusters>::call);
+
+  using utils_webm_codec::WaveformBuilder;
+  class_<WaveformBuilder>("embind_WaveformBuilder")
+      .constructor(&utils_embind::construct<WaveformBuilder,
+                                            const std::vector<uint8_t>&,
+                                            uint32_t>,
+                   allow_raw_pointers())
+      .function("push", &guard<&WaveformBuilder::push>::call)
+      .function("finish", &guard<&WaveformBuilder::finish>::call)
+      .function("startTime", &WaveformBuilder::startTime);
+
+  function("embind_findThumbnailCluster", &guard<&findThumbnailCluster>::call);
+  function("embind_extractThumbnail",
+           &guard<&utils_webm_codec::extractThumbnailWrapper>::call);
 }
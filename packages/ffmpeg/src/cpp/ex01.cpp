@@ -1,33 +1,69 @@
+#include <csignal>
 #include <cstring>
 #include <optional>
+#include "utils-memory.hpp"
+#include "utils-progress.hpp"
+#include "utils-webm-cache.hpp"
+#include "utils-webm-codec.hpp"
+#include "utils-webm-fetch.hpp"
 #include "utils-webm.hpp"
 #include "utils.hpp"
 
-int mainParseMetadata(int argc, const char* argv[]) {
+utils::Result<void> mainParseMetadata(int argc, const char* argv[]) {
   utils::Cli cli{argc, argv};
   auto in_file = cli.argument<std::string>("--in");
   auto slice = cli.argument<size_t>("--slice");
+  auto cache_dir = cli.argument<std::string>("--cache-dir");
+  auto cache_size =
+      cli.argument<uintmax_t>("--cache-size").value_or(64 << 20);
   ASSERT(in_file);
 
-  auto webmData = utils::readFile(in_file.value());
+  TRY_ASSIGN(auto webmData, utils::readFile(in_file.value()));
+  auto file_size = webmData.size();
   if (slice) {
     // test if metadata can be parsed properly with incomplete data
     webmData = std::vector(webmData.begin(), webmData.begin() + slice.value());
   }
-  auto [status, metadata] = utils_webm::parseMetadata(webmData);
+
+  // lookup cache keyed by metadata prefix and file size
+  std::optional<utils_webm_cache::DirectoryCache> cache;
+  uint64_t key = 0;
+  if (cache_dir) {
+    TRY(cache.emplace().initialize(cache_dir.value(), cache_size));
+    key = utils_webm_cache::cacheKey(webmData.data(), webmData.size(),
+                                     file_size);
+    auto cached = cache->get(key);
+    dbg(key, cached.has_value());
+    if (cached) {
+      std::cout << nlohmann::json(cached.value()).dump(2) << std::endl;
+      return {};
+    }
+  }
+
+  TRY_ASSIGN(auto parsed, utils_webm::parseMetadata(webmData));
+  auto& [status, metadata] = parsed;
   dbg(status.code, status.completed_ok(), status.ok());
+  if (cache && status.ok()) {
+    TRY(cache->put(key, metadata));
+  }
   std::cout << nlohmann::json(metadata).dump(2) << std::endl;
-  return 0;
+  return {};
 }
 
-int mainParseFrames(int argc, const char* argv[]) {
+utils::Result<void> mainParseFrames(int argc, const char* argv[]) {
   utils::Cli cli{argc, argv};
   auto in_file = cli.argument<std::string>("--in");
   auto slice_start = cli.argument<size_t>("--slice-start");
   auto slice_end = cli.argument<size_t>("--slice-end");
+  // slice can start at arbitrary byte (e.g. fixed size download chunk)
+  auto resync = cli.argument<std::string>("--resync").value_or("false");
+  // push chunks in reverse order to mimic concurrent range download
+  auto range_chunk = cli.argument<size_t>("--range-chunk");
+  // payload of other tracks is skipped
+  auto track_number = cli.argument<uint64_t>("--track-number");
   ASSERT(in_file);
 
-  auto webmData = utils::readFile(in_file.value());
+  TRY_ASSIGN(auto webmData, utils::readFile(in_file.value()));
   auto begin = webmData.begin();
   auto end = webmData.end();
   if (slice_end) {
@@ -37,14 +73,41 @@ int mainParseFrames(int argc, const char* argv[]) {
     begin += slice_start.value();
   }
   webmData = std::vector(begin, end);
-  auto [status, frames] = utils_webm::parseFrames(webmData);
+  if (range_chunk) {
+    ASSERT(range_chunk.value() > 0);
+    utils_webm::RangeFrameParser parser{webmData.size(), track_number};
+    size_t num_chunks =
+        (webmData.size() + range_chunk.value() - 1) / range_chunk.value();
+    for (size_t i = num_chunks; i-- > 0;) {
+      size_t offset = i * range_chunk.value();
+      size_t size = std::min(range_chunk.value(), webmData.size() - offset);
+      TRY(parser.push(offset, std::vector(webmData.begin() + offset,
+                                          webmData.begin() + offset + size)));
+      dbg(offset, parser.done(), parser.reader_.missing().size(),
+          parser.callback_.frames_.size());
+    }
+    TRY_ASSIGN(auto frames, parser.finish());
+    dbg(frames.size());
+    return {};
+  }
+  if (resync == "true") {
+    auto clusters = utils_webm::findClusters(webmData.data(), webmData.size());
+    for (auto& cluster : clusters) {
+      dbg(cluster.offset, cluster.end, cluster.timecode, cluster.end_verified);
+    }
+  }
+  TRY_ASSIGN(auto parsed,
+             resync == "true"
+                 ? utils_webm::parseFramesResync(webmData, track_number)
+                 : utils_webm::parseFrames(webmData, track_number));
+  auto& [status, frames] = parsed;
   dbg(status.code, status.completed_ok(), status.ok());
   dbg(frames.size());
 
-  return 0;
+  return {};
 }
 
-int mainRemux(int argc, const char* argv[]) {
+utils::Result<void> mainRemux(int argc, const char* argv[]) {
   utils::Cli cli{argc, argv};
   auto in_file = cli.argument<std::string>("--in");
   auto out_file = cli.argument<std::string>("--out");
@@ -52,29 +115,127 @@ int mainRemux(int argc, const char* argv[]) {
   auto slice_end = cli.argument<size_t>("--slice-end");
   auto fix_timestamp =
       cli.argument<std::string>("--fix-timestamp").value_or("true");
+  auto track_number = cli.argument<uint64_t>("--track-number");
+  auto cue_interval = cli.argument<double>("--cue-interval")
+                          .value_or(utils_webm::DEFAULT_CUE_INTERVAL);
   ASSERT(in_file);
   ASSERT(out_file);
 
   // read metadata
-  auto webmData = utils::readFile(in_file.value());
-  auto [status1, metadata] = utils_webm::parseMetadata(webmData);
+  TRY_ASSIGN(auto webmData, utils::readFile(in_file.value()));
+  TRY_ASSIGN(auto parsed_metadata, utils_webm::parseMetadata(webmData));
+  auto& [status1, metadata] = parsed_metadata;
   dbg(status1.code);
 
   // read frames
   auto sliceData = std::vector(
       slice_start ? webmData.begin() + slice_start.value() : webmData.begin(),
       slice_end ? webmData.begin() + slice_end.value() : webmData.end());
-  auto [status2, frames] = utils_webm::parseFrames(sliceData);
+  TRY_ASSIGN(auto parsed_frames,
+             utils_webm::parseFrames(sliceData, track_number));
+  auto& [status2, frames] = parsed_frames;
   dbg(status2.code, frames.size());
 
   // remux
-  auto output = utils_webm::remux(metadata, frames, fix_timestamp == "true");
-  utils::writeFile(out_file.value(), output);
-  return 0;
+  TRY_ASSIGN(auto output,
+             utils_webm::remux(metadata, frames, fix_timestamp == "true",
+                               track_number, cue_interval));
+  TRY(utils::writeFile(out_file.value(), output));
+  return {};
 }
 
-int main(int argc, const char* argv[]) {
-  ASSERT(argc >= 2);
+// e.g. fetch-clip --url http://localhost:8080/test.webm --out test.out.webm
+//        --start-time 35 --end-time 45 --concurrency 4
+utils::Result<void> mainFetchClip(int argc, const char* argv[]) {
+  utils::Cli cli{argc, argv};
+  auto url = cli.argument<std::string>("--url");
+  auto out_file = cli.argument<std::string>("--out");
+  utils_webm_fetch::FetchClipOptions options;
+  options.start_time = cli.argument<double>("--start-time").value_or(-1);
+  options.end_time = cli.argument<double>("--end-time").value_or(-1);
+  options.track_number = cli.argument<uint64_t>("--track-number");
+  options.fix_timestamp =
+      cli.argument<std::string>("--fix-timestamp").value_or("true") == "true";
+  options.concurrency =
+      cli.argument<int>("--concurrency").value_or(options.concurrency);
+  options.chunk_size =
+      cli.argument<size_t>("--chunk-size").value_or(options.chunk_size);
+  ASSERT(url);
+  ASSERT(out_file);
+
+  TRY_ASSIGN(auto output, utils_webm_fetch::fetchClip(url.value(), options));
+  TRY(utils::writeFile(out_file.value(), output));
+  return {};
+}
+
+utils::Result<void> mainWaveform(int argc, const char* argv[]) {
+  utils::Cli cli{argc, argv};
+  auto in_file = cli.argument<std::string>("--in");
+  auto out_file = cli.argument<std::string>("--out");
+  auto slice_start = cli.argument<size_t>("--slice-start");
+  auto slice_end = cli.argument<size_t>("--slice-end");
+  auto samples_per_bucket =
+      cli.argument<uint32_t>("--samples-per-bucket").value_or(4800);
+  ASSERT(in_file);
+  ASSERT(out_file);
+
+  // read metadata
+  TRY_ASSIGN(auto webmData, utils::readFile(in_file.value()));
+  utils_webm_codec::WaveformBuilder builder;
+  TRY(builder.initialize(webmData, samples_per_bucket));
+
+  // push cluster slice in small chunks to mimic incremental download
+  auto begin = slice_start ? slice_start.value() : 0;
+  auto end = slice_end ? slice_end.value() : webmData.size();
+  TRY_ASSIGN(auto parsed, utils_webm::parseMetadata(webmData));
+  auto& [status, metadata] = parsed;
+  ASSERT(status.ok());
+  std::vector<size_t> boundaries;
+  for (auto& cue_point : metadata.cue_points) {
+    auto position = metadata.segment_body_start.value() +
+                    cue_point.cluster_position.value();
+    if (begin < position && position < end) {
+      boundaries.push_back(position);
+    }
+  }
+  boundaries.push_back(end);
+  for (auto boundary : boundaries) {
+    TRY(builder.push(std::vector(webmData.begin() + begin,
+                                 webmData.begin() + boundary)));
+    begin = boundary;
+  }
+  TRY_ASSIGN(auto output, builder.finish());
+  dbg(builder.startTime(), output.size() / 6);
+  TRY(utils::writeFile(out_file.value(), output));
+  return {};
+}
+
+utils::Result<void> mainThumbnail(int argc, const char* argv[]) {
+  utils::Cli cli{argc, argv};
+  auto in_file = cli.argument<std::string>("--in");
+  auto out_file = cli.argument<std::string>("--out");
+  auto time = cli.argument<double>("--time").value_or(0);
+  auto width = cli.argument<int>("--width").value_or(0);
+  ASSERT(in_file);
+  ASSERT(out_file);
+
+  // only metadata and single cluster are used as in browser
+  TRY_ASSIGN(auto webmData, utils::readFile(in_file.value()));
+  TRY_ASSIGN(auto range,
+             utils_webm_codec::findThumbnailClusterWrapper(webmData, time));
+  dbg(range.start, range.end, range.start_time);
+  auto clusterData = std::vector(
+      webmData.begin() + static_cast<size_t>(range.start),
+      range.end ? webmData.begin() + static_cast<size_t>(range.end.value())
+                : webmData.end());
+  TRY_ASSIGN(auto output,
+             utils_webm_codec::extractThumbnailWrapper(webmData, clusterData,
+                                                       time, width));
+  TRY(utils::writeFile(out_file.value(), output));
+  return {};
+}
+
+utils::Result<void> mainCommand(int argc, const char* argv[]) {
   std::string command(argv[1]);
   if (command == "parse-metadata") {
     return mainParseMetadata(argc, argv);
@@ -85,5 +246,51 @@ int main(int argc, const char* argv[]) {
   if (command == "remux") {
     return mainRemux(argc, argv);
   }
-  return 1;
+  if (command == "fetch-clip") {
+    return mainFetchClip(argc, argv);
+  }
+  if (command == "waveform") {
+    return mainWaveform(argc, argv);
+  }
+  if (command == "thumbnail") {
+    return mainThumbnail(argc, argv);
+  }
+  return utils::Error{"cli", "unknown command: " + command};
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " <command> [--flag value]..."
+              << std::endl;
+    return 1;
+  }
+  utils::Cli cli{argc, argv};
+  utils_memory::setBudget(cli.argument<size_t>("--memory-budget").value_or(0));
+  utils_memory::setArena(
+      cli.argument<std::string>("--arena").value_or("false") == "true");
+  // e.g. --deadline 10 --progress true (SIGINT cancels running operation)
+  utils_progress::setDeadline(cli.argument<double>("--deadline").value_or(0));
+  if (cli.argument<std::string>("--progress").value_or("false") == "true") {
+    utils_progress::setCallback([](const utils_progress::Progress& progress) {
+      std::cerr << utils_progress::formatProgress(progress) << std::endl;
+      return true;
+    });
+  }
+  utils_progress::cancelOnSignal(SIGINT);
+  auto result = mainCommand(argc, argv);
+  // e.g. memory budget exceeded after the operation's last check
+  auto failure = utils_progress::takeFailure();
+  if (result.ok() && !failure.ok()) {
+    result = failure;
+  }
+  if (cli.argument<std::string>("--memory-stats").value_or("false") ==
+      "true") {
+    std::cerr << utils_memory::formatStats(utils_memory::lastStats())
+              << std::endl;
+  }
+  if (!result.ok()) {
+    std::cerr << utils::formatError(result.error()) << std::endl;
+    return 1;
+  }
+  return 0;
 }
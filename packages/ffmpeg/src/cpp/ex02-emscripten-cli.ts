@@ -0,0 +1,124 @@
+import fs from "node:fs";
+import path from "node:path";
+import process from "node:process";
+import { z } from "zod";
+import { tinycli, tinycliMulti } from "../tinycli";
+import type {
+  EmbindVector,
+  EmscriptenInit,
+  EmscriptenModule,
+} from "./ex02-emscripten-types";
+
+const DEFAULT_MODULE_PATH = "build/emscripten/Release/ex02-emscripten.js";
+
+let Module: EmscriptenModule;
+
+async function initModule(modulePath: string) {
+  const init: EmscriptenInit = require(path.resolve(modulePath));
+  Module = await init();
+}
+
+const parseMetadata = tinycli(
+  z.object({
+    module: z.string().default(DEFAULT_MODULE_PATH),
+    in: z.string(),
+    slice: z.preprocess(Number, z.number().int()).optional(),
+  }),
+  async (args) => {
+    await initModule(args.module);
+
+    // read data and slice
+    const inData = await readFile(args.in);
+    if (typeof args.slice === "number") {
+      inData.resize(args.slice, 0);
+    }
+
+    // process
+    const metadata = Module.embind_parseMetadata(inData);
+    console.log(metadata);
+  }
+);
+
+const remux = tinycli(
+  z.object({
+    module: z.string().default(DEFAULT_MODULE_PATH),
+    in: z.string(),
+    out: z.string(),
+    startTime: z.preprocess(Number, z.number()).default(-1),
+    endTime: z.preprocess(Number, z.number()).default(-1),
+    fixTimestamp: z.enum(["true", "false"]).default("true"),
+    memoryBudget: z.preprocess(Number, z.number().int()).default(0),
+    arena: z.enum(["true", "false"]).default("false"),
+  }),
+  async (args) => {
+    await initModule(args.module);
+    Module.embind_setMemoryBudget(args.memoryBudget);
+    Module.embind_setArena(args.arena === "true");
+
+    // read metadata (only first 16KB is expected to include moov and sidx)
+    const inData = await readFile(args.in);
+    const metadataData = sliceVector(inData, 0, 2 ** 14);
+
+    // compute containing range
+    const range = Module.embind_findSegmentRange(
+      metadataData,
+      args.startTime,
+      args.endTime
+    );
+    console.log(range);
+
+    // slice fragment data
+    const fragmentData = sliceVector(
+      inData,
+      range.start_byte,
+      range.end_byte >= 0 ? range.end_byte : undefined
+    );
+
+    // process
+    const output = Module.embind_remux(
+      metadataData,
+      fragmentData,
+      args.fixTimestamp === "true"
+    );
+    console.log(Module.embind_lastMemoryStats());
+    await fs.promises.writeFile(args.out, output.view());
+  }
+);
+
+//
+// utils
+//
+
+async function readFile(filename: string): Promise<EmbindVector> {
+  const buffer = await fs.promises.readFile(filename);
+  const vector = new Module.embind_Vector();
+  vector.resize(buffer.length, 0);
+  vector.view().set(new Uint8Array(buffer));
+  return vector;
+}
+
+function sliceVector(
+  vector: EmbindVector,
+  start: number,
+  end?: number
+): EmbindVector {
+  const sliceArray = vector.view().slice(start, end);
+  const result = new Module.embind_Vector();
+  result.resize(sliceArray.length, 0);
+  result.view().set(sliceArray);
+  return result;
+}
+
+//
+// main
+//
+
+function main() {
+  const cli = tinycliMulti({ parseMetadata, remux });
+  const args = process.argv.slice(2);
+  return cli(args);
+}
+
+if (require.main === module) {
+  main();
+}
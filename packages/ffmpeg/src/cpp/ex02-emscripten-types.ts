@@ -0,0 +1,86 @@
+export interface EmbindVector {
+  resize: (length: number, defaultValue: number) => void;
+  view(): Uint8Array;
+}
+
+export interface EmbindMemoryStats {
+  peak: number; // maximum bytes in use during last operation
+  current: number; // bytes still in use after last operation (e.g. result)
+  allocated: number; // sum of all allocation sizes
+  allocations: number;
+  process_peak: number; // including buffers allocated outside operation
+  heap_size: number; // wasm heap size
+  arena_size: number; // bytes reserved by arena chunks
+}
+
+export interface EmbindProgress {
+  time: number; // processed media time in seconds
+  bytes: number; // processed input bytes
+  total_time: number; // 0 if unknown
+  total_bytes: number; // 0 if unknown
+  elapsed: number; // seconds since operation started
+  throughput: number; // bytes per second
+  eta: number; // estimated seconds to completion (-1 if unknown)
+}
+
+export interface SimpleTrack {
+  track_id: number;
+  timescale: number;
+  handler_type: string; // e.g. soun, vide
+}
+
+// segment (sidx reference) columns
+export interface SimpleMetadata {
+  init_end: number; // [0, init_end) is initialization segment (ftyp + moov)
+  timescale: number;
+  duration: number; // in seconds
+  tracks: SimpleTrack[];
+  segment_start_time: Float64Array; // in seconds
+  segment_start_byte: Float64Array;
+  segment_end_byte: Float64Array;
+}
+
+export interface EmbindSegmentRange {
+  start_byte: number;
+  end_byte: number; // -1 when reaching the end of file
+  start_time: number; // of first segment
+}
+
+// thrown by embind functions on failure (cf. utils-embind.hpp)
+export interface EmbindError extends Error {
+  code: string; // e.g. assert, av, cancelled, deadline, memory_budget
+}
+
+export interface EmscriptenModule {
+  embind_Vector: new () => EmbindVector;
+
+  embind_parseMetadata: (metadata_buffer: EmbindVector) => SimpleMetadata;
+
+  embind_findSegmentRange: (
+    metadata_buffer: EmbindVector,
+    start_time: number, // -1 to indicate no value
+    end_time: number
+  ) => EmbindSegmentRange;
+
+  embind_remux: (
+    metadata_buffer: EmbindVector,
+    fragment_buffer: EmbindVector,
+    fix_timestamp: boolean
+  ) => EmbindVector;
+
+  embind_setMemoryBudget: (budget: number) => void; // 0 to disable
+  // serve small allocations from arena reused across operations
+  embind_setArena: (enabled: boolean) => void;
+  embind_lastMemoryStats: () => EmbindMemoryStats;
+  // return false from callback to cancel (wasm runs synchronously so that
+  // cancellation requested elsewhere has to be observed by the callback)
+  embind_setProgressCallback: (
+    callback: ((progress: EmbindProgress) => boolean | void) | null
+  ) => void;
+  embind_setDeadline: (seconds: number) => void; // 0 to disable
+  embind_cancel: () => void;
+}
+
+export type EmscriptenInit = (options?: {
+  locateFile: (filename: string) => string;
+}) => Promise<EmscriptenModule>;
@@ -0,0 +1,113 @@
+#include <emscripten.h>
+#include <emscripten/bind.h>
+#include <emscripten/val.h>
+#include "utils-embind.hpp"
+#include "utils-memory.hpp"
+#include "utils-mp4.hpp"
+#include "utils-progress.hpp"
+
+using namespace emscripten;
+using utils_embind::guard;
+
+template <typename T>
+val vector_view(const std::vector<T>& self) {
+  return val(typed_memory_view(self.size(), self.data()));
+}
+
+// copy column into js owned Float64Array
+template <class F>
+val segment_column(const utils_mp4::SimpleMetadata& metadata, F f) {
+  std::vector<double> column;
+  for (auto& segment : metadata.segments) {
+    column.push_back(static_cast<double>(f(segment)));
+  }
+  return val::global("Float64Array").new_(vector_view(column));
+}
+
+utils::Result<val> parseMetadata(const std::vector<uint8_t>& metadata_buffer) {
+  utils_memory::Scope memory_scope;
+  TRY_ASSIGN(auto metadata, utils_mp4::parseMetadata(metadata_buffer));
+  auto result = val::object();
+  result.set("init_end", static_cast<double>(metadata.init_end));
+  result.set("timescale", metadata.timescale);
+  result.set("duration", metadata.duration);
+  auto tracks = val::array();
+  for (auto& track : metadata.tracks) {
+    auto entry = val::object();
+    entry.set("track_id", track.track_id);
+    entry.set("timescale", track.timescale);
+    entry.set("handler_type", track.handler_type);
+    tracks.call<void>("push", entry);
+  }
+  result.set("tracks", tracks);
+  result.set("segment_start_time",
+             segment_column(metadata, [](auto& s) { return s.start_time; }));
+  result.set("segment_start_byte",
+             segment_column(metadata, [](auto& s) { return s.start_byte; }));
+  result.set("segment_end_byte",
+             segment_column(metadata, [](auto& s) { return s.end_byte; }));
+  return result;
+}
+
+utils::Result<utils_mp4::SegmentRange> findSegmentRange(
+    const std::vector<uint8_t>& metadata_buffer,
+    double start_time,
+    double end_time) {
+  utils_memory::Scope memory_scope;
+  TRY_ASSIGN(auto metadata, utils_mp4::parseMetadata(metadata_buffer));
+  return utils_mp4::findSegmentRange(metadata, start_time, end_time);
+}
+
+//
+// embind_setProgressCallback
+//
+
+// js callback returning false cancels running operation
+void setProgressCallback(val callback) {
+  if (callback.isNull() || callback.isUndefined()) {
+    utils_progress::setCallback(nullptr);
+    return;
+  }
+  utils_progress::setCallback(
+      [callback](const utils_progress::Progress& progress) {
+        return !callback(progress).isFalse();
+      });
+}
+
+EMSCRIPTEN_BINDINGS(ex02) {
+  register_vector<uint8_t>("embind_Vector")
+      .function("view", &vector_view<uint8_t>);
+
+  value_object<utils_memory::Stats>("embind_MemoryStats")
+      .field("peak", &utils_memory::Stats::peak)
+      .field("current", &utils_memory::Stats::current)
+      .field("allocated", &utils_memory::Stats::allocated)
+      .field("allocations", &utils_memory::Stats::allocations)
+      .field("process_peak", &utils_memory::Stats::process_peak)
+      .field("heap_size", &utils_memory::Stats::heap_size)
+      .field("arena_size", &utils_memory::Stats::arena_size);
+  function("embind_setMemoryBudget", &utils_memory::setBudget);
+  function("embind_setArena", &utils_memory::setArena);
+  function("embind_lastMemoryStats", &utils_memory::lastStats);
+
+  value_object<utils_progress::Progress>("embind_Progress")
+      .field("time", &utils_progress::Progress::time)
+      .field("bytes", &utils_progress::Progress::bytes)
+      .field("total_time", &utils_progress::Progress::total_time)
+      .field("total_bytes", &utils_progress::Progress::total_bytes)
+      .field("elapsed", &utils_progress::Progress::elapsed)
+      .field("throughput", &utils_progress::Progress::throughput)
+      .field("eta", &utils_progress::Progress::eta);
+  function("embind_setProgressCallback", &setProgressCallback);
+  function("embind_setDeadline", &utils_progress::setDeadline);
+  function("embind_cancel", &utils_progress::cancel);
+
+  value_object<utils_mp4::SegmentRange>("embind_SegmentRange")
+      .field("start_byte", &utils_mp4::SegmentRange::start_byte)
+      .field("end_byte", &utils_mp4::SegmentRange::end_byte)
+      .field("start_time", &utils_mp4::SegmentRange::start_time);
+
+  function("embind_parseMetadata", &guard<&parseMetadata>::call);
+  function("embind_findSegmentRange", &guard<&findSegmentRange>::call);
+  function("embind_remux", &guard<&utils_mp4::remux>::call);
+}
@@ -0,0 +1,130 @@
+#include <csignal>
+#include <cstring>
+#include <optional>
+#include "utils-memory.hpp"
+#include "utils-mp4.hpp"
+#include "utils-progress.hpp"
+#include "utils.hpp"
+
+utils::Result<void> mainParseMetadata(int argc, const char* argv[]) {
+  utils::Cli cli{argc, argv};
+  auto in_file = cli.argument<std::string>("--in");
+  auto slice = cli.argument<size_t>("--slice");
+  ASSERT(in_file);
+
+  TRY_ASSIGN(auto mp4Data, utils::readFile(in_file.value()));
+  if (slice) {
+    // test if metadata can be parsed properly with incomplete data
+    mp4Data = std::vector(mp4Data.begin(), mp4Data.begin() + slice.value());
+  }
+  TRY_ASSIGN(auto metadata, utils_mp4::parseMetadata(mp4Data));
+  std::cout << nlohmann::json(metadata).dump(2) << std::endl;
+  return {};
+}
+
+utils::Result<void> mainParseFragments(int argc, const char* argv[]) {
+  utils::Cli cli{argc, argv};
+  auto in_file = cli.argument<std::string>("--in");
+  auto slice_start = cli.argument<size_t>("--slice-start");
+  auto slice_end = cli.argument<size_t>("--slice-end");
+  ASSERT(in_file);
+
+  TRY_ASSIGN(auto mp4Data, utils::readFile(in_file.value()));
+  auto begin = mp4Data.begin();
+  auto end = mp4Data.end();
+  if (slice_end) {
+    end = begin + slice_end.value();
+  }
+  if (slice_start) {
+    begin += slice_start.value();
+  }
+  mp4Data = std::vector(begin, end);
+  TRY_ASSIGN(auto parsed, utils_mp4::parseFragments(mp4Data));
+  auto& [fragments, frames] = parsed;
+  dbg(fragments.size(), frames.size());
+  if (!frames.empty()) {
+    dbg(frames.front().decode_time, frames.back().decode_time);
+  }
+  return {};
+}
+
+utils::Result<void> mainRemux(int argc, const char* argv[]) {
+  utils::Cli cli{argc, argv};
+  auto in_file = cli.argument<std::string>("--in");
+  auto out_file = cli.argument<std::string>("--out");
+  auto slice = cli.argument<size_t>("--slice").value_or(1 << 14);
+  auto start_time = cli.argument<double>("--start-time").value_or(-1);
+  auto end_time = cli.argument<double>("--end-time").value_or(-1);
+  auto fix_timestamp =
+      cli.argument<std::string>("--fix-timestamp").value_or("true");
+  ASSERT(in_file);
+  ASSERT(out_file);
+
+  // only metadata prefix and planned byte range are used as in browser
+  TRY_ASSIGN(auto mp4Data, utils::readFile(in_file.value()));
+  auto metadataData = std::vector(
+      mp4Data.begin(), mp4Data.begin() + std::min(slice, mp4Data.size()));
+  TRY_ASSIGN(auto metadata, utils_mp4::parseMetadata(metadataData));
+  TRY_ASSIGN(auto range,
+             utils_mp4::findSegmentRange(metadata, start_time, end_time));
+  dbg(range.start_byte, range.end_byte, range.start_time);
+
+  auto fragmentData = std::vector(
+      mp4Data.begin() + range.start_byte,
+      range.end_byte >= 0 ? mp4Data.begin() + range.end_byte : mp4Data.end());
+  TRY_ASSIGN(auto output, utils_mp4::remux(metadataData, fragmentData,
+                                           fix_timestamp == "true"));
+  TRY(utils::writeFile(out_file.value(), output));
+  return {};
+}
+
+utils::Result<void> mainCommand(int argc, const char* argv[]) {
+  std::string command(argv[1]);
+  if (command == "parse-metadata") {
+    return mainParseMetadata(argc, argv);
+  }
+  if (command == "parse-fragments") {
+    return mainParseFragments(argc, argv);
+  }
+  if (command == "remux") {
+    return mainRemux(argc, argv);
+  }
+  return utils::Error{"cli", "unknown command: " + command};
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " <command> [--flag value]..."
+              << std::endl;
+    return 1;
+  }
+  utils::Cli cli{argc, argv};
+  utils_memory::setBudget(cli.argument<size_t>("--memory-budget").value_or(0));
+  utils_memory::setArena(
+      cli.argument<std::string>("--arena").value_or("false") == "true");
+  // e.g. --deadline 10 --progress true (SIGINT cancels running operation)
+  utils_progress::setDeadline(cli.argument<double>("--deadline").value_or(0));
+  if (cli.argument<std::string>("--progress").value_or("false") == "true") {
+    utils_progress::setCallback([](const utils_progress::Progress& progress) {
+      std::cerr << utils_progress::formatProgress(progress) << std::endl;
+      return true;
+    });
+  }
+  utils_progress::cancelOnSignal(SIGINT);
+  auto result = mainCommand(argc, argv);
+  // e.g. memory budget exceeded after the operation's last check
+  auto failure = utils_progress::takeFailure();
+  if (result.ok() && !failure.ok()) {
+    result = failure;
+  }
+  if (cli.argument<std::string>("--memory-stats").value_or("false") ==
+      "true") {
+    std::cerr << utils_memory::formatStats(utils_memory::lastStats())
+              << std::endl;
+  }
+  if (!result.ok()) {
+    std::cerr << utils::formatError(result.error()) << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <emscripten/val.h>
+#include <memory>
+#include "utils-progress.hpp"
+#include "utils.hpp"
+
+// embind entry points report failure as js `Error` with `code` property
+// (cf. utils::Error) instead of letting c++ exception (or abort) reach js.
+// e.g.
+//   function("embind_convert", &utils_embind::guard<&ex00_impl::convert>::call)
+
+namespace utils_embind {
+
+// value type of `Result<T>` (or plain return type of infallible function)
+template <class R>
+struct unwrapped {
+  using type = R;
+};
+
+template <class T>
+struct unwrapped<utils::Result<T>> {
+  using type = T;
+};
+
+template <class R>
+using unwrapped_t = typename unwrapped<R>::type;
+
+template <class F,
+          class R = std::invoke_result_t<F>,
+          class T = unwrapped_t<R>>
+utils::Result<T> callResult(F& f) {
+  if constexpr (!std::is_same_v<R, T>) {
+    return f();
+  } else if constexpr (std::is_void_v<T>) {
+    f();
+    return {};
+  } else {
+    return utils::Result<T>{f()};
+  }
+}
+
+// run `f` and turn its error (or std exception when built with exceptions)
+// into utils::Error. failure reported by `utils_progress::fail` after the
+// operation's last check (e.g. memory budget exceeded by operator new
+// without exceptions) is also picked up here.
+template <class F, class T = unwrapped_t<std::invoke_result_t<F>>>
+utils::Result<T> capture(F f) {
+#ifdef UTILS_HAS_EXCEPTIONS
+  auto result = [&]() -> utils::Result<T> {
+    try {
+      return callResult(f);
+    } catch (const std::exception& e) {
+      return utils::toError(e);
+    }
+  }();
+#else
+  auto result = callResult(f);
+#endif
+  auto failure = utils_progress::takeFailure();
+  if (result.ok() && !failure.ok()) {
+    return failure.error();
+  }
+  return result;
+}
+
+[[noreturn]] void throwError(const utils::Error& error) {
+  auto js_error = emscripten::val::global("Error").new_(error.message);
+  js_error.set("code", error.code);
+  js_error.throw_();
+}
+
+template <class T>
+T unwrap(utils::Result<T>&& result) {
+  if (!result.ok()) {
+    throwError(result.error());
+  }
+  if constexpr (!std::is_void_v<T>) {
+    return std::move(result.value());
+  }
+}
+
+//
+// wrap free function, member function, or constructor for embind
+//
+
+template <auto F>
+struct guard;
+
+template <class R, class... Args, R (*F)(Args...)>
+struct guard<F> {
+  static unwrapped_t<R> call(Args... args) {
+    return unwrap(
+        capture([&]() -> R { return F(std::forward<Args>(args)...); }));
+  }
+};
+
+template <class C, class R, class... Args, R (C::*F)(Args...)>
+struct guard<F> {
+  static unwrapped_t<R> call(C& self, Args... args) {
+    return unwrap(
+        capture([&]() -> R { return (self.*F)(std::forward<Args>(args)...); }));
+  }
+};
+
+template <class C, class R, class... Args, R (C::*F)(Args...) const>
+struct guard<F> {
+  static unwrapped_t<R> call(const C& self, Args... args) {
+    return unwrap(
+        capture([&]() -> R { return (self.*F)(std::forward<Args>(args)...); }));
+  }
+};
+
+// for class_<T>().constructor(&construct<T, Args...>, allow_raw_pointers()).
+// `T` is default constructed and opened by `initialize(args...)` so that
+// partially opened state is released by its destructor on failure.
+template <class T, class... Args>
+T* construct(Args... args) {
+  return unwrap(capture([&]() -> utils::Result<T*> {
+    auto self = std::make_unique<T>();
+    TRY(self->initialize(std::forward<Args>(args)...));
+    return self.release();
+  }));
+}
+
+}  // namespace utils_embind
@@ -1,30 +1,42 @@
 #pragma once
 
+#include <cstring>
+#include <functional>
 #include <map>
+#include "utils-progress.hpp"
 #include "utils.hpp"
 
 extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
 #include <libavformat/avio.h>
+#include <libavutil/audio_fifo.h>
 #include <libavutil/avutil.h>
+#include <libavutil/channel_layout.h>
 #include <libavutil/dict.h>
+#include <libswresample/swresample.h>
 }
 
 namespace utils_ffmpeg {
 
-#define ASSERT_AV(EXPR)                                                       \
-  do {                                                                        \
-    int code = EXPR;                                                          \
-    if (code < 0) {                                                           \
-      std::vector<char> message;                                              \
-      message.resize(100);                                                    \
-      av_strerror(code, message.data(), message.size());                      \
-      std::ostringstream ostr;                                                \
-      ostr << "[" << __FILE__ << ":" << __LINE__ << "] (AV-" << -code << ": " \
-           << message.data() << ") " << #EXPR;                                \
-      throw std::runtime_error{ostr.str()};                                   \
-    }                                                                         \
+// return `utils::Error` from enclosing function (cf. ASSERT)
+#define ASSERT_AV(EXPR)                                                \
+  do {                                                                 \
+    int code = EXPR;                                                   \
+    if (code < 0) {                                                    \
+      return ::utils_ffmpeg::avError(code, __FILE__, __LINE__, #EXPR); \
+    }                                                                  \
   } while (0)
 
+utils::Error avError(int code, const char* file, int line, const char* expr) {
+  char error[100];
+  av_strerror(code, error, sizeof(error));
+  char message[512];
+  std::snprintf(message, sizeof(message), "[%s:%d] (AV-%d: %s) %s", file,
+                line, -code, error, expr);
+  return utils::Error{"av", message};
+}
+
 //
 // AVDictionary to std::map
 //
@@ -39,16 +51,221 @@ std::map<std::string, std::string> mapFromAVDictionary(
   return result;
 }
 
+//
+// demuxer skips payload of unselected streams (e.g. video of muxed source)
+//
+
+void discardOtherStreams(AVFormatContext* ifmt_ctx, int stream_index) {
+  for (unsigned int i = 0; i < ifmt_ctx->nb_streams; i++) {
+    if (static_cast<int>(i) != stream_index) {
+      ifmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+  }
+}
+
+//
+// AVCodecContext wrapper to decode single stream
+//
+
+// wrappers below are opened by `initialize` after construction so that
+// destructor releases partially opened state on failure
+
+struct Decoder {
+  AVCodecContext* codec_ctx_ = nullptr;
+  AVFrame* frame_ = nullptr;
+
+  utils::Result<void> initialize(const AVStream* stream) {
+    return initialize(stream->codecpar, stream->time_base);
+  }
+
+  utils::Result<void> initialize(const AVCodecParameters* codecpar,
+                                 AVRational time_base) {
+    auto codec = avcodec_find_decoder(codecpar->codec_id);
+    ASSERT(codec);
+    codec_ctx_ = avcodec_alloc_context3(codec);
+    ASSERT(codec_ctx_);
+    ASSERT_AV(avcodec_parameters_to_context(codec_ctx_, codecpar));
+    codec_ctx_->pkt_timebase = time_base;
+    ASSERT_AV(avcodec_open2(codec_ctx_, codec, nullptr));
+    frame_ = av_frame_alloc();
+    ASSERT(frame_);
+    return {};
+  }
+
+  ~Decoder() {
+    av_frame_free(&frame_);
+    avcodec_free_context(&codec_ctx_);
+  }
+
+  // send packet (nullptr to flush) and call `on_frame(frame_)` (returning
+  // `utils::Result<void>`) for each decoded frame
+  template <class F>
+  utils::Result<void> decode(const AVPacket* pkt, F on_frame) {
+    ASSERT_AV(avcodec_send_packet(codec_ctx_, pkt));
+    while (true) {
+      int ret = avcodec_receive_frame(codec_ctx_, frame_);
+      if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+        break;
+      }
+      ASSERT_AV(ret);
+      auto result = on_frame(frame_);
+      av_frame_unref(frame_);
+      TRY(result);
+    }
+    return {};
+  }
+};
+
+//
+// AVCodecContext wrapper to encode single stream
+//
+
+struct Encoder {
+  AVCodecContext* codec_ctx_ = nullptr;
+  AVPacket* pkt_ = nullptr;
+
+  // `configure(codec_ctx_)` sets parameters before opening codec
+  template <class F>
+  utils::Result<void> initialize(const AVCodec* codec, F configure) {
+    codec_ctx_ = avcodec_alloc_context3(codec);
+    ASSERT(codec_ctx_);
+    configure(codec_ctx_);
+    ASSERT_AV(avcodec_open2(codec_ctx_, codec, nullptr));
+    pkt_ = av_packet_alloc();
+    ASSERT(pkt_);
+    return {};
+  }
+
+  ~Encoder() {
+    av_packet_free(&pkt_);
+    avcodec_free_context(&codec_ctx_);
+  }
+
+  // send frame (nullptr to flush) and call `on_packet(pkt_)` (returning
+  // `utils::Result<void>`) for each encoded packet
+  template <class F>
+  utils::Result<void> encode(const AVFrame* frame, F on_packet) {
+    ASSERT_AV(avcodec_send_frame(codec_ctx_, frame));
+    while (true) {
+      int ret = avcodec_receive_packet(codec_ctx_, pkt_);
+      if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+        break;
+      }
+      ASSERT_AV(ret);
+      auto result = on_packet(pkt_);
+      av_packet_unref(pkt_);
+      TRY(result);
+    }
+    return {};
+  }
+};
+
+//
+// SwrContext wrapper to convert decoded frames into encoder's format
+//
+
+// converted samples are queued so that encoder can take fixed size frames
+// (cf. AVCodecContext.frame_size)
+struct Resampler {
+  SwrContext* swr_ctx_ = nullptr;
+  AVAudioFifo* fifo_ = nullptr;
+  AVFrame* convert_frame_ = nullptr;
+  AVFrame* frame_ = nullptr;
+  const AVCodecContext* out_ctx_ = nullptr;
+
+  utils::Result<void> initialize(const AVFrame* in,
+                                 const AVCodecContext* out) {
+    out_ctx_ = out;
+    ASSERT_AV(swr_alloc_set_opts2(
+        &swr_ctx_, &out->ch_layout, out->sample_fmt, out->sample_rate,
+        &in->ch_layout, static_cast<AVSampleFormat>(in->format),
+        in->sample_rate, 0, nullptr));
+    ASSERT_AV(swr_init(swr_ctx_));
+    fifo_ = av_audio_fifo_alloc(out->sample_fmt, out->ch_layout.nb_channels,
+                                out->frame_size > 0 ? out->frame_size : 1);
+    ASSERT(fifo_);
+    convert_frame_ = av_frame_alloc();
+    ASSERT(convert_frame_);
+    frame_ = av_frame_alloc();
+    ASSERT(frame_);
+    return {};
+  }
+
+  ~Resampler() {
+    av_frame_free(&frame_);
+    av_frame_free(&convert_frame_);
+    if (fifo_) {
+      av_audio_fifo_free(fifo_);
+    }
+    swr_free(&swr_ctx_);
+  }
+
+  // convert `in` (nullptr to flush) and queue result
+  utils::Result<void> write(const AVFrame* in) {
+    int in_samples = in ? in->nb_samples : 0;
+    auto in_data =
+        in ? const_cast<const uint8_t**>(in->extended_data) : nullptr;
+    int out_samples = swr_get_out_samples(swr_ctx_, in_samples);
+    ASSERT_AV(out_samples);
+    if (out_samples == 0) {
+      return {};
+    }
+    TRY(allocateFrame(convert_frame_, out_samples));
+    int converted = swr_convert(swr_ctx_, convert_frame_->extended_data,
+                                out_samples, in_data, in_samples);
+    ASSERT_AV(converted);
+    ASSERT(av_audio_fifo_write(
+               fifo_, reinterpret_cast<void**>(convert_frame_->extended_data),
+               converted) == converted);
+    return {};
+  }
+
+  int size() const { return av_audio_fifo_size(fifo_); }
+
+  utils::Result<void> drain(int nb_samples) {
+    ASSERT_AV(av_audio_fifo_drain(fifo_, nb_samples));
+    return {};
+  }
+
+  // dequeue `nb_samples` as frame (valid until next call)
+  utils::Result<AVFrame*> read(int nb_samples) {
+    TRY(allocateFrame(frame_, nb_samples));
+    ASSERT(av_audio_fifo_read(fifo_,
+                              reinterpret_cast<void**>(frame_->extended_data),
+                              nb_samples) == nb_samples);
+    return frame_;
+  }
+
+  utils::Result<void> allocateFrame(AVFrame* frame, int nb_samples) {
+    av_frame_unref(frame);
+    frame->format = out_ctx_->sample_fmt;
+    ASSERT_AV(av_channel_layout_copy(&frame->ch_layout, &out_ctx_->ch_layout));
+    frame->sample_rate = out_ctx_->sample_rate;
+    frame->nb_samples = nb_samples;
+    ASSERT_AV(av_frame_get_buffer(frame, 0));
+    return {};
+  }
+};
+
 //
 // AVIOContext wrapper for in-memory data
 //
 
+// reads `input` in place (caller keeps it alive while demuxing)
 struct BufferInput {
-  AVIOContext* avio_ctx_;
-  std::vector<uint8_t> input_;
+  AVIOContext* avio_ctx_ = nullptr;
+  const uint8_t* input_ = nullptr;
+  size_t input_size_ = 0;
   size_t input_pos_ = 0;
 
-  BufferInput(const std::vector<uint8_t>& input) : input_{input} {
+  utils::Result<void> initialize(const std::vector<uint8_t>& input) {
+    return initialize(input.data(), input.size());
+  }
+
+  utils::Result<void> initialize(const uint8_t* input, size_t input_size) {
+    input_ = input;
+    input_size_ = input_size;
+
     // ffmpeg internal buffer (needs to be allocated on our own initially)
     constexpr size_t AVIO_BUFFER_SIZE = 1 << 12;  // 4K
     auto avio_buffer = reinterpret_cast<uint8_t*>(av_malloc(AVIO_BUFFER_SIZE));
@@ -58,12 +275,18 @@ struct BufferInput {
     avio_ctx_ =
         avio_alloc_context(avio_buffer, AVIO_BUFFER_SIZE, 0, this,
                            BufferInput::readPacket, NULL, BufferInput::seek);
+    if (!avio_ctx_) {
+      av_free(avio_buffer);
+    }
     ASSERT(avio_ctx_);
+    return {};
   }
 
   ~BufferInput() {
-    av_freep(&avio_ctx_->buffer);
-    avio_context_free(&avio_ctx_);
+    if (avio_ctx_) {
+      av_freep(&avio_ctx_->buffer);
+      avio_context_free(&avio_ctx_);
+    }
   }
 
   static int readPacket(void* opaque, uint8_t* buf, int buf_size) {
@@ -72,11 +295,15 @@ struct BufferInput {
   }
 
   int readPacketImpl(uint8_t* buf, int buf_size) {
-    int read_size = std::min<int>(buf_size, input_.size() - input_pos_);
+    // custom AVIOContext doesn't poll AVFormatContext.interrupt_callback
+    if (utils_progress::interrupted()) {
+      return AVERROR_EXIT;
+    }
+    int read_size = std::min<size_t>(buf_size, input_size_ - input_pos_);
     if (read_size == 0) {
       return AVERROR_EOF;
     }
-    std::memcpy(buf, &input_[input_pos_], read_size);
+    std::memcpy(buf, input_ + input_pos_, read_size);
     input_pos_ += read_size;
     return read_size;
   }
@@ -89,16 +316,16 @@ struct BufferInput {
     // cf. io_seek in third_party/FFmpeg/tools/target_dem_fuzzer.c
 
     if (whence == AVSEEK_SIZE) {
-      return input_.size();
+      return input_size_;
     }
 
     if (whence == SEEK_CUR) {
       offset += input_pos_;
     } else if (whence == SEEK_END) {
-      offset = input_.size() - offset;
+      offset = input_size_ - offset;
     }
 
-    if (offset < 0 || input_.size() < (size_t)offset) {
+    if (offset < 0 || input_size_ < (size_t)offset) {
       return -1;
     }
     input_pos_ = (size_t)offset;
@@ -107,10 +334,12 @@ struct BufferInput {
 };
 
 struct BufferOutput {
-  AVIOContext* avio_ctx_;
+  AVIOContext* avio_ctx_ = nullptr;
   std::vector<uint8_t> output_;
+  // called with whole output after each write (e.g. to follow muxed pages)
+  std::function<void(const std::vector<uint8_t>&)> on_write_;
 
-  BufferOutput() {
+  utils::Result<void> initialize() {
     // ffmpeg internal buffer (needs to be allocated on our own initially)
     constexpr size_t AVIO_BUFFER_SIZE = 1 << 12;  // 4K
     auto avio_buffer = reinterpret_cast<uint8_t*>(av_malloc(AVIO_BUFFER_SIZE));
@@ -119,12 +348,18 @@ struct BufferOutput {
     // instantiate AVIOContext
     avio_ctx_ = avio_alloc_context(avio_buffer, AVIO_BUFFER_SIZE, 1, this, NULL,
                                    BufferOutput::writePacket, NULL);
+    if (!avio_ctx_) {
+      av_free(avio_buffer);
+    }
     ASSERT(avio_ctx_);
+    return {};
   }
 
   ~BufferOutput() {
-    av_freep(&avio_ctx_->buffer);
-    avio_context_free(&avio_ctx_);
+    if (avio_ctx_) {
+      av_freep(&avio_ctx_->buffer);
+      avio_context_free(&avio_ctx_);
+    }
   }
 
   static int writePacket(void* opaque, uint8_t* buf, int buf_size) {
@@ -134,6 +369,9 @@ struct BufferOutput {
 
   int writePacketImpl(uint8_t* buf, int buf_size) {
     output_.insert(output_.end(), buf, buf + buf_size);
+    if (on_write_) {
+      on_write_(output_);
+    }
     return buf_size;
   }
 };
@@ -0,0 +1,339 @@
+#pragma once
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <optional>
+#include <string>
+#include "utils.hpp"
+
+// minimal HTTP/1.1 client for range requests over plain POSIX sockets
+// (native build only, no TLS). failure is returned as utils::Error with code
+// "http" so that it can be reported from worker thread (cf.
+// utils-webm-fetch.hpp).
+
+namespace utils_http {
+
+constexpr size_t MAX_HEADER_SIZE = 64 << 10;
+constexpr int MAX_REDIRECTS = 5;
+constexpr int POLL_INTERVAL_MS = 100;
+constexpr double IDLE_TIMEOUT = 30;  // seconds without receiving any byte
+
+utils::Error httpError(const std::string& message) {
+  return utils::Error{"http", message};
+}
+
+//
+// url
+//
+
+struct Url {
+  std::string host;  // without brackets of IPv6 literal
+  std::string port;
+  std::string path;  // including query
+
+  // host and port as in url (e.g. "[::1]:8080")
+  std::string authority() const {
+    auto result = host.find(':') == std::string::npos ? host : "[" + host + "]";
+    return port == "80" ? result : result + ":" + port;
+  }
+};
+
+utils::Result<Url> parseUrl(const std::string& url) {
+  const std::string scheme = "http://";
+  if (url.compare(0, scheme.size(), scheme) != 0) {
+    return httpError("only http:// url is supported (" + url + ")");
+  }
+  auto path_start = url.find('/', scheme.size());
+  auto authority = url.substr(scheme.size(), path_start - scheme.size());
+  Url result;
+  result.path =
+      path_start == std::string::npos ? "/" : url.substr(path_start);
+  // IPv6 literal is bracketed (e.g. "[::1]:8080") since it contains ':'
+  size_t host_end = 0;
+  if (!authority.empty() && authority[0] == '[') {
+    host_end = authority.find(']');
+    if (host_end == std::string::npos) {
+      return httpError("invalid url (" + url + ")");
+    }
+    result.host = authority.substr(1, host_end - 1);
+    host_end++;
+  } else {
+    host_end = authority.find(':');
+    result.host = authority.substr(0, host_end);
+  }
+  if (host_end < authority.size()) {
+    if (authority[host_end] != ':') {
+      return httpError("invalid url (" + url + ")");
+    }
+    result.port = authority.substr(host_end + 1);
+  }
+  if (result.port.empty()) {
+    result.port = "80";
+  }
+  if (result.host.empty()) {
+    return httpError("invalid url (" + url + ")");
+  }
+  return result;
+}
+
+//
+// socket
+//
+
+struct Socket {
+  int fd_ = -1;
+
+  Socket() = default;
+  Socket(const Socket&) = delete;
+  Socket& operator=(const Socket&) = delete;
+
+  ~Socket() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+  }
+
+  utils::Result<void> connect(const Url& url) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addrs = nullptr;
+    int code = getaddrinfo(url.host.c_str(), url.port.c_str(), &hints, &addrs);
+    if (code != 0) {
+      return httpError("getaddrinfo failed (" + url.host +
+                       "): " + gai_strerror(code));
+    }
+    DEFER {
+      freeaddrinfo(addrs);
+    };
+    for (auto addr = addrs; addr; addr = addr->ai_next) {
+      fd_ = ::socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+      if (fd_ < 0) {
+        continue;
+      }
+      if (::connect(fd_, addr->ai_addr, addr->ai_addrlen) == 0) {
+        return {};
+      }
+      ::close(fd_);
+      fd_ = -1;
+    }
+    return httpError("connect failed (" + url.host + ":" + url.port + ")");
+  }
+
+  bool sendAll(const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+      auto n = ::send(fd_, data.data() + sent, data.size() - sent, 0);
+      if (n <= 0) {
+        return false;
+      }
+      sent += n;
+    }
+    return true;
+  }
+
+  // bytes received (0 on EOF, -1 on error, timeout or `stop`)
+  ssize_t receive(uint8_t* buffer,
+                  size_t size,
+                  const std::atomic<bool>* stop) {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::duration<double>(IDLE_TIMEOUT));
+    pollfd pfd{fd_, POLLIN, 0};
+    for (;;) {
+      if (stop && stop->load()) {
+        return -1;
+      }
+      int ready = ::poll(&pfd, 1, POLL_INTERVAL_MS);
+      if (ready > 0) {
+        return ::recv(fd_, buffer, size, 0);
+      }
+      if (ready < 0 || std::chrono::steady_clock::now() >= deadline) {
+        return -1;
+      }
+    }
+  }
+};
+
+//
+// response
+//
+
+struct Response {
+  int status = 0;
+  std::map<std::string, std::string> headers;  // lower case name
+  // from Content-Range (or Content-Length of 200 response)
+  std::optional<uint64_t> total_size;
+};
+
+std::optional<Response> parseResponseHeader(const std::string& header) {
+  Response result;
+  if (std::sscanf(header.c_str(), "HTTP/%*d.%*d %d", &result.status) != 1) {
+    return {};
+  }
+  size_t pos = header.find("\r\n");
+  while (pos != std::string::npos && pos + 2 < header.size()) {
+    size_t line_start = pos + 2;
+    pos = header.find("\r\n", line_start);
+    auto line = header.substr(line_start, pos - line_start);
+    auto colon = line.find(':');
+    if (colon == std::string::npos) {
+      continue;
+    }
+    auto name = line.substr(0, colon);
+    std::transform(name.begin(), name.end(), name.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    auto value_start = line.find_first_not_of(" \t", colon + 1);
+    result.headers[name] =
+        value_start == std::string::npos ? "" : line.substr(value_start);
+  }
+  return result;
+}
+
+std::optional<uint64_t> parseUint(const std::string& s) {
+  if (s.empty() || !std::isdigit(static_cast<unsigned char>(s[0]))) {
+    return {};
+  }
+  errno = 0;
+  auto result = std::strtoull(s.c_str(), nullptr, 10);
+  if (errno == ERANGE) {
+    return {};
+  }
+  return result;
+}
+
+//
+// main API
+//
+
+// GET bytes [begin, end) and pass body to `on_data(data, size)` as it arrives
+// (return false from it to abort). range is emulated when server responds
+// with whole content. `stop` is polled so that other thread can abandon it.
+template <class F>
+utils::Result<Response> fetchRange(std::string url,
+                                   uint64_t begin,
+                                   uint64_t end,
+                                   F on_data,
+                                   const std::atomic<bool>* stop = nullptr) {
+  ASSERT(begin < end);
+  for (int redirect = 0; redirect <= MAX_REDIRECTS; redirect++) {
+    auto parsed = parseUrl(url);
+    if (!parsed.ok()) {
+      return parsed.error();
+    }
+    auto& target = parsed.value();
+    Socket socket;
+    auto connected = socket.connect(target);
+    if (!connected.ok()) {
+      return connected.error();
+    }
+    auto request = "GET " + target.path + " HTTP/1.1\r\n" +
+                   "Host: " + target.authority() + "\r\n" +
+                   "Range: bytes=" + std::to_string(begin) + "-" +
+                   std::to_string(end - 1) + "\r\n" +
+                   "Connection: close\r\n\r\n";
+    if (!socket.sendAll(request)) {
+      return httpError("send failed (" + url + ")");
+    }
+
+    // header
+    uint8_t buffer[64 << 10];
+    std::string header;
+    size_t header_end;
+    for (;;) {
+      auto n = socket.receive(buffer, sizeof(buffer), stop);
+      if (n <= 0) {
+        return httpError("connection closed before header (" + url + ")");
+      }
+      header.append(reinterpret_cast<char*>(buffer), n);
+      header_end = header.find("\r\n\r\n");
+      if (header_end != std::string::npos) {
+        break;
+      }
+      if (header.size() > MAX_HEADER_SIZE) {
+        return httpError("header too large (" + url + ")");
+      }
+    }
+    auto response = parseResponseHeader(header.substr(0, header_end + 2));
+    if (!response) {
+      return httpError("invalid status line (" + url + ")");
+    }
+    auto& headers = response->headers;
+    if (300 <= response->status && response->status < 400 &&
+        headers.count("location")) {
+      auto& location = headers["location"];
+      url = location[0] == '/' ? "http://" + target.authority() + location
+                               : location;
+      continue;
+    }
+    if (headers.count("transfer-encoding") &&
+        headers["transfer-encoding"] != "identity") {
+      return httpError("transfer-encoding is not supported (" + url + ")");
+    }
+
+    // bytes of whole content to skip and to deliver
+    uint64_t skip = 0;
+    auto content_length = parseUint(headers["content-length"]);
+    if (response->status == 206) {
+      // e.g. "bytes 0-1023/4096"
+      unsigned long long first, last, total;
+      if (std::sscanf(headers["content-range"].c_str(), "bytes %llu-%llu/%llu",
+                      &first, &last, &total) != 3 ||
+          first != begin) {
+        return httpError("unexpected content-range (" + url + ")");
+      }
+      response->total_size = total;
+    } else if (response->status == 200) {
+      skip = begin;
+      response->total_size = content_length;
+    } else {
+      return httpError("unexpected status " +
+                       std::to_string(response->status) + " (" + url + ")");
+    }
+    uint64_t remaining = end - begin;
+    if (response->total_size) {
+      remaining = std::min(remaining,
+                           response->total_size.value() -
+                               std::min(begin, response->total_size.value()));
+    }
+
+    // body
+    auto deliver = [&](const uint8_t* data, size_t size) {
+      size_t skipped = std::min<uint64_t>(skip, size);
+      skip -= skipped;
+      size_t n = std::min<uint64_t>(size - skipped, remaining);
+      remaining -= n;
+      return n == 0 || on_data(data + skipped, n);
+    };
+    auto body_start = reinterpret_cast<const uint8_t*>(header.data()) +
+                      header_end + 4;
+    if (!deliver(body_start, header.size() - header_end - 4)) {
+      return httpError("aborted (" + url + ")");
+    }
+    while (remaining > 0) {
+      auto n = socket.receive(buffer, sizeof(buffer), stop);
+      if (n <= 0) {
+        return httpError("connection closed before end of range (" + url +
+                         ")");
+      }
+      if (!deliver(buffer, n)) {
+        return httpError("aborted (" + url + ")");
+      }
+    }
+    return response.value();
+  }
+  return httpError("too many redirects (" + url + ")");
+}
+
+}  // namespace utils_http
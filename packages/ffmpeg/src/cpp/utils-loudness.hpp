@@ -0,0 +1,287 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "utils-simd.hpp"
+#include "utils.hpp"
+
+// EBU R128 integrated loudness (ITU-R BS.1770-4)
+// cf.
+// - https://tech.ebu.ch/docs/tech/tech3341.pdf
+// - https://github.com/jiixyj/libebur128/blob/master/ebur128/ebur128.c
+
+namespace utils_loudness {
+
+using utils_simd::f64x2;
+
+//
+// K-weighting filter
+//
+
+constexpr double PI = 3.14159265358979323846;
+
+// second order IIR coefficients (normalized a0 = 1)
+struct Biquad {
+  double b0, b1, b2, a1, a2;
+};
+
+// "pre-filter" (high shelf) and "RLB" (high pass) for given sample rate
+std::pair<Biquad, Biquad> kWeighting(double sample_rate) {
+  Biquad shelf;
+  {
+    double f0 = 1681.974450955533;
+    double G = 3.999843853973347;
+    double Q = 0.7071752369554196;
+    double K = std::tan(PI * f0 / sample_rate);
+    double Vh = std::pow(10.0, G / 20.0);
+    double Vb = std::pow(Vh, 0.4996667741545416);
+    double a0 = 1.0 + K / Q + K * K;
+    shelf.b0 = (Vh + Vb * K / Q + K * K) / a0;
+    shelf.b1 = 2.0 * (K * K - Vh) / a0;
+    shelf.b2 = (Vh - Vb * K / Q + K * K) / a0;
+    shelf.a1 = 2.0 * (K * K - 1.0) / a0;
+    shelf.a2 = (1.0 - K / Q + K * K) / a0;
+  }
+  Biquad highpass;
+  {
+    double f0 = 38.13547087602444;
+    double Q = 0.5003270373238773;
+    double K = std::tan(PI * f0 / sample_rate);
+    double a0 = 1.0 + K / Q + K * K;
+    highpass.b0 = 1.0;
+    highpass.b1 = -2.0;
+    highpass.b2 = 1.0;
+    highpass.a1 = 2.0 * (K * K - 1.0) / a0;
+    highpass.a2 = (1.0 - K / Q + K * K) / a0;
+  }
+  return {shelf, highpass};
+}
+
+// channel weight G_i (LFE is excluded and surround is boosted for 5.1 layout)
+double channelWeight(int channel, int num_channels) {
+  if (num_channels == 6) {
+    constexpr double WEIGHTS[] = {1.0, 1.0, 1.0, 0.0, 1.41, 1.41};
+    return WEIGHTS[channel];
+  }
+  return 1.0;
+}
+
+//
+// gating block energies
+//
+
+// gating block is 400ms with 75% overlap, so energies are accumulated per 100ms
+// and then combined into blocks at the end
+constexpr double SUBBLOCK_DURATION = 0.1;
+
+struct Subblocks {
+  uint64_t first_ = 0;
+  // sum of channel-weighted squares and number of samples contributed
+  std::vector<double> energies_;
+  std::vector<uint32_t> counts_;
+
+  utils::Result<void> add(uint64_t index, double energy, uint32_t count) {
+    if (energies_.empty()) {
+      first_ = index;
+    }
+    ASSERT(index >= first_);
+    if (index - first_ >= energies_.size()) {
+      energies_.resize(index - first_ + 1, 0);
+      counts_.resize(index - first_ + 1, 0);
+    }
+    energies_[index - first_] += energy;
+    counts_[index - first_] += count;
+    return {};
+  }
+
+  utils::Result<void> merge(const Subblocks& other) {
+    if (other.energies_.empty()) {
+      return {};
+    }
+    if (!energies_.empty() && other.first_ < first_) {
+      // keep `first_` as minimum by re-adding ours onto the other
+      Subblocks copy = other;
+      TRY(copy.merge(*this));
+      *this = std::move(copy);
+      return {};
+    }
+    for (size_t i = 0; i < other.energies_.size(); i++) {
+      TRY(add(other.first_ + i, other.energies_[i], other.counts_[i]));
+    }
+    return {};
+  }
+};
+
+//
+// analyzer for planar float samples
+//
+
+struct Analyzer {
+  const int num_channels_;
+  const uint32_t subblock_size_;
+  Biquad shelf_;
+  Biquad highpass_;
+  // transposed direct form II state of two biquads for each channel pair
+  struct PairState {
+    f64x2 s1[2] = {f64x2::splat(0), f64x2::splat(0)};
+    f64x2 s2[2] = {f64x2::splat(0), f64x2::splat(0)};
+  };
+  std::vector<PairState> states_;
+  std::vector<float> silence_;  // padding lane for odd number of channels
+  Subblocks subblocks_;
+
+  // caller checks `num_channels > 0`
+  Analyzer(int sample_rate, int num_channels)
+      : num_channels_{num_channels},
+        subblock_size_{static_cast<uint32_t>(
+            std::lround(sample_rate * SUBBLOCK_DURATION))} {
+    std::tie(shelf_, highpass_) = kWeighting(sample_rate);
+    states_.resize((num_channels_ + 1) / 2);
+  }
+
+  // `position` is the absolute sample index of `data[c][0]`.
+  // `accumulate = false` only warms up the filter (e.g. decoder pre-roll).
+  utils::Result<void> process(const float* const* data,
+                              size_t num_samples,
+                              int64_t position,
+                              bool accumulate) {
+    if (num_channels_ % 2 == 1 && silence_.size() < num_samples) {
+      silence_.resize(num_samples, 0);
+    }
+    if (!accumulate) {
+      filterRun(data, 0, num_samples);
+      return {};
+    }
+    ASSERT(position >= 0);
+
+    // split into runs not crossing 100ms boundary
+    size_t i = 0;
+    while (i < num_samples) {
+      uint64_t p = static_cast<uint64_t>(position) + i;
+      uint64_t index = p / subblock_size_;
+      size_t end = std::min<size_t>(num_samples,
+                                    i + (subblock_size_ - p % subblock_size_));
+      double energy = filterRun(data, i, end);
+      TRY(subblocks_.add(index, energy, static_cast<uint32_t>(end - i)));
+      i = end;
+    }
+    return {};
+  }
+
+  // filter samples [begin, end) of all channels and return channel-weighted
+  // sum of squares. two channels are processed at once in simd lanes.
+  double filterRun(const float* const* data, size_t begin, size_t end) {
+    const f64x2 sb0 = f64x2::splat(shelf_.b0), sb1 = f64x2::splat(shelf_.b1),
+                sb2 = f64x2::splat(shelf_.b2), sa1 = f64x2::splat(shelf_.a1),
+                sa2 = f64x2::splat(shelf_.a2);
+    const f64x2 hb0 = f64x2::splat(highpass_.b0),
+                hb1 = f64x2::splat(highpass_.b1),
+                hb2 = f64x2::splat(highpass_.b2),
+                ha1 = f64x2::splat(highpass_.a1),
+                ha2 = f64x2::splat(highpass_.a2);
+
+    double energy = 0;
+    for (int c = 0; c < num_channels_; c += 2) {
+      const float* x0 = data[c];
+      const float* x1 = c + 1 < num_channels_ ? data[c + 1] : silence_.data();
+      const f64x2 weight =
+          f64x2::make(channelWeight(c, num_channels_),
+                      c + 1 < num_channels_
+                          ? channelWeight(c + 1, num_channels_)
+                          : 0.0);
+      auto& state = states_[c / 2];
+      f64x2 s1a = state.s1[0], s2a = state.s2[0];
+      f64x2 s1b = state.s1[1], s2b = state.s2[1];
+      f64x2 acc = f64x2::splat(0);
+      for (size_t i = begin; i < end; i++) {
+        f64x2 x = f64x2::make(x0[i], x1[i]);
+        // shelf
+        f64x2 y = sb0 * x + s1a;
+        s1a = sb1 * x - sa1 * y + s2a;
+        s2a = sb2 * x - sa2 * y;
+        // high pass
+        f64x2 z = hb0 * y + s1b;
+        s1b = hb1 * y - ha1 * z + s2b;
+        s2b = hb2 * y - ha2 * z;
+        acc = acc + z * z;
+      }
+      state.s1[0] = s1a;
+      state.s2[0] = s2a;
+      state.s1[1] = s1b;
+      state.s2[1] = s2b;
+      acc = acc * weight;
+      energy += acc.lane0() + acc.lane1();
+    }
+    return energy;
+  }
+};
+
+//
+// gated integration
+//
+
+double energyToLoudness(double energy) {
+  return -0.691 + 10.0 * std::log10(energy);
+}
+
+// integrated loudness (LUFS) of given tracks gated together
+// (single track for "track gain" and all tracks for "album gain")
+double integratedLoudness(const std::vector<const Subblocks*>& tracks,
+                          uint32_t subblock_size) {
+  // mean square of each 400ms block (blocks don't straddle tracks)
+  std::vector<double> blocks;
+  for (auto track : tracks) {
+    auto& e = track->energies_;
+    auto& n = track->counts_;
+    for (size_t i = 0; i + 4 <= e.size(); i++) {
+      bool complete = true;
+      for (size_t j = i; j < i + 4; j++) {
+        complete = complete && n[j] == subblock_size;
+      }
+      if (complete) {
+        blocks.push_back((e[i] + e[i + 1] + e[i + 2] + e[i + 3]) /
+                         (4.0 * subblock_size));
+      }
+    }
+  }
+
+  // absolute gate (-70 LUFS)
+  double sum = 0;
+  size_t count = 0;
+  for (auto z : blocks) {
+    if (energyToLoudness(z) > -70.0) {
+      sum += z;
+      count++;
+    }
+  }
+  if (count == 0) {
+    return -70.0;
+  }
+
+  // relative gate (-10 LU)
+  double relative_gate = energyToLoudness(sum / count) - 10.0;
+  sum = 0;
+  count = 0;
+  for (auto z : blocks) {
+    auto l = energyToLoudness(z);
+    if (l > -70.0 && l > relative_gate) {
+      sum += z;
+      count++;
+    }
+  }
+  if (count == 0) {
+    return -70.0;
+  }
+  return energyToLoudness(sum / count);
+}
+
+// R128_TRACK_GAIN/R128_ALBUM_GAIN value for Opus comment header
+// i.e. Q7.8 fixed point dB gain towards -23 LUFS (cf. RFC 7845 section 5.2.1)
+int toR128Gain(double loudness) {
+  auto gain = std::lround((-23.0 - loudness) * 256.0);
+  return static_cast<int>(std::clamp<long>(gain, -32768, 32767));
+}
+
+}  // namespace utils_loudness
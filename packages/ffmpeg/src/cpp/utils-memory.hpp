@@ -0,0 +1,610 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include "utils-progress.hpp"
+#include "utils.hpp"
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/heap.h>
+#endif
+
+extern "C" {
+#include <libavutil/mem.h>
+}
+
+// heap accounting to size workers and to fail fast before wasm heap grows.
+// including this header replaces global `operator new/delete` so that all
+// std containers (input/output buffers, parsed frames, etc...) are counted.
+// ffmpeg's own allocations (av_malloc) are hooked only when ffmpeg is built
+// with `--malloc-prefix=utils_av_` (emscripten build, cf.
+// UTILS_MEMORY_HOOK_AV_MALLOC). otherwise a single allocation is capped by
+// the budget via `av_max_alloc` and large buffers held by us are added
+// explicitly (cf. Reservation).
+// small blocks of an operation can be served by arena (cf. setArena).
+
+namespace utils_memory {
+
+// bytes attributed to single operation (cf. Scope)
+struct Stats {
+  size_t peak = 0;       // maximum bytes in use during operation
+  size_t current = 0;    // bytes still in use after operation (e.g. result)
+  size_t allocated = 0;  // sum of all allocation sizes
+  size_t allocations = 0;
+  size_t process_peak = 0;  // including buffers allocated outside operation
+  size_t heap_size = 0;     // wasm heap size (0 for native build)
+  size_t arena_size = 0;    // bytes reserved by arena chunks
+};
+
+//
+// global counters
+//
+
+struct Counters {
+  std::atomic<int64_t> current{0};
+  std::atomic<int64_t> peak{0};
+  std::atomic<int64_t> allocated{0};
+  std::atomic<int64_t> allocations{0};
+  std::atomic<int64_t> process_peak{0};
+  // bytes in use when outermost scope started
+  std::atomic<int64_t> baseline{0};
+  // 0 to indicate no budget
+  std::atomic<int64_t> budget{0};
+  std::atomic<int> depth{0};
+  size_t next_budget = 0;
+  bool next_arena = false;
+  Stats last;
+};
+
+Counters& counters() {
+  // never destructed since operator delete can be called after main returns
+  static Counters* instance = new (std::malloc(sizeof(Counters))) Counters{};
+  return *instance;
+}
+
+void updateMax(std::atomic<int64_t>& target, int64_t value) {
+  int64_t prev = target.load();
+  while (prev < value && !target.compare_exchange_weak(prev, value)) {
+  }
+}
+
+// formatted upfront without allocation
+struct BudgetMessage {
+  char text_[160];
+
+  explicit BudgetMessage(size_t requested) {
+    auto& c = counters();
+    std::snprintf(text_, sizeof(text_),
+                  "memory budget exceeded (requested %zu bytes while %lld "
+                  "bytes in use with budget %lld bytes)",
+                  requested,
+                  static_cast<long long>(c.current.load() - c.baseline.load()),
+                  static_cast<long long>(c.budget.load()));
+  }
+};
+
+utils::Error budgetError(size_t requested) {
+  return utils::Error{"memory_budget", BudgetMessage{requested}.text_};
+}
+
+#ifdef UTILS_HAS_EXCEPTIONS
+// thrown by `operator new` (so that callers catching std::bad_alloc keep
+// working)
+struct BudgetExceeded : std::bad_alloc, utils::ErrorCode {
+  BudgetMessage message_;
+
+  explicit BudgetExceeded(size_t requested) : message_{requested} {}
+
+  const char* what() const noexcept override { return message_.text_; }
+
+  const char* code() const override { return "memory_budget"; }
+};
+#endif
+
+// false (without counting) if budget is exceeded unless `over_budget`
+bool tryAccount(size_t size, bool over_budget = false) {
+  auto& c = counters();
+  int64_t now = c.current.fetch_add(size) + size;
+  int64_t budget = c.budget.load();
+  if (!over_budget && budget > 0 && now - c.baseline.load() > budget) {
+    c.current.fetch_sub(size);
+    return false;
+  }
+  c.allocated.fetch_add(size);
+  c.allocations.fetch_add(1);
+  updateMax(c.peak, now);
+  updateMax(c.process_peak, now);
+  return true;
+}
+
+//
+// allocation with size header
+// (header ends with requested size and arena size class (0 if malloc-ed))
+//
+
+constexpr size_t HEADER_SIZE = alignof(std::max_align_t);
+static_assert(HEADER_SIZE >= 2 * sizeof(size_t) && 16 % HEADER_SIZE == 0);
+
+size_t& headerSize(void* ptr) {
+  return reinterpret_cast<size_t*>(ptr)[-1];
+}
+
+size_t& headerClass(void* ptr) {
+  return reinterpret_cast<size_t*>(ptr)[-2];
+}
+
+//
+// arena
+//
+
+// blocks up to ARENA_MAX_BLOCK are carved out of chunks and recycled through
+// free list of each size class. when operation ends, chunks are rewound at
+// once for next operation, so that steady state workers keep reusing same
+// memory instead of fragmenting (or growing) wasm heap. chunk still holding
+// blocks which outlive the operation (e.g. result, embind object grown
+// within operation) is detached from arena instead and freed by deallocation
+// of its last block.
+
+constexpr size_t ARENA_CHUNK_SIZE = 1 << 20;
+constexpr size_t ARENA_MAX_BLOCK = 64 << 10;
+
+// 16 bytes step up to 128, then 4 classes per power of two (25% waste at most)
+constexpr std::array<size_t, 44> ARENA_CLASSES = []() {
+  std::array<size_t, 44> result{};
+  size_t n = 0;
+  for (size_t size = 16; size <= 128; size += 16) {
+    result[n++] = size;
+  }
+  for (size_t base = 128; base < ARENA_MAX_BLOCK; base *= 2) {
+    for (size_t k = 1; k <= 4; k++) {
+      result[n++] = base + base / 4 * k;
+    }
+  }
+  return result;
+}();
+static_assert(ARENA_CLASSES.back() == ARENA_MAX_BLOCK);
+
+// aligned to ARENA_CHUNK_SIZE so that block finds its chunk by address
+struct ArenaChunk {
+  ArenaChunk* next;
+  size_t live;    // blocks not freed yet
+  bool detached;  // left by finished operation
+};
+
+constexpr size_t ARENA_CHUNK_HEADER =
+    (sizeof(ArenaChunk) + HEADER_SIZE - 1) / HEADER_SIZE * HEADER_SIZE;
+
+ArenaChunk* chunkOf(void* ptr) {
+  return reinterpret_cast<ArenaChunk*>(reinterpret_cast<uintptr_t>(ptr) &
+                                       ~(ARENA_CHUNK_SIZE - 1));
+}
+
+struct Arena {
+  std::mutex mutex_;
+  ArenaChunk* chunks_ = nullptr;  // in allocation order (except detached)
+  ArenaChunk* last_ = nullptr;
+  ArenaChunk* current_ = nullptr;
+  size_t used_ = 0;  // bytes carved from current_
+  size_t size_ = 0;  // including detached chunks
+  std::array<void*, ARENA_CLASSES.size()> free_{};
+
+  // nullptr if too large or chunk cannot be allocated
+  void* allocate(size_t size) {
+    if (size > ARENA_MAX_BLOCK) {
+      return nullptr;
+    }
+    size_t index = std::lower_bound(ARENA_CLASSES.begin(), ARENA_CLASSES.end(),
+                                    std::max<size_t>(size, 1)) -
+                   ARENA_CLASSES.begin();
+    std::lock_guard<std::mutex> lock{mutex_};
+    void* ptr = free_[index];
+    if (ptr) {
+      free_[index] = *reinterpret_cast<void**>(ptr);
+    } else {
+      ptr = carve(HEADER_SIZE + ARENA_CLASSES[index]);
+      if (!ptr) {
+        return nullptr;
+      }
+    }
+    chunkOf(ptr)->live++;
+    headerSize(ptr) = size;
+    headerClass(ptr) = index + 1;
+    return ptr;
+  }
+
+  void deallocate(void* ptr) {
+    size_t index = headerClass(ptr) - 1;
+    auto chunk = chunkOf(ptr);
+    std::lock_guard<std::mutex> lock{mutex_};
+    chunk->live--;
+    if (chunk->detached) {
+      if (chunk->live == 0) {
+        std::free(chunk);
+        size_ -= ARENA_CHUNK_SIZE;
+      }
+      return;
+    }
+    *reinterpret_cast<void**>(ptr) = free_[index];
+    free_[index] = ptr;
+  }
+
+  // `size_` changes when detached chunk is freed by other thread
+  size_t size() {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return size_;
+  }
+
+  // detach chunks with live blocks and rewind the rest to the first chunk
+  void release() {
+    std::lock_guard<std::mutex> lock{mutex_};
+    ArenaChunk** link = &chunks_;
+    last_ = nullptr;
+    while (auto chunk = *link) {
+      if (chunk->live > 0) {
+        chunk->detached = true;
+        *link = chunk->next;
+        continue;
+      }
+      last_ = chunk;
+      link = &chunk->next;
+    }
+    current_ = chunks_;
+    used_ = ARENA_CHUNK_HEADER;
+    free_.fill(nullptr);
+  }
+
+  void* carve(size_t block_size) {
+    if (!current_ || used_ + block_size > ARENA_CHUNK_SIZE) {
+      if (current_ && current_->next) {
+        current_ = current_->next;
+      } else {
+        auto chunk = reinterpret_cast<ArenaChunk*>(
+            std::aligned_alloc(ARENA_CHUNK_SIZE, ARENA_CHUNK_SIZE));
+        if (!chunk) {
+          return nullptr;
+        }
+        *chunk = ArenaChunk{nullptr, 0, false};
+        (last_ ? last_->next : chunks_) = chunk;
+        last_ = current_ = chunk;
+        size_ += ARENA_CHUNK_SIZE;
+      }
+      used_ = ARENA_CHUNK_HEADER;
+    }
+    auto block = reinterpret_cast<uint8_t*>(current_) + used_;
+    used_ += block_size;
+    return block + HEADER_SIZE;
+  }
+};
+
+Arena& arena() {
+  // never destructed for the same reason as `counters`
+  static Arena* instance = new (std::malloc(sizeof(Arena))) Arena{};
+  return *instance;
+}
+
+// arena serves only the thread running operation (cf. Scope) and blocks
+// freed elsewhere (e.g. parallelFor workers) go back under lock
+bool& arenaThread() {
+  thread_local bool value = false;
+  return value;
+}
+
+// nullptr if budget is exceeded or malloc fails (for nothrow operator new)
+void* tryAllocate(size_t size, size_t align, bool over_budget = false) {
+  size_t header = std::max(HEADER_SIZE, align);
+  if (!tryAccount(size, over_budget)) {
+    return nullptr;
+  }
+  if (align <= HEADER_SIZE && arenaThread()) {
+    if (void* ptr = arena().allocate(size)) {
+      return ptr;
+    }
+  }
+  void* base = align <= HEADER_SIZE
+                   ? std::malloc(header + size)
+                   : std::aligned_alloc(
+                         align, (header + size + align - 1) / align * align);
+  if (!base) {
+    counters().current.fetch_sub(size);
+    return nullptr;
+  }
+  auto ptr = reinterpret_cast<uint8_t*>(base) + header;
+  headerSize(ptr) = size;
+  headerClass(ptr) = 0;
+  return ptr;
+}
+
+// for `operator new` which cannot return error. with exceptions, failure
+// throws std::bad_alloc (BudgetExceeded if budget is exceeded). without
+// exceptions, exceeding budget is reported by `utils_progress::fail` so that
+// the operation returns error at its next check, and the allocation is
+// served over budget meanwhile. malloc failure aborts.
+void* allocate(size_t size, size_t align) {
+  void* ptr = tryAllocate(size, align);
+  if (ptr) {
+    return ptr;
+  }
+  auto& c = counters();
+  int64_t in_use = c.current.load() - c.baseline.load();
+  int64_t budget = c.budget.load();
+  bool exceeded = budget > 0 && in_use + static_cast<int64_t>(size) > budget;
+#ifdef UTILS_HAS_EXCEPTIONS
+  if (exceeded) {
+    throw BudgetExceeded{size};
+  }
+  throw std::bad_alloc{};
+#else
+  if (exceeded) {
+    utils_progress::fail("memory_budget", BudgetMessage{size}.text_);
+    ptr = tryAllocate(size, align, true);
+    if (ptr) {
+      return ptr;
+    }
+  }
+  std::fprintf(stderr, "[out_of_memory] requested %zu bytes\n", size);
+  std::abort();
+#endif
+}
+
+void deallocate(void* ptr, size_t align) {
+  if (!ptr) {
+    return;
+  }
+  size_t header = std::max(HEADER_SIZE, align);
+  counters().current.fetch_sub(headerSize(ptr));
+  if (headerClass(ptr) != 0) {
+    arena().deallocate(ptr);
+    return;
+  }
+  std::free(reinterpret_cast<uint8_t*>(ptr) - header);
+}
+
+// nullptr (with `ptr` intact) on failure as std::realloc
+void* tryReallocate(void* ptr, size_t size) {
+  if (!ptr) {
+    return tryAllocate(size, 0);
+  }
+  void* result = tryAllocate(size, 0);
+  if (result) {
+    std::memcpy(result, ptr, std::min(size, headerSize(ptr)));
+    deallocate(ptr, 0);
+  }
+  return result;
+}
+
+//
+// main API
+//
+
+// budget (in bytes) applied to subsequent operations (0 to disable)
+void setBudget(size_t budget) {
+  counters().next_budget = budget;
+}
+
+// serve small allocations of subsequent operations from arena
+void setArena(bool enabled) {
+  counters().next_arena = enabled;
+}
+
+// stats of last finished operation
+Stats lastStats() {
+  return counters().last;
+}
+
+// attribute allocations to single operation. nested scopes are no-op so that
+// e.g. `convert` calling `split` is measured once.
+struct Scope {
+  bool outermost_ = false;
+
+  Scope() {
+    auto& c = counters();
+    outermost_ = c.depth.fetch_add(1) == 0;
+    if (!outermost_) {
+      return;
+    }
+    int64_t current = c.current.load();
+    c.baseline = current;
+    c.peak = current;
+    c.allocated = 0;
+    c.allocations = 0;
+    c.budget = static_cast<int64_t>(c.next_budget);
+    arenaThread() = c.next_arena;
+    if (c.next_budget > 0) {
+      av_max_alloc(std::min<size_t>(c.next_budget, INT_MAX));
+    }
+  }
+
+  ~Scope() {
+    auto& c = counters();
+    c.depth.fetch_sub(1);
+    if (!outermost_) {
+      return;
+    }
+    int64_t baseline = c.baseline.load();
+    c.budget = 0;
+    av_max_alloc(INT_MAX);
+    arenaThread() = false;
+    arena().release();
+    auto& last = c.last;
+    last.peak = std::max<int64_t>(c.peak.load() - baseline, 0);
+    last.current = std::max<int64_t>(c.current.load() - baseline, 0);
+    last.allocated = c.allocated.load();
+    last.allocations = c.allocations.load();
+    last.process_peak = c.process_peak.load();
+#ifdef __EMSCRIPTEN__
+    last.heap_size = emscripten_get_heap_size();
+#endif
+    last.arena_size = arena().size();
+  }
+};
+
+// account buffers allocated outside of `operator new` (e.g. av_malloc-ed
+// packets) while they are alive
+struct Reservation {
+  size_t size_ = 0;
+
+  utils::Result<void> add(size_t size) {
+#ifndef UTILS_MEMORY_HOOK_AV_MALLOC
+    if (!tryAccount(size)) {
+      return budgetError(size);
+    }
+    size_ += size;
+#endif
+    return {};
+  }
+
+  ~Reservation() { counters().current.fetch_sub(size_); }
+};
+
+std::string formatStats(const Stats& stats) {
+  std::ostringstream ostr;
+  ostr << "peak = " << stats.peak << ", current = " << stats.current
+       << ", allocated = " << stats.allocated
+       << ", allocations = " << stats.allocations
+       << ", process_peak = " << stats.process_peak
+       << ", heap_size = " << stats.heap_size
+       << ", arena_size = " << stats.arena_size;
+  return ostr.str();
+}
+
+}  // namespace utils_memory
+
+//
+// replace global operator new/delete
+// (every variant is defined since e.g. sanitizer runtime provides its own)
+//
+
+void* operator new(std::size_t size) {
+  return utils_memory::allocate(size, 0);
+}
+
+void* operator new[](std::size_t size) {
+  return utils_memory::allocate(size, 0);
+}
+
+void* operator new(std::size_t size, std::align_val_t align) {
+  return utils_memory::allocate(size, static_cast<size_t>(align));
+}
+
+void* operator new[](std::size_t size, std::align_val_t align) {
+  return utils_memory::allocate(size, static_cast<size_t>(align));
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return utils_memory::tryAllocate(size, 0);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return utils_memory::tryAllocate(size, 0);
+}
+
+void* operator new(std::size_t size,
+                   std::align_val_t align,
+                   const std::nothrow_t&) noexcept {
+  return utils_memory::tryAllocate(size, static_cast<size_t>(align));
+}
+
+void* operator new[](std::size_t size,
+                     std::align_val_t align,
+                     const std::nothrow_t&) noexcept {
+  return utils_memory::tryAllocate(size, static_cast<size_t>(align));
+}
+
+void operator delete(void* ptr) noexcept {
+  utils_memory::deallocate(ptr, 0);
+}
+
+void operator delete[](void* ptr) noexcept {
+  utils_memory::deallocate(ptr, 0);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  utils_memory::deallocate(ptr, 0);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+  utils_memory::deallocate(ptr, 0);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  utils_memory::deallocate(ptr, 0);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  utils_memory::deallocate(ptr, 0);
+}
+
+void operator delete(void* ptr, std::align_val_t align) noexcept {
+  utils_memory::deallocate(ptr, static_cast<size_t>(align));
+}
+
+void operator delete[](void* ptr, std::align_val_t align) noexcept {
+  utils_memory::deallocate(ptr, static_cast<size_t>(align));
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t align) noexcept {
+  utils_memory::deallocate(ptr, static_cast<size_t>(align));
+}
+
+void operator delete[](void* ptr,
+                       std::size_t,
+                       std::align_val_t align) noexcept {
+  utils_memory::deallocate(ptr, static_cast<size_t>(align));
+}
+
+void operator delete(void* ptr,
+                     std::align_val_t align,
+                     const std::nothrow_t&) noexcept {
+  utils_memory::deallocate(ptr, static_cast<size_t>(align));
+}
+
+void operator delete[](void* ptr,
+                       std::align_val_t align,
+                       const std::nothrow_t&) noexcept {
+  utils_memory::deallocate(ptr, static_cast<size_t>(align));
+}
+
+//
+// av_malloc hook (ffmpeg configured with --malloc-prefix=utils_av_)
+//
+
+#ifdef UTILS_MEMORY_HOOK_AV_MALLOC
+extern "C" {
+
+void* utils_av_malloc(size_t size) {
+  return utils_memory::tryAllocate(size, 0);
+}
+
+void* utils_av_realloc(void* ptr, size_t size) {
+  return utils_memory::tryReallocate(ptr, size);
+}
+
+void utils_av_free(void* ptr) {
+  utils_memory::deallocate(ptr, 0);
+}
+
+// ffmpeg built with --disable-asm doesn't request more than 16 bytes
+int utils_av_posix_memalign(void** ptr, size_t align, size_t size) {
+  *ptr = align <= utils_memory::HEADER_SIZE
+             ? utils_memory::tryAllocate(size, 0)
+             : nullptr;
+  return *ptr ? 0 : ENOMEM;
+}
+
+void* utils_av_memalign(size_t align, size_t size) {
+  return align <= utils_memory::HEADER_SIZE
+             ? utils_memory::tryAllocate(size, 0)
+             : nullptr;
+}
+}
+#endif
@@ -0,0 +1,551 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+#include "nlohmann-json-optional.hpp"
+#include "utils-memory.hpp"
+#include "utils-progress.hpp"
+#include "utils.hpp"
+
+// fragmented mp4 (e.g. m4a DASH format) counterpart of utils_webm.
+// "sidx" plays the role of webm cue points to map time to byte range and
+// each "moof" + "mdat" pair plays the role of cluster.
+// cf.
+// - ISO/IEC 14496-12 (4.2 Box, 8.8 Movie Fragments, 8.16.3 Segment Index)
+// - packages/ffmpeg/third_party/FFmpeg/libavformat/mov.c
+
+namespace utils_mp4 {
+
+//
+// big endian read/write
+//
+
+uint64_t readBE(const uint8_t* p, int num_bytes) {
+  uint64_t v = 0;
+  for (int i = 0; i < num_bytes; i++) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+void writeBE(uint8_t* p, uint64_t v, int num_bytes) {
+  for (int i = num_bytes - 1; i >= 0; i--) {
+    p[i] = v & 0xff;
+    v >>= 8;
+  }
+}
+
+// sequential reader within single box body. reading past the end gives zero
+// and marks reader as failed, so that caller checks `ok()` once per field
+// group instead of per read.
+struct BoxReader {
+  const uint8_t* data_;
+  size_t end_;
+  size_t pos_;
+  bool failed_ = false;
+
+  uint64_t read(int num_bytes) {
+    if (failed_ || pos_ + num_bytes > end_) {
+      failed_ = true;
+      return 0;
+    }
+    auto v = readBE(data_ + pos_, num_bytes);
+    pos_ += num_bytes;
+    return v;
+  }
+
+  void skip(size_t num_bytes) {
+    if (failed_ || num_bytes > end_ - pos_) {
+      failed_ = true;
+      return;
+    }
+    pos_ += num_bytes;
+  }
+
+  bool ok() const { return !failed_; }
+};
+
+//
+// box header
+//
+
+struct Box {
+  std::string type;
+  size_t start;  // offset of box header
+  size_t body;   // offset of box body
+  size_t end;
+
+  BoxReader reader(const uint8_t* data) const { return {data, end, body}; }
+};
+
+// std::nullopt if box header or body is truncated
+std::optional<Box> readBox(const uint8_t* data, size_t size, size_t pos) {
+  if (pos + 8 > size) {
+    return {};
+  }
+  Box box;
+  box.start = pos;
+  box.body = pos + 8;
+  box.type = std::string(reinterpret_cast<const char*>(data + pos + 4), 4);
+  uint64_t box_size = readBE(data + pos, 4);
+  if (box_size == 1) {
+    if (pos + 16 > size) {
+      return {};
+    }
+    box_size = readBE(data + pos + 8, 8);
+    box.body = pos + 16;
+  } else if (box_size == 0) {
+    // extends to end of file
+    box_size = size - pos;
+  }
+  if (box.type == "uuid") {
+    box.body += 16;
+  }
+  if (box_size < box.body - pos || box_size > size - pos) {
+    return {};
+  }
+  box.end = pos + box_size;
+  return box;
+}
+
+// complete child boxes within [begin, end)
+std::vector<Box> readBoxes(const uint8_t* data, size_t begin, size_t end) {
+  std::vector<Box> boxes;
+  size_t pos = begin;
+  while (auto box = readBox(data, end, pos)) {
+    boxes.push_back(box.value());
+    pos = box->end;
+  }
+  return boxes;
+}
+
+const Box* findBox(const std::vector<Box>& boxes, const std::string& type) {
+  auto found = std::find_if(boxes.begin(), boxes.end(),
+                            [&](auto& box) { return box.type == type; });
+  return found == boxes.end() ? nullptr : &*found;
+}
+
+//
+// simple structs
+//
+
+struct SimpleTrack {
+  uint32_t track_id;
+  uint32_t timescale;        // mdhd
+  std::string handler_type;  // e.g. "soun", "vide"
+
+  OPTIONAL__NLOHMANN_DEFINE_TYPE(SimpleTrack,
+                                 track_id,
+                                 timescale,
+                                 handler_type);
+};
+
+// single sidx reference (subsegment) with absolute byte range
+struct SimpleSegment {
+  uint64_t start_byte;
+  uint64_t end_byte;
+  double start_time;  // in seconds
+  double duration;
+
+  OPTIONAL__NLOHMANN_DEFINE_TYPE(SimpleSegment,
+                                 start_byte,
+                                 end_byte,
+                                 start_time,
+                                 duration);
+};
+
+struct SimpleMetadata {
+  // [0, init_end) is initialization segment (ftyp + moov)
+  uint64_t init_end = 0;
+  uint32_t timescale = 0;  // mvhd
+  double duration = 0;     // in seconds
+  std::vector<SimpleTrack> tracks;
+  std::vector<SimpleSegment> segments;
+
+  OPTIONAL__NLOHMANN_DEFINE_TYPE(SimpleMetadata,
+                                 init_end,
+                                 timescale,
+                                 duration,
+                                 tracks,
+                                 segments);
+};
+
+// sample within fragment as byte range of input buffer (no copy)
+struct SimpleFrame {
+  uint32_t track_id;
+  uint64_t decode_time;  // in track timescale
+  uint32_t duration;
+  size_t offset;
+  uint32_t size;
+};
+
+// moof + mdat pair
+struct SimpleFragment {
+  size_t start;
+  size_t end;
+  // for single track fragments (e.g. audio only DASH format)
+  uint32_t track_id = 0;
+  uint64_t base_decode_time = 0;
+  // offset of tfdt box body to patch timestamp in place
+  std::optional<size_t> tfdt_body;
+};
+
+//
+// parse moov and sidx
+//
+
+// mvhd and mdhd share the layout up to timescale/duration
+utils::Result<std::pair<uint32_t, uint64_t>> parseTimescaleDuration(
+    const uint8_t* data,
+    const Box& box) {
+  auto reader = box.reader(data);
+  auto version = reader.read(1);
+  reader.skip(3);
+  reader.skip(version == 1 ? 16 : 8);
+  uint32_t timescale = reader.read(4);
+  uint64_t duration = reader.read(version == 1 ? 8 : 4);
+  ASSERT(reader.ok());
+  return std::pair{timescale, duration};
+}
+
+utils::Result<SimpleTrack> parseTrak(const uint8_t* data, const Box& trak) {
+  SimpleTrack track{};
+  auto children = readBoxes(data, trak.body, trak.end);
+
+  auto tkhd = findBox(children, "tkhd");
+  ASSERT(tkhd);
+  auto reader = tkhd->reader(data);
+  auto version = reader.read(1);
+  reader.skip(3 + (version == 1 ? 16 : 8));
+  track.track_id = reader.read(4);
+  ASSERT(reader.ok());
+
+  auto mdia = findBox(children, "mdia");
+  ASSERT(mdia);
+  auto mdia_children = readBoxes(data, mdia->body, mdia->end);
+  auto mdhd = findBox(mdia_children, "mdhd");
+  ASSERT(mdhd);
+  TRY_ASSIGN(auto timescale_duration, parseTimescaleDuration(data, *mdhd));
+  track.timescale = timescale_duration.first;
+  auto hdlr = findBox(mdia_children, "hdlr");
+  if (hdlr) {
+    // version/flags and pre_defined precede handler_type
+    auto hdlr_reader = hdlr->reader(data);
+    hdlr_reader.skip(8);
+    auto handler_type = data + hdlr_reader.pos_;
+    hdlr_reader.skip(4);
+    ASSERT(hdlr_reader.ok());
+    track.handler_type =
+        std::string(reinterpret_cast<const char*>(handler_type), 4);
+  }
+  return track;
+}
+
+utils::Result<void> parseSidx(const uint8_t* data,
+                              const Box& sidx,
+                              SimpleMetadata& result) {
+  auto reader = sidx.reader(data);
+  auto version = reader.read(1);
+  reader.skip(3);
+  reader.skip(4);  // reference_ID
+  double timescale = reader.read(4);
+  ASSERT(timescale > 0);
+  uint64_t earliest_presentation_time = reader.read(version == 1 ? 8 : 4);
+  uint64_t first_offset = reader.read(version == 1 ? 8 : 4);
+  reader.skip(2);
+  auto reference_count = reader.read(2);
+  ASSERT(reader.ok());
+
+  uint64_t offset = sidx.end + first_offset;
+  uint64_t time = earliest_presentation_time;
+  for (uint64_t i = 0; i < reference_count; i++) {
+    auto reference = reader.read(4);
+    auto duration = reader.read(4);
+    reader.skip(4);
+    ASSERT(reader.ok());
+    // hierarchical sidx (reference_type = 1) is not supported
+    ASSERT(!(reference >> 31));
+    uint64_t size = reference & 0x7fffffff;
+    result.segments.push_back(SimpleSegment{
+        offset, offset + size, time / timescale, duration / timescale});
+    offset += size;
+    time += duration;
+  }
+  return {};
+}
+
+// parse leading part of file (ftyp, moov and sidx)
+utils::Result<SimpleMetadata> parseMetadata(
+    const std::vector<uint8_t>& buffer) {
+  SimpleMetadata result;
+  auto data = buffer.data();
+  for (auto& box : readBoxes(data, 0, buffer.size())) {
+    if (box.type == "moov") {
+      result.init_end = box.end;
+      auto children = readBoxes(data, box.body, box.end);
+      auto mvhd = findBox(children, "mvhd");
+      ASSERT(mvhd);
+      TRY_ASSIGN(auto timescale_duration,
+                 parseTimescaleDuration(data, *mvhd));
+      auto [timescale, duration] = timescale_duration;
+      result.timescale = timescale;
+      result.duration = timescale > 0 ? double(duration) / timescale : 0;
+      for (auto& child : children) {
+        if (child.type == "trak") {
+          TRY_ASSIGN(auto track, parseTrak(data, child));
+          result.tracks.push_back(std::move(track));
+        }
+      }
+    }
+    if (box.type == "sidx" && result.segments.empty()) {
+      TRY(parseSidx(data, box, result));
+    }
+    if (box.type == "moof") {
+      break;
+    }
+  }
+  ASSERT(result.init_end > 0);
+
+  // mvhd duration is usually zero for fragmented file
+  if (result.duration == 0 && !result.segments.empty()) {
+    auto& last = result.segments.back();
+    result.duration = last.start_time + last.duration;
+  }
+  return result;
+}
+
+//
+// parse moof and mdat
+//
+
+// tfhd flags
+constexpr uint32_t TFHD_BASE_DATA_OFFSET = 0x1;
+constexpr uint32_t TFHD_SAMPLE_DESCRIPTION_INDEX = 0x2;
+constexpr uint32_t TFHD_DEFAULT_SAMPLE_DURATION = 0x8;
+constexpr uint32_t TFHD_DEFAULT_SAMPLE_SIZE = 0x10;
+constexpr uint32_t TFHD_DEFAULT_SAMPLE_FLAGS = 0x20;
+
+// trun flags
+constexpr uint32_t TRUN_DATA_OFFSET = 0x1;
+constexpr uint32_t TRUN_FIRST_SAMPLE_FLAGS = 0x4;
+constexpr uint32_t TRUN_SAMPLE_DURATION = 0x100;
+constexpr uint32_t TRUN_SAMPLE_SIZE = 0x200;
+constexpr uint32_t TRUN_SAMPLE_FLAGS = 0x400;
+constexpr uint32_t TRUN_SAMPLE_COMPOSITION_TIME_OFFSET = 0x800;
+
+// collect frames of `traf` (sample data is assumed to be in following mdat)
+utils::Result<void> parseTraf(const uint8_t* data,
+                              const Box& moof,
+                              const Box& traf,
+                              SimpleFragment& fragment,
+                              std::vector<SimpleFrame>& frames) {
+  auto children = readBoxes(data, traf.body, traf.end);
+
+  // tfhd
+  auto tfhd = findBox(children, "tfhd");
+  ASSERT(tfhd);
+  auto reader = tfhd->reader(data);
+  uint32_t tfhd_flags = reader.read(4) & 0xffffff;
+  uint32_t track_id = reader.read(4);
+  // absolute base offset cannot be resolved within sliced buffer
+  ASSERT(!(tfhd_flags & TFHD_BASE_DATA_OFFSET));
+  if (tfhd_flags & TFHD_SAMPLE_DESCRIPTION_INDEX) {
+    reader.skip(4);
+  }
+  uint32_t default_duration =
+      tfhd_flags & TFHD_DEFAULT_SAMPLE_DURATION ? reader.read(4) : 0;
+  uint32_t default_size =
+      tfhd_flags & TFHD_DEFAULT_SAMPLE_SIZE ? reader.read(4) : 0;
+  if (tfhd_flags & TFHD_DEFAULT_SAMPLE_FLAGS) {
+    reader.skip(4);
+  }
+  ASSERT(reader.ok());
+
+  // tfdt
+  uint64_t decode_time = 0;
+  auto tfdt = findBox(children, "tfdt");
+  if (tfdt) {
+    auto tfdt_reader = tfdt->reader(data);
+    auto version = tfdt_reader.read(1);
+    tfdt_reader.skip(3);
+    decode_time = tfdt_reader.read(version == 1 ? 8 : 4);
+    ASSERT(tfdt_reader.ok());
+    fragment.tfdt_body = tfdt->body;
+  }
+  fragment.track_id = track_id;
+  fragment.base_decode_time = decode_time;
+
+  // trun (data offset is relative to moof i.e. default-base-is-moof). trun
+  // without data offset continues right after the previous trun's data
+  // (cf. ISO/IEC 14496-12 section 8.8.8)
+  size_t offset = moof.start;
+  for (auto& trun : children) {
+    if (trun.type != "trun") {
+      continue;
+    }
+    auto trun_reader = trun.reader(data);
+    uint32_t flags = trun_reader.read(4) & 0xffffff;
+    auto sample_count = trun_reader.read(4);
+    if (flags & TRUN_DATA_OFFSET) {
+      offset = moof.start + static_cast<int32_t>(trun_reader.read(4));
+    }
+    if (flags & TRUN_FIRST_SAMPLE_FLAGS) {
+      trun_reader.skip(4);
+    }
+    ASSERT(trun_reader.ok());
+    for (uint64_t i = 0; i < sample_count; i++) {
+      SimpleFrame frame{track_id, decode_time, default_duration, offset,
+                        default_size};
+      if (flags & TRUN_SAMPLE_DURATION) {
+        frame.duration = trun_reader.read(4);
+      }
+      if (flags & TRUN_SAMPLE_SIZE) {
+        frame.size = trun_reader.read(4);
+      }
+      if (flags & TRUN_SAMPLE_FLAGS) {
+        trun_reader.skip(4);
+      }
+      if (flags & TRUN_SAMPLE_COMPOSITION_TIME_OFFSET) {
+        trun_reader.skip(4);
+      }
+      ASSERT(trun_reader.ok());
+      frames.push_back(frame);
+      offset += frame.size;
+      decode_time += frame.duration;
+    }
+  }
+  return {};
+}
+
+// parse complete moof/mdat pairs in buffer (e.g. sliced by SimpleSegment)
+utils::Result<std::pair<std::vector<SimpleFragment>, std::vector<SimpleFrame>>>
+parseFragments(const std::vector<uint8_t>& buffer) {
+  std::vector<SimpleFragment> fragments;
+  std::vector<SimpleFrame> frames;
+  auto data = buffer.data();
+  auto boxes = readBoxes(data, 0, buffer.size());
+  for (size_t i = 0; i + 1 < boxes.size(); i++) {
+    auto& moof = boxes[i];
+    auto& mdat = boxes[i + 1];
+    if (moof.type != "moof" || mdat.type != "mdat") {
+      continue;
+    }
+    auto& fragment = fragments.emplace_back();
+    fragment.start = moof.start;
+    fragment.end = mdat.end;
+    size_t num_frames = frames.size();
+    for (auto& traf : readBoxes(data, moof.body, moof.end)) {
+      if (traf.type == "traf") {
+        TRY(parseTraf(data, moof, traf, fragment, frames));
+      }
+    }
+    for (size_t j = num_frames; j < frames.size(); j++) {
+      ASSERT(mdat.body <= frames[j].offset &&
+             frames[j].offset + frames[j].size <= mdat.end);
+    }
+  }
+  return std::pair{std::move(fragments), std::move(frames)};
+}
+
+//
+// range planner
+//
+
+// byte range of segments covering [start_time, end_time]
+// (-1 to indicate no value)
+struct SegmentRange {
+  double start_byte;
+  double end_byte;    // -1 when reaching the end of file
+  double start_time;  // of first segment
+};
+
+utils::Result<SegmentRange> findSegmentRange(const SimpleMetadata& metadata,
+                                             double start_time,
+                                             double end_time) {
+  auto& segments = metadata.segments;
+  ASSERT(!segments.empty());
+
+  // last segment starting at or before `start_time`
+  size_t first = 0;
+  if (start_time >= 0) {
+    for (size_t i = 0; i < segments.size(); i++) {
+      if (segments[i].start_time <= start_time) {
+        first = i;
+      }
+    }
+  }
+
+  // first segment starting after `end_time`
+  size_t last = segments.size();
+  if (end_time >= 0) {
+    for (size_t i = first; i < segments.size(); i++) {
+      if (segments[i].start_time > end_time) {
+        last = i;
+        break;
+      }
+    }
+  }
+
+  SegmentRange result;
+  result.start_byte = segments[first].start_byte;
+  result.end_byte =
+      last < segments.size() ? static_cast<double>(segments[last].start_byte)
+                             : -1;
+  result.start_time = segments[first].start_time;
+  return result;
+}
+
+//
+// remux
+//
+
+// standalone fragmented m4a from init segment and selected fragments.
+// `fix_timestamp` shifts tfdt so that output starts from zero.
+utils::Result<std::vector<uint8_t>> remux(
+    const std::vector<uint8_t>& metadata_buffer,
+    const std::vector<uint8_t>& fragment_buffer,
+    bool fix_timestamp) {
+  utils_memory::Scope memory_scope;
+  utils_progress::Scope progress_scope;
+  TRY_ASSIGN(auto metadata, parseMetadata(metadata_buffer));
+  TRY_ASSIGN(auto parsed, parseFragments(fragment_buffer));
+  auto& [fragments, frames] = parsed;
+  ASSERT(!fragments.empty());
+
+  std::vector<uint8_t> output;
+  size_t total = metadata.init_end;
+  for (auto& fragment : fragments) {
+    total += fragment.end - fragment.start;
+  }
+  output.reserve(total);
+
+  // init segment (without sidx since it refers to original offsets)
+  output.insert(output.end(), metadata_buffer.begin(),
+                metadata_buffer.begin() + metadata.init_end);
+
+  uint64_t first_decode_time = fragments[0].base_decode_time;
+  // report by bytes since tfdt is in track timescale
+  utils_progress::setTotal(0, fragment_buffer.size());
+  for (auto& fragment : fragments) {
+    TRY(utils_progress::update(0, fragment.start));
+    size_t output_start = output.size();
+    output.insert(output.end(), fragment_buffer.begin() + fragment.start,
+                  fragment_buffer.begin() + fragment.end);
+    if (fix_timestamp && fragment.tfdt_body) {
+      auto p = output.data() + output_start +
+               (fragment.tfdt_body.value() - fragment.start);
+      auto decode_time = fragment.base_decode_time - first_decode_time;
+      if (p[0] == 1) {
+        writeBE(p + 4, decode_time, 8);
+      } else {
+        writeBE(p + 4, decode_time, 4);
+      }
+    }
+  }
+  return output;
+}
+
+}  // namespace utils_mp4
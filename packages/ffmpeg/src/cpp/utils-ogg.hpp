@@ -0,0 +1,878 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+#include "utils-memory.hpp"
+#include "utils-progress.hpp"
+#include "utils.hpp"
+
+// rewrite OpusTags of ogg opus, add Skeleton keyframe index and chain streams
+// without touching audio pages
+// (cf. https://www.rfc-editor.org/rfc/rfc3533,
+//  https://www.rfc-editor.org/rfc/rfc7845 and
+//  https://wiki.xiph.org/Ogg_Skeleton_4)
+
+namespace utils_ogg {
+
+//
+// page
+//
+
+constexpr size_t PAGE_HEADER_SIZE = 27;
+constexpr size_t MAX_SEGMENTS = 255;
+constexpr uint8_t FLAG_CONTINUED = 0x01;
+constexpr uint8_t FLAG_BOS = 0x02;
+constexpr uint8_t FLAG_EOS = 0x04;
+
+// offsets within page header
+constexpr size_t OFFSET_FLAGS = 5;
+constexpr size_t OFFSET_GRANULE = 6;
+constexpr size_t OFFSET_SERIAL = 14;
+constexpr size_t OFFSET_SEQUENCE = 18;
+constexpr size_t OFFSET_CRC = 22;
+constexpr size_t OFFSET_SEGMENTS = 26;
+
+uint32_t readLE32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
+
+void writeLE32(uint8_t* p, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = (v >> (8 * i)) & 0xff;
+  }
+}
+
+uint64_t readLE64(const uint8_t* p) {
+  return readLE32(p) | (static_cast<uint64_t>(readLE32(p + 4)) << 32);
+}
+
+void writeLE64(uint8_t* p, uint64_t v) {
+  writeLE32(p, v);
+  writeLE32(p + 4, v >> 32);
+}
+
+// little endian packet fields
+struct PacketWriter {
+  std::vector<uint8_t> data_;
+
+  void bytes(const void* src, size_t n) {
+    auto p = reinterpret_cast<const uint8_t*>(src);
+    data_.insert(data_.end(), p, p + n);
+  }
+
+  void le(uint64_t v, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      data_.push_back((v >> (8 * i)) & 0xff);
+    }
+  }
+
+  // 7 bits per byte from lowest and high bit marks the last byte
+  void vlint(uint64_t v) {
+    for (; v >= 0x80; v >>= 7) {
+      data_.push_back(v & 0x7f);
+    }
+    data_.push_back(v | 0x80);
+  }
+};
+
+// cf. PacketWriter::vlint
+utils::Result<uint64_t> readVlint(const std::vector<uint8_t>& packet,
+                                  size_t& pos) {
+  uint64_t v = 0;
+  for (int bits = 0;; bits += 7) {
+    ASSERT(pos < packet.size() && bits < 64);
+    auto byte = packet[pos++];
+    v |= static_cast<uint64_t>(byte & 0x7f) << bits;
+    if (byte & 0x80) {
+      return v;
+    }
+  }
+}
+
+struct Page {
+  size_t start;  // offset of "OggS"
+  size_t body;   // offset of segment data
+  size_t end;
+  uint8_t flags;
+  int64_t granule;  // -1 if no packet ends on this page
+  uint32_t serial;
+  uint32_t sequence;
+  // lacing values
+  const uint8_t* segments;
+  size_t num_segments;
+};
+
+// page at `pos` (nullopt if truncated or not a page)
+std::optional<Page> readPage(const uint8_t* data, size_t size, size_t pos) {
+  if (size - pos < PAGE_HEADER_SIZE ||
+      std::memcmp(data + pos, "OggS", 4) != 0 || data[pos + 4] != 0) {
+    return {};
+  }
+  Page page;
+  page.start = pos;
+  page.flags = data[pos + OFFSET_FLAGS];
+  page.granule = static_cast<int64_t>(readLE64(data + pos + OFFSET_GRANULE));
+  page.serial = readLE32(data + pos + OFFSET_SERIAL);
+  page.sequence = readLE32(data + pos + OFFSET_SEQUENCE);
+  page.num_segments = data[pos + OFFSET_SEGMENTS];
+  page.body = pos + PAGE_HEADER_SIZE + page.num_segments;
+  if (page.body > size) {
+    return {};
+  }
+  page.segments = data + pos + PAGE_HEADER_SIZE;
+  size_t body_size = 0;
+  for (size_t i = 0; i < page.num_segments; i++) {
+    body_size += page.segments[i];
+  }
+  page.end = page.body + body_size;
+  if (page.end > size) {
+    return {};
+  }
+  return page;
+}
+
+//
+// crc (polynomial 0x04c11db7, non reflected, zero initial value and no final
+// xor, computed with crc field zeroed)
+//
+
+constexpr uint32_t CRC_POLY = 0x04c11db7;
+
+struct CrcTable {
+  // slicing by 4
+  uint32_t table[4][256];
+
+  CrcTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t r = i << 24;
+      for (int j = 0; j < 8; j++) {
+        r = (r << 1) ^ ((r & 0x80000000) ? CRC_POLY : 0);
+      }
+      table[0][i] = r;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+      for (int k = 1; k < 4; k++) {
+        auto prev = table[k - 1][i];
+        table[k][i] = (prev << 8) ^ table[0][prev >> 24];
+      }
+    }
+  }
+};
+
+const CrcTable& crcTable() {
+  static CrcTable instance;
+  return instance;
+}
+
+uint32_t crcUpdate(uint32_t crc, const uint8_t* data, size_t size) {
+  auto& t = crcTable().table;
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    crc ^= (static_cast<uint32_t>(data[i]) << 24) | (data[i + 1] << 16) |
+           (data[i + 2] << 8) | data[i + 3];
+    crc = t[3][crc >> 24] ^ t[2][(crc >> 16) & 0xff] ^ t[1][(crc >> 8) & 0xff] ^
+          t[0][crc & 0xff];
+  }
+  for (; i < size; i++) {
+    crc = (crc << 8) ^ t[0][(crc >> 24) ^ data[i]];
+  }
+  return crc;
+}
+
+// crc of whole page written into its crc field
+void writePageCrc(uint8_t* page, size_t size) {
+  writeLE32(page + OFFSET_CRC, 0);
+  writeLE32(page + OFFSET_CRC, crcUpdate(0, page, size));
+}
+
+// a * b mod CRC_POLY as polynomials over GF(2)
+uint32_t crcMultiply(uint32_t a, uint32_t b) {
+  uint32_t r = 0;
+  for (int i = 31; i >= 0; i--) {
+    r = (r << 1) ^ ((r & 0x80000000) ? CRC_POLY : 0);
+    if ((b >> i) & 1) {
+      r ^= a;
+    }
+  }
+  return r;
+}
+
+// crc after appending `n` zero bytes (i.e. crc * x^(8n)) in O(log n)
+uint32_t crcShift(uint32_t crc, size_t n) {
+  // x^(8 * 2^k) mod CRC_POLY
+  static const auto powers = []() {
+    std::array<uint32_t, 64> result;
+    result[0] = 0x100;
+    for (size_t k = 1; k < result.size(); k++) {
+      result[k] = crcMultiply(result[k - 1], result[k - 1]);
+    }
+    return result;
+  }();
+  for (size_t k = 0; n > 0; k++, n >>= 1) {
+    if (n & 1) {
+      crc = crcMultiply(crc, powers[k]);
+    }
+  }
+  return crc;
+}
+
+// overwrite 32 bit header field of page in place. since crc is linear, only
+// the change of the field is folded into existing crc instead of reading
+// whole page again.
+void writePageField(uint8_t* page, size_t size, size_t offset, uint32_t v) {
+  uint8_t delta[4];
+  writeLE32(delta, readLE32(page + offset) ^ v);
+  auto crc_delta = crcShift(crcUpdate(0, delta, 4), size - offset - 4);
+  writeLE32(page + offset, v);
+  writeLE32(page + OFFSET_CRC, readLE32(page + OFFSET_CRC) ^ crc_delta);
+}
+
+void renumberPage(uint8_t* page, size_t size, uint32_t sequence) {
+  writePageField(page, size, OFFSET_SEQUENCE, sequence);
+}
+
+//
+// OpusTags (vorbis comment)
+//
+
+struct Comments {
+  std::string vendor;
+  std::vector<std::string> entries;  // "KEY=value"
+  std::vector<uint8_t> extra;        // binary data after comments
+};
+
+utils::Result<Comments> parseComments(const std::vector<uint8_t>& packet) {
+  const uint8_t* p = packet.data();
+  size_t size = packet.size();
+  size_t pos = 8;
+  auto read = [&](size_t n) -> utils::Result<const uint8_t*> {
+    ASSERT(n <= size - pos);
+    auto result = p + pos;
+    pos += n;
+    return result;
+  };
+  auto read32 = [&]() -> utils::Result<uint32_t> {
+    TRY_ASSIGN(auto q, read(4));
+    return readLE32(q);
+  };
+  ASSERT(size >= 8 && std::memcmp(p, "OpusTags", 8) == 0);
+
+  Comments result;
+  TRY_ASSIGN(auto vendor_size, read32());
+  TRY_ASSIGN(auto vendor, read(vendor_size));
+  result.vendor.assign(vendor, vendor + vendor_size);
+  TRY_ASSIGN(auto count, read32());
+  for (uint32_t i = 0; i < count; i++) {
+    TRY_ASSIGN(auto entry_size, read32());
+    TRY_ASSIGN(auto entry, read(entry_size));
+    result.entries.emplace_back(entry, entry + entry_size);
+  }
+  result.extra.assign(p + pos, p + size);
+  return result;
+}
+
+std::vector<uint8_t> serializeComments(const Comments& comments) {
+  std::vector<uint8_t> result{'O', 'p', 'u', 's', 'T', 'a', 'g', 's'};
+  auto write = [&](const void* src, size_t n) {
+    auto q = reinterpret_cast<const uint8_t*>(src);
+    result.insert(result.end(), q, q + n);
+  };
+  auto write32 = [&](uint32_t v) {
+    uint8_t buf[4];
+    writeLE32(buf, v);
+    write(buf, 4);
+  };
+  write32(comments.vendor.size());
+  write(comments.vendor.data(), comments.vendor.size());
+  write32(comments.entries.size());
+  for (auto& entry : comments.entries) {
+    write32(entry.size());
+    write(entry.data(), entry.size());
+  }
+  write(comments.extra.data(), comments.extra.size());
+  return result;
+}
+
+// field names are case insensitive
+bool matchKey(const std::string& entry, const std::string& key) {
+  if (entry.size() <= key.size() || entry[key.size()] != '=') {
+    return false;
+  }
+  for (size_t i = 0; i < key.size(); i++) {
+    if (std::toupper(entry[i]) != std::toupper(key[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// replace all entries of each key (empty value only removes them)
+void updateComments(Comments& comments,
+                    const std::map<std::string, std::string>& metadata) {
+  for (auto& [key, value] : metadata) {
+    auto& entries = comments.entries;
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                 [&](auto& e) { return matchKey(e, key); }),
+                  entries.end());
+    if (!value.empty()) {
+      entries.push_back(key + "=" + value);
+    }
+  }
+}
+
+//
+// main API
+//
+
+// header pages (OpusHead and OpusTags) and offset of the first audio page.
+// packets of leading Skeleton stream (cf. SkeletonIndexer) are kept to be
+// written again around new header pages.
+struct Headers {
+  Page head;
+  std::vector<Page> tags_pages;
+  std::vector<uint8_t> tags_packet;
+  std::optional<uint32_t> skeleton_serial;
+  std::vector<std::vector<uint8_t>> skeleton_packets;
+  size_t audio_start;
+};
+
+// append packets ending on `page` to `packets` (`partial` carries the rest)
+void readPackets(const std::vector<uint8_t>& data,
+                 const Page& page,
+                 std::vector<uint8_t>& partial,
+                 std::vector<std::vector<uint8_t>>& packets) {
+  size_t offset = page.body;
+  for (size_t i = 0; i < page.num_segments; i++) {
+    partial.insert(partial.end(), data.begin() + offset,
+                   data.begin() + offset + page.segments[i]);
+    offset += page.segments[i];
+    if (page.segments[i] < 255) {
+      packets.push_back(std::move(partial));
+      partial.clear();
+    }
+  }
+}
+
+utils::Result<Headers> parseHeaders(const std::vector<uint8_t>& data) {
+  Headers result;
+  std::optional<Page> head;
+  std::vector<uint8_t> skeleton_partial;
+  bool tags_complete = false;
+  bool skeleton_complete = false;
+  size_t pos = 0;
+  while (!tags_complete || (result.skeleton_serial && !skeleton_complete)) {
+    auto page = readPage(data.data(), data.size(), pos);
+    ASSERT(page);
+    pos = page->end;
+    auto body = data.data() + page->body;
+    auto body_size = page->end - page->body;
+
+    // BOS pages of Skeleton and opus come first
+    if (page->flags & FLAG_BOS) {
+      ASSERT(result.tags_pages.empty());
+      if (body_size >= 8 && std::memcmp(body, "fishead\0", 8) == 0) {
+        ASSERT(!result.skeleton_serial && !head);
+        result.skeleton_serial = page->serial;
+        readPackets(data, page.value(), skeleton_partial,
+                    result.skeleton_packets);
+        continue;
+      }
+      // OpusHead is single packet on its own page
+      ASSERT(!head);
+      ASSERT(page->num_segments > 0 &&
+             page->segments[page->num_segments - 1] < 255);
+      ASSERT(body_size >= 8 && std::memcmp(body, "OpusHead", 8) == 0);
+      head = page;
+      continue;
+    }
+    ASSERT(head);
+
+    // Skeleton ends with EOS page before any audio page
+    if (page->serial == result.skeleton_serial) {
+      ASSERT(!skeleton_complete);
+      readPackets(data, page.value(), skeleton_partial,
+                  result.skeleton_packets);
+      skeleton_complete = page->flags & FLAG_EOS;
+      continue;
+    }
+
+    // OpusTags can span pages and it ends with its last page
+    ASSERT(page->serial == head->serial && !tags_complete);
+    result.tags_packet.insert(result.tags_packet.end(), body,
+                              body + body_size);
+    tags_complete = page->num_segments > 0 &&
+                    page->segments[page->num_segments - 1] < 255;
+    if (tags_complete) {
+      // multiple packets on tags page is not allowed
+      for (size_t i = 0; i + 1 < page->num_segments; i++) {
+        ASSERT(page->segments[i] == 255);
+      }
+    }
+    result.tags_pages.push_back(page.value());
+  }
+  result.head = head.value();
+  result.audio_start = pos;
+  return result;
+}
+
+// pages of single packet starting from `sequence` with zero granule position
+// (cf. RFC 7845 section 5.2)
+void writePacketPages(std::vector<uint8_t>& output,
+                      const std::vector<uint8_t>& packet,
+                      uint32_t serial,
+                      uint32_t& sequence) {
+  // lacing values (last one is less than 255 even if it's 0)
+  size_t num_lacing = packet.size() / 255 + 1;
+  size_t lacing_pos = 0;
+  size_t packet_pos = 0;
+  while (lacing_pos < num_lacing) {
+    size_t num_segments = std::min(MAX_SEGMENTS, num_lacing - lacing_pos);
+    size_t page_start = output.size();
+    output.resize(page_start + PAGE_HEADER_SIZE + num_segments);
+    uint8_t* header = output.data() + page_start;
+    std::memcpy(header, "OggS", 4);
+    header[4] = 0;
+    header[OFFSET_FLAGS] = lacing_pos > 0 ? FLAG_CONTINUED : 0;
+    std::memset(header + OFFSET_GRANULE, 0, 8);
+    writeLE32(header + OFFSET_SERIAL, serial);
+    writeLE32(header + OFFSET_SEQUENCE, sequence++);
+    header[OFFSET_SEGMENTS] = num_segments;
+    size_t body_size = 0;
+    for (size_t i = 0; i < num_segments; i++) {
+      size_t lacing = lacing_pos + i + 1 < num_lacing
+                          ? 255
+                          : packet.size() - 255 * (num_lacing - 1);
+      header[PAGE_HEADER_SIZE + i] = lacing;
+      body_size += lacing;
+    }
+    output.insert(output.end(), packet.begin() + packet_pos,
+                  packet.begin() + packet_pos + body_size);
+    writePageCrc(output.data() + page_start, output.size() - page_start);
+    lacing_pos += num_segments;
+    packet_pos += body_size;
+  }
+}
+
+// Skeleton pages placed around opus header pages (cf. RFC 3533 section 6 and
+// Skeleton 4 "packet order")
+struct SkeletonPages {
+  std::vector<uint8_t> front;  // fishead on BOS page
+  std::vector<uint8_t> back;   // following packets and empty EOS page
+};
+
+SkeletonPages writeSkeletonPages(
+    const std::vector<std::vector<uint8_t>>& packets,
+    uint32_t serial) {
+  SkeletonPages result;
+  uint32_t sequence = 0;
+  writePacketPages(result.front, packets[0], serial, sequence);
+  result.front[OFFSET_FLAGS] = FLAG_BOS;
+  writePageCrc(result.front.data(), result.front.size());
+  for (size_t i = 1; i < packets.size(); i++) {
+    writePacketPages(result.back, packets[i], serial, sequence);
+  }
+
+  // empty page to end skeleton before any audio page
+  size_t eos_start = result.back.size();
+  result.back.resize(eos_start + PAGE_HEADER_SIZE);
+  uint8_t* eos = result.back.data() + eos_start;
+  std::memcpy(eos, "OggS", 4);
+  eos[4] = 0;
+  eos[OFFSET_FLAGS] = FLAG_EOS;
+  std::memset(eos + OFFSET_GRANULE, 0, 8);
+  writeLE32(eos + OFFSET_SERIAL, serial);
+  writeLE32(eos + OFFSET_SEQUENCE, sequence);
+  eos[OFFSET_SEGMENTS] = 0;
+  writePageCrc(eos, PAGE_HEADER_SIZE);
+  return result;
+}
+
+// move byte offsets of Skeleton packets (segment length and content offset
+// of fishead, and the first keypoint of index whose others are relative) by
+// `shift`
+utils::Result<std::vector<std::vector<uint8_t>>> shiftSkeleton(
+    std::vector<std::vector<uint8_t>> packets,
+    int64_t shift) {
+  for (auto& packet : packets) {
+    auto p = packet.data();
+    if (packet.size() >= 80 && std::memcmp(p, "fishead\0", 8) == 0 &&
+        (p[8] | (p[9] << 8)) >= 4) {
+      for (size_t offset : {64, 72}) {
+        // zero is unknown
+        if (auto v = readLE64(p + offset); v > 0) {
+          writeLE64(p + offset, v + shift);
+        }
+      }
+    }
+    if (packet.size() >= 42 && std::memcmp(p, "index\0", 6) == 0 &&
+        readLE64(p + 10) > 0) {
+      size_t pos = 42;
+      TRY_ASSIGN(auto offset, readVlint(packet, pos));
+      PacketWriter w;
+      w.bytes(p, 42);
+      w.vlint(offset + shift);
+      w.bytes(p + pos, packet.size() - pos);
+      packet = std::move(w.data_);
+    }
+  }
+  return packets;
+}
+
+// rewrite tags (cf. updateComments) and repaginate only header pages. audio
+// pages are copied as is, or renumbered when the number of header pages
+// changes.
+utils::Result<std::vector<uint8_t>> updateTags(
+    const std::vector<uint8_t>& data,
+    const std::map<std::string, std::string>& metadata) {
+  utils_memory::Scope memory_scope;
+  utils_progress::Scope progress_scope;
+  TRY_ASSIGN(auto headers, parseHeaders(data));
+  TRY_ASSIGN(auto comments, parseComments(headers.tags_packet));
+  updateComments(comments, metadata);
+  auto tags_packet = serializeComments(comments);
+
+  std::vector<uint8_t> output;
+  output.reserve(data.size() - headers.tags_packet.size() + tags_packet.size() +
+                 (tags_packet.size() / (255 * 255) + 1) *
+                     (PAGE_HEADER_SIZE + MAX_SEGMENTS));
+  // Skeleton offsets move with header size, which in turn depends on index
+  // size so that it's repeated until the size settles
+  uint32_t sequence = 0;
+  int64_t offset_shift = 0;
+  for (;;) {
+    output.clear();
+    SkeletonPages skeleton;
+    if (headers.skeleton_serial) {
+      TRY_ASSIGN(auto packets,
+                 shiftSkeleton(headers.skeleton_packets, offset_shift));
+      skeleton = writeSkeletonPages(packets, headers.skeleton_serial.value());
+    }
+    output.insert(output.end(), skeleton.front.begin(), skeleton.front.end());
+    output.insert(output.end(), data.begin() + headers.head.start,
+                  data.begin() + headers.head.end);
+    sequence = headers.head.sequence + 1;
+    writePacketPages(output, tags_packet, headers.head.serial, sequence);
+    output.insert(output.end(), skeleton.back.begin(), skeleton.back.end());
+    auto size_change = static_cast<int64_t>(output.size()) -
+                       static_cast<int64_t>(headers.audio_start);
+    if (!headers.skeleton_serial || size_change == offset_shift) {
+      break;
+    }
+    offset_shift = size_change;
+  }
+
+  // audio pages
+  size_t audio_start = output.size();
+  output.insert(output.end(), data.begin() + headers.audio_start, data.end());
+  // shift (instead of renumbering from scratch) to keep gaps as they are
+  uint32_t shift = sequence - (headers.tags_pages.back().sequence + 1);
+  if (shift == 0) {
+    return output;
+  }
+  utils_progress::setTotal(0, output.size());
+  size_t pos = audio_start;
+  while (pos < output.size()) {
+    auto page = readPage(output.data(), output.size(), pos);
+    ASSERT(page);
+    // other logical stream (e.g. chained) keeps its own sequence
+    if (page->serial == headers.head.serial) {
+      renumberPage(output.data() + pos, page->end - pos,
+                   page->sequence + shift);
+    }
+    TRY(utils_progress::update(0, page->end));
+    pos = page->end;
+  }
+  return output;
+}
+
+//
+// chained stream
+//
+
+// complete ogg streams (links) played one after another, each keeping its
+// own headers (e.g. pre-skip of OpusHead) and final granule position so that
+// joins are gapless (cf. RFC 3533 section 4 and RFC 7845 section 3). serial
+// number of link colliding with earlier one is rewritten.
+struct Chain {
+  std::vector<uint8_t> output_;
+  std::vector<uint32_t> serials_;
+
+  // `link` has to be single logical stream (i.e. without Skeleton)
+  utils::Result<void> append(std::vector<uint8_t> link) {
+    std::optional<uint32_t> serial;
+    for (size_t pos = 0; pos < link.size();) {
+      auto page = readPage(link.data(), link.size(), pos);
+      ASSERT(page);
+      ASSERT(!serial || page->serial == serial.value());
+      serial = page->serial;
+      pos = page->end;
+    }
+    ASSERT(serial);
+    auto unique = serial.value();
+    while (std::find(serials_.begin(), serials_.end(), unique) !=
+           serials_.end()) {
+      unique++;
+    }
+    if (unique != serial.value()) {
+      for (size_t pos = 0; pos < link.size();) {
+        auto page = readPage(link.data(), link.size(), pos).value();
+        writePageField(link.data() + pos, page.end - pos, OFFSET_SERIAL,
+                       unique);
+        pos = page.end;
+      }
+    }
+    serials_.push_back(unique);
+    output_.insert(output_.end(), link.begin(), link.end());
+    return {};
+  }
+};
+
+//
+// Ogg Skeleton 4 keyframe index
+//
+
+constexpr uint64_t OPUS_GRANULE_RATE = 48000;
+// decoder has to converge for 80ms before seek target (cf. RFC 7845
+// section 4.6)
+constexpr uint64_t OPUS_PREROLL_SAMPLES = 3840;
+
+// samples of opus packet by its TOC byte (0 if unknown)
+// (cf. RFC 6716 section 3.1)
+uint32_t opusPacketSamples(const uint8_t* packet, size_t size) {
+  if (size == 0) {
+    return 0;
+  }
+  uint8_t config = packet[0] >> 3;
+  static constexpr uint32_t SILK_FRAMES[] = {480, 960, 1920, 2880};
+  uint32_t frame = config < 12   ? SILK_FRAMES[config & 3]
+                   : config < 16 ? 480u << (config & 1)   // hybrid
+                                 : 120u << (config & 3);  // celt
+  switch (packet[0] & 3) {
+    case 0:
+      return frame;
+    case 1:
+    case 2:
+      return 2 * frame;
+    default:
+      return size >= 2 ? frame * (packet[1] & 0x3f) : 0;
+  }
+}
+
+struct Keypoint {
+  uint64_t offset;  // of page where packet starts (relative to input)
+  uint64_t time;    // in samples after pre-skip
+};
+
+struct AudioPages {
+  uint32_t serial;
+  uint16_t pre_skip;
+  std::vector<Keypoint> keypoints;
+  uint64_t first_time;
+  uint64_t end_time;
+  uint32_t min_packet_samples;  // 0 if unknown
+};
+
+// fishead of Skeleton 4.0 (presentation time and base time are zero)
+std::vector<uint8_t> skeletonHead(uint64_t segment_length,
+                                  uint64_t content_offset) {
+  PacketWriter w;
+  w.bytes("fishead\0", 8);
+  w.le(4, 2);  // version major
+  w.le(0, 2);  // version minor
+  w.le(0, 8);
+  w.le(1000, 8);
+  w.le(0, 8);
+  w.le(1000, 8);
+  w.data_.resize(w.data_.size() + 20);  // UTC (unspecified)
+  w.le(segment_length, 8);
+  w.le(content_offset, 8);
+  return std::move(w.data_);
+}
+
+std::vector<uint8_t> skeletonBone(const AudioPages& audio) {
+  // packets to decode before seek target (enough even if all are shortest)
+  uint64_t preroll = 0;
+  if (audio.min_packet_samples > 0) {
+    preroll = (OPUS_PREROLL_SAMPLES + audio.min_packet_samples - 1) /
+              audio.min_packet_samples;
+  }
+  PacketWriter w;
+  w.bytes("fisbone\0", 8);
+  w.le(44, 4);  // offset of message headers from this field
+  w.le(audio.serial, 4);
+  w.le(2, 4);  // OpusHead and OpusTags
+  w.le(OPUS_GRANULE_RATE, 8);
+  w.le(1, 8);
+  w.le(audio.pre_skip, 8);  // base granule
+  w.le(preroll, 4);
+  w.le(0, 1);  // granule shift
+  w.le(0, 3);  // padding
+  std::string headers =
+      "Content-Type: audio/opus\r\n"
+      "Role: audio/main\r\n"
+      "Name: audio_0\r\n";
+  w.bytes(headers.data(), headers.size());
+  return std::move(w.data_);
+}
+
+// keypoint offsets are shifted by `shift` bytes of skeleton pages
+std::vector<uint8_t> skeletonIndex(const AudioPages& audio, uint64_t shift) {
+  PacketWriter w;
+  w.bytes("index\0", 6);
+  w.le(audio.serial, 4);
+  w.le(audio.keypoints.size(), 8);
+  w.le(OPUS_GRANULE_RATE, 8);  // timestamp denominator
+  w.le(audio.first_time, 8);
+  w.le(audio.end_time, 8);
+  uint64_t offset = 0;
+  uint64_t time = 0;
+  for (auto& keypoint : audio.keypoints) {
+    w.vlint(keypoint.offset + shift - offset);
+    w.vlint(keypoint.time - time);
+    offset = keypoint.offset + shift;
+    time = keypoint.time;
+  }
+  return std::move(w.data_);
+}
+
+// Skeleton track with keypoint at least every `interval` seconds, recorded
+// from pages of ogg opus as muxer writes them (cf. BufferOutput::on_write_)
+// and inserted in front of them when muxing is finished. header pages of opus
+// stream are kept and audio pages are moved as is since they belong to their
+// own logical stream.
+struct SkeletonIndexer {
+  uint64_t step_ = 0;
+  size_t pos_ = 0;  // end of scanned pages
+  std::optional<Headers> headers_;
+  AudioPages audio_{};
+  int64_t granule_ = 0;
+  std::optional<uint64_t> next_time_;
+  utils::Result<void> status_;  // first failure of `scan`
+
+  utils::Result<void> initialize(double interval) {
+    ASSERT(interval > 0);
+    step_ = static_cast<uint64_t>(interval * OPUS_GRANULE_RATE);
+    return {};
+  }
+
+  uint64_t toTime(int64_t granule) const {
+    return std::max<int64_t>(granule - audio_.pre_skip, 0);
+  }
+
+  // `data` is whole output so far
+  void scan(const std::vector<uint8_t>& data) {
+    if (status_.ok()) {
+      status_ = scanImpl(data);
+    }
+  }
+
+  utils::Result<void> scanImpl(const std::vector<uint8_t>& data) {
+    while (auto page = readPage(data.data(), data.size(), pos_)) {
+      pos_ = page->end;
+      if (!headers_) {
+        // OpusTags ends on the first page after OpusHead ending a packet
+        if (!(page->flags & FLAG_BOS) && page->num_segments > 0 &&
+            page->segments[page->num_segments - 1] < 255) {
+          TRY(startAudio(data));
+        }
+        continue;
+      }
+      TRY(scanAudioPage(data, page.value()));
+    }
+    return {};
+  }
+
+  utils::Result<void> startAudio(const std::vector<uint8_t>& data) {
+    TRY_ASSIGN(headers_, parseHeaders(data));
+    ASSERT(headers_->audio_start == pos_ && !headers_->skeleton_serial);
+    audio_.serial = headers_->head.serial;
+    // OpusHead "OpusHead" version channels pre-skip ...
+    ASSERT(headers_->head.end - headers_->head.body >= 12);
+    auto head = data.data() + headers_->head.body;
+    audio_.pre_skip = head[10] | (head[11] << 8);
+    return {};
+  }
+
+  // every opus packet is decodable on its own so that any page starting with
+  // new packet can be keypoint. its time is the granule of previous page.
+  utils::Result<void> scanAudioPage(const std::vector<uint8_t>& data,
+                                    const Page& page) {
+    ASSERT(page.serial == audio_.serial);  // chained stream is not indexed
+    auto time = toTime(granule_);
+    if (!(page.flags & FLAG_CONTINUED) && page.body < page.end &&
+        (!next_time_ || time >= next_time_.value())) {
+      audio_.keypoints.push_back({page.start, time});
+      next_time_ = time + step_;
+    }
+    if (page.granule >= 0) {
+      granule_ = page.granule;
+    }
+
+    // packets starting on this page (shortest one bounds preroll packets)
+    bool starts = !(page.flags & FLAG_CONTINUED);
+    size_t offset = page.body;
+    for (size_t i = 0; i < page.num_segments; i++) {
+      if (starts) {
+        auto samples =
+            opusPacketSamples(data.data() + offset, page.end - offset);
+        if (samples > 0 && (audio_.min_packet_samples == 0 ||
+                            samples < audio_.min_packet_samples)) {
+          audio_.min_packet_samples = samples;
+        }
+      }
+      offset += page.segments[i];
+      starts = page.segments[i] < 255;
+    }
+    return {};
+  }
+
+  // insert skeleton pages into finished output `data`. Skeleton BOS page
+  // goes first and the rest follows opus header pages, so that pages are
+  // moved in place (reallocating only when capacity is short).
+  utils::Result<void> finish(std::vector<uint8_t>& data) {
+    TRY(status_);
+    ASSERT(headers_ && pos_ == data.size());
+    ASSERT(!audio_.keypoints.empty());
+    audio_.first_time = audio_.keypoints[0].time;
+    audio_.end_time = toTime(granule_);
+    // any serial distinct from opus stream
+    uint32_t serial = audio_.serial + 1;
+    auto bone = skeletonBone(audio_);
+
+    // index size depends on shifted offsets so that it's repeated until the
+    // size settles
+    auto audio_start = headers_->audio_start;
+    SkeletonPages skeleton;
+    size_t shift = 0;
+    for (;;) {
+      skeleton = writeSkeletonPages(
+          {skeletonHead(data.size() + shift, audio_start + shift), bone,
+           skeletonIndex(audio_, shift)},
+          serial);
+      auto size = skeleton.front.size() + skeleton.back.size();
+      if (size == shift) {
+        break;
+      }
+      shift = size;
+    }
+
+    size_t size = data.size();
+    data.resize(size + shift);
+    auto p = data.data();
+    std::memmove(p + audio_start + shift, p + audio_start, size - audio_start);
+    std::memmove(p + skeleton.front.size(), p, audio_start);
+    std::memcpy(p, skeleton.front.data(), skeleton.front.size());
+    std::memcpy(p + skeleton.front.size() + audio_start, skeleton.back.data(),
+                skeleton.back.size());
+    return {};
+  }
+};
+
+}  // namespace utils_ogg
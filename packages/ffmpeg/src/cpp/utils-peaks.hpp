@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "utils-simd.hpp"
+#include "utils.hpp"
+
+// waveform peaks for trim UI.
+// each bucket of `samples_per_bucket` samples (all channels mixed together)
+// is encoded as three little endian int16 (min, max, rms) scaled by 32767.
+
+namespace utils_peaks {
+
+struct PeakBuilder {
+  const uint32_t samples_per_bucket_;
+  std::vector<int16_t> peaks_;
+
+  // current bucket
+  uint32_t count_ = 0;
+  float min_ = 0;
+  float max_ = 0;
+  double sum_sq_ = 0;
+  size_t sum_count_ = 0;
+
+  // caller checks `samples_per_bucket > 0`
+  PeakBuilder(uint32_t samples_per_bucket)
+      : samples_per_bucket_{samples_per_bucket} {}
+
+  // feed planar samples incrementally
+  void process(const float* const* data, int num_channels, size_t num_samples) {
+    size_t i = 0;
+    while (i < num_samples) {
+      size_t end =
+          std::min<size_t>(num_samples, i + (samples_per_bucket_ - count_));
+      for (int c = 0; c < num_channels; c++) {
+        auto r = utils_simd::reduceMinMaxSquare(data[c] + i, end - i);
+        if (count_ == 0 && c == 0) {
+          min_ = r.min;
+          max_ = r.max;
+        }
+        min_ = std::min(min_, r.min);
+        max_ = std::max(max_, r.max);
+        sum_sq_ += r.sum_sq;
+      }
+      sum_count_ += (end - i) * num_channels;
+      count_ += end - i;
+      i = end;
+      if (count_ == samples_per_bucket_) {
+        flush();
+      }
+    }
+  }
+
+  void flush() {
+    if (count_ == 0) {
+      return;
+    }
+    auto rms = std::sqrt(sum_sq_ / std::max<size_t>(sum_count_, 1));
+    peaks_.push_back(toInt16(min_));
+    peaks_.push_back(toInt16(max_));
+    peaks_.push_back(toInt16(rms));
+    count_ = 0;
+    sum_sq_ = 0;
+    sum_count_ = 0;
+  }
+
+  static int16_t toInt16(double x) {
+    return static_cast<int16_t>(std::lround(std::clamp(x, -1.0, 1.0) * 32767));
+  }
+
+  // including last partial bucket
+  std::vector<uint8_t> finish() {
+    flush();
+    std::vector<uint8_t> result;
+    result.resize(peaks_.size() * sizeof(int16_t));
+    for (size_t i = 0; i < peaks_.size(); i++) {
+      uint16_t v = static_cast<uint16_t>(peaks_[i]);
+      result[2 * i] = v & 0xff;
+      result[2 * i + 1] = (v >> 8) & 0xff;
+    }
+    return result;
+  }
+};
+
+}  // namespace utils_peaks
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include "utils.hpp"
+
+// progress reporting and cancellation of long running operation.
+// settings (callback, deadline) are applied to subsequent operations in the
+// same manner as `utils_memory::setBudget`, and each operation opens `Scope`.
+// processing loops call `update` (throttled report and cancellation check)
+// and input callbacks poll `interrupted` (cf. AVIOInterruptCB) so that
+// cancelled operation returns error and releases its buffers.
+// `fail` reports error from where it cannot be returned (e.g. operator new)
+// and stops the operation at next check in the same manner.
+
+namespace utils_progress {
+
+using Clock = std::chrono::steady_clock;
+
+struct Progress {
+  double time = 0;         // processed media time in seconds
+  double bytes = 0;        // processed input bytes
+  double total_time = 0;   // 0 if unknown
+  double total_bytes = 0;  // 0 if unknown
+  double elapsed = 0;      // seconds since operation started
+  double throughput = 0;   // bytes per second
+  double eta = -1;         // estimated seconds to completion (-1 if unknown)
+};
+
+// return false to cancel operation
+using Callback = std::function<bool(const Progress&)>;
+
+enum class Reason { NONE, CANCEL, DEADLINE, FAILURE };
+
+//
+// global state
+//
+
+struct State {
+  // written by `cancel` from other thread or signal handler
+  std::atomic<bool> cancelled{false};
+  std::atomic<Reason> reason{Reason::NONE};
+  std::atomic<int> depth{0};
+  // set by the first `fail` (fixed size not to allocate)
+  std::atomic<bool> failed{false};
+  char failure_code[32] = {};
+  char failure_message[160] = {};
+  // fixed while operation is running
+  Clock::time_point start;
+  Clock::time_point deadline;
+  double deadline_seconds = 0;  // 0 if no deadline
+  Callback callback;
+  // only touched by thread running operation loop
+  Clock::time_point next_report;
+  Progress progress;
+  // applied to next operation
+  Callback next_callback;
+  double next_deadline = 0;
+  double interval = 0.1;
+};
+
+State& state() {
+  static State instance;
+  return instance;
+}
+
+double secondsSince(Clock::time_point start, Clock::time_point now) {
+  return std::chrono::duration<double>(now - start).count();
+}
+
+//
+// main API
+//
+
+// callback for subsequent operations (nullptr to disable)
+void setCallback(Callback callback) {
+  state().next_callback = std::move(callback);
+}
+
+// deadline in seconds for subsequent operations (0 to disable)
+void setDeadline(double seconds) {
+  state().next_deadline = seconds;
+}
+
+// minimum seconds between callback invocations
+void setInterval(double seconds) {
+  state().interval = seconds;
+}
+
+// cancel running operation (safe to call from other thread or signal handler)
+void cancel() {
+  auto& s = state();
+  if (!s.failed.load()) {
+    s.reason = Reason::CANCEL;
+  }
+  s.cancelled = true;
+}
+
+// cheap enough to poll per packet or per input read
+bool interrupted() {
+  auto& s = state();
+  if (s.depth.load() == 0) {
+    return false;
+  }
+  if (s.cancelled.load()) {
+    return true;
+  }
+  if (s.deadline_seconds > 0 && Clock::now() >= s.deadline) {
+    s.reason = Reason::DEADLINE;
+    s.cancelled = true;
+    return true;
+  }
+  return false;
+}
+
+// stop running operation with error (e.g. memory budget exceeded inside
+// operator new). only the first failure is kept.
+void fail(const char* code, const char* message) {
+  auto& s = state();
+  if (s.failed.exchange(true)) {
+    return;
+  }
+  std::snprintf(s.failure_code, sizeof(s.failure_code), "%s", code);
+  std::snprintf(s.failure_message, sizeof(s.failure_message), "%s", message);
+  s.reason = Reason::FAILURE;
+  s.cancelled = true;
+}
+
+// error given to `fail` (if any) and clear it. for boundary (cf.
+// utils_embind::capture) to report failure after the operation's last check.
+utils::Result<void> takeFailure() {
+  auto& s = state();
+  if (!s.failed.exchange(false)) {
+    return {};
+  }
+  return utils::Error{s.failure_code, s.failure_message};
+}
+
+// error with code "cancelled", "deadline", or the one given to `fail`
+utils::Result<void> check() {
+  if (!interrupted()) {
+    return {};
+  }
+  auto& s = state();
+  auto reason = s.reason.load();
+  if (reason == Reason::FAILURE) {
+    return utils::Error{s.failure_code, s.failure_message};
+  }
+  if (reason == Reason::DEADLINE) {
+    char message[64];
+    std::snprintf(message, sizeof(message), "deadline exceeded (%g sec)",
+                  s.deadline_seconds);
+    return utils::Error{"deadline", message};
+  }
+  return utils::Error{"cancelled", "cancelled"};
+}
+
+// for AVFormatContext.interrupt_callback
+int interruptCallback(void*) {
+  return interrupted() ? 1 : 0;
+}
+
+void setTotal(double total_time, double total_bytes) {
+  auto& progress = state().progress;
+  progress.total_time = total_time;
+  progress.total_bytes = total_bytes;
+}
+
+// record processed position, report it when interval has passed, then
+// return error if cancelled
+utils::Result<void> update(double time, double bytes) {
+  auto& s = state();
+  if (s.depth.load() == 0) {
+    return {};
+  }
+  s.progress.time = time;
+  s.progress.bytes = bytes;
+  if (s.callback) {
+    auto now = Clock::now();
+    if (now >= s.next_report) {
+      s.next_report =
+          now + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(s.interval));
+      auto& p = s.progress;
+      p.elapsed = secondsSince(s.start, now);
+      p.throughput = p.elapsed > 0 ? p.bytes / p.elapsed : 0;
+      // fraction by time if known since input can be read only partially
+      double fraction = p.total_time > 0    ? p.time / p.total_time
+                        : p.total_bytes > 0 ? p.bytes / p.total_bytes
+                                            : 0;
+      p.eta = fraction > 0 ? p.elapsed * (1 - fraction) / fraction : -1;
+      if (!s.callback(p)) {
+        cancel();
+      }
+    }
+  }
+  return check();
+}
+
+// track single operation. nested scopes are no-op (cf. utils_memory::Scope)
+struct Scope {
+  bool outermost_ = false;
+
+  Scope() {
+    auto& s = state();
+    outermost_ = s.depth.load() == 0;
+    if (!outermost_) {
+      s.depth.fetch_add(1);
+      return;
+    }
+    s.start = Clock::now();
+    s.deadline_seconds = s.next_deadline;
+    s.deadline = s.start + std::chrono::duration_cast<Clock::duration>(
+                               std::chrono::duration<double>(s.next_deadline));
+    s.callback = s.next_callback;
+    s.next_report = s.start;
+    s.progress = Progress{};
+    s.reason = Reason::NONE;
+    s.failed = false;
+    s.cancelled = false;
+    s.depth.fetch_add(1);
+  }
+
+  ~Scope() {
+    auto& s = state();
+    s.depth.fetch_sub(1);
+    if (outermost_) {
+      s.callback = nullptr;
+    }
+  }
+};
+
+// cancel running operation on e.g. SIGINT (native cli).
+// outside of operation, signal is handled by default action.
+void cancelOnSignal(int signum) {
+  state();
+  std::signal(signum, [](int signum) {
+    if (state().depth.load() == 0) {
+      std::signal(signum, SIG_DFL);
+      std::raise(signum);
+      return;
+    }
+    cancel();
+  });
+}
+
+std::string formatProgress(const Progress& p) {
+  std::ostringstream ostr;
+  ostr << "time = " << p.time << ", bytes = " << p.bytes
+       << ", elapsed = " << p.elapsed << ", throughput = " << p.throughput
+       << ", eta = " << p.eta;
+  return ostr.str();
+}
+
+}  // namespace utils_progress
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include "utils.hpp"
+
+// single producer single consumer byte queue between threads. each side only
+// stores its own index (and acquires the other), so that bytes are handed
+// over without lock nor copy other than into and out of the ring.
+
+namespace utils_ring {
+
+// separate cache lines for indices written by different threads
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+struct SpscRing {
+  std::unique_ptr<uint8_t[]> data_;
+  size_t capacity_ = 0;  // power of two
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> head_{0};  // by consumer
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail_{0};  // by producer
+  alignas(CACHE_LINE_SIZE) std::atomic<bool> closed_{false};
+
+  utils::Result<void> initialize(size_t capacity) {
+    ASSERT(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    capacity_ = capacity;
+    data_.reset(new uint8_t[capacity]);
+    return {};
+  }
+
+  //
+  // producer
+  //
+
+  // bytes written (less than `size` if ring is full)
+  size_t tryWrite(const uint8_t* src, size_t size) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_acquire);
+    size_t n = std::min(size, capacity_ - (tail - head));
+    size_t offset = tail & (capacity_ - 1);
+    size_t first = std::min(n, capacity_ - offset);
+    std::memcpy(data_.get() + offset, src, first);
+    std::memcpy(data_.get(), src + first, n - first);
+    tail_.store(tail + n, std::memory_order_release);
+    return n;
+  }
+
+  // no more write
+  void close() { closed_.store(true, std::memory_order_release); }
+
+  //
+  // consumer
+  //
+
+  // contiguous readable bytes (rest follows after `consume` when wrapped)
+  std::pair<const uint8_t*, size_t> peek() const {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    size_t offset = head & (capacity_ - 1);
+    return {data_.get() + offset, std::min(tail - head, capacity_ - offset)};
+  }
+
+  void consume(size_t n) {
+    head_.store(head_.load(std::memory_order_relaxed) + n,
+                std::memory_order_release);
+  }
+
+  // closed and everything is consumed
+  bool drained() const {
+    // load `closed_` first so that the last write is visible
+    bool closed = closed_.load(std::memory_order_acquire);
+    return closed && peek().second == 0;
+  }
+};
+
+}  // namespace utils_ring
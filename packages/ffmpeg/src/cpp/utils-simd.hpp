@@ -0,0 +1,282 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+// minimal 2 lane double and 4 lane float vectors used by audio analysis
+// kernels and 16 lane byte vector used by byte search (SSE2 on native x86,
+// simd128 on emscripten with `-msimd128`, otherwise scalar fallback)
+
+namespace utils_simd {
+
+#if defined(__SSE2__)
+
+struct f64x2 {
+  __m128d v;
+
+  static f64x2 make(double a, double b) { return {_mm_set_pd(b, a)}; }
+  static f64x2 splat(double a) { return {_mm_set1_pd(a)}; }
+  double lane0() const { return _mm_cvtsd_f64(v); }
+  double lane1() const { return _mm_cvtsd_f64(_mm_unpackhi_pd(v, v)); }
+  friend f64x2 operator+(f64x2 l, f64x2 r) { return {_mm_add_pd(l.v, r.v)}; }
+  friend f64x2 operator-(f64x2 l, f64x2 r) { return {_mm_sub_pd(l.v, r.v)}; }
+  friend f64x2 operator*(f64x2 l, f64x2 r) { return {_mm_mul_pd(l.v, r.v)}; }
+};
+
+struct f32x4 {
+  __m128 v;
+
+  static f32x4 load(const float* p) { return {_mm_loadu_ps(p)}; }
+  static f32x4 splat(float a) { return {_mm_set1_ps(a)}; }
+  void store(float* p) const { _mm_storeu_ps(p, v); }
+  friend f32x4 min(f32x4 l, f32x4 r) { return {_mm_min_ps(l.v, r.v)}; }
+  friend f32x4 max(f32x4 l, f32x4 r) { return {_mm_max_ps(l.v, r.v)}; }
+  friend f32x4 operator+(f32x4 l, f32x4 r) { return {_mm_add_ps(l.v, r.v)}; }
+  friend f32x4 operator*(f32x4 l, f32x4 r) { return {_mm_mul_ps(l.v, r.v)}; }
+};
+
+struct u8x16 {
+  __m128i v;
+
+  static u8x16 load(const uint8_t* p) {
+    return {_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))};
+  }
+  static u8x16 splat(uint8_t a) { return {_mm_set1_epi8(a)}; }
+  // bit i is set if lane i is non zero (lanes are either 0x00 or 0xff)
+  uint32_t mask() const { return _mm_movemask_epi8(v); }
+  friend u8x16 operator==(u8x16 l, u8x16 r) {
+    return {_mm_cmpeq_epi8(l.v, r.v)};
+  }
+  friend u8x16 operator&(u8x16 l, u8x16 r) {
+    return {_mm_and_si128(l.v, r.v)};
+  }
+};
+
+#elif defined(__wasm_simd128__)
+
+struct f64x2 {
+  v128_t v;
+
+  static f64x2 make(double a, double b) { return {wasm_f64x2_make(a, b)}; }
+  static f64x2 splat(double a) { return {wasm_f64x2_splat(a)}; }
+  double lane0() const { return wasm_f64x2_extract_lane(v, 0); }
+  double lane1() const { return wasm_f64x2_extract_lane(v, 1); }
+  friend f64x2 operator+(f64x2 l, f64x2 r) {
+    return {wasm_f64x2_add(l.v, r.v)};
+  }
+  friend f64x2 operator-(f64x2 l, f64x2 r) {
+    return {wasm_f64x2_sub(l.v, r.v)};
+  }
+  friend f64x2 operator*(f64x2 l, f64x2 r) {
+    return {wasm_f64x2_mul(l.v, r.v)};
+  }
+};
+
+struct f32x4 {
+  v128_t v;
+
+  static f32x4 load(const float* p) { return {wasm_v128_load(p)}; }
+  static f32x4 splat(float a) { return {wasm_f32x4_splat(a)}; }
+  void store(float* p) const { wasm_v128_store(p, v); }
+  friend f32x4 min(f32x4 l, f32x4 r) { return {wasm_f32x4_pmin(l.v, r.v)}; }
+  friend f32x4 max(f32x4 l, f32x4 r) { return {wasm_f32x4_pmax(l.v, r.v)}; }
+  friend f32x4 operator+(f32x4 l, f32x4 r) {
+    return {wasm_f32x4_add(l.v, r.v)};
+  }
+  friend f32x4 operator*(f32x4 l, f32x4 r) {
+    return {wasm_f32x4_mul(l.v, r.v)};
+  }
+};
+
+struct u8x16 {
+  v128_t v;
+
+  static u8x16 load(const uint8_t* p) { return {wasm_v128_load(p)}; }
+  static u8x16 splat(uint8_t a) { return {wasm_i8x16_splat(a)}; }
+  uint32_t mask() const { return wasm_i8x16_bitmask(v); }
+  friend u8x16 operator==(u8x16 l, u8x16 r) {
+    return {wasm_i8x16_eq(l.v, r.v)};
+  }
+  friend u8x16 operator&(u8x16 l, u8x16 r) {
+    return {wasm_v128_and(l.v, r.v)};
+  }
+};
+
+#else
+
+struct f64x2 {
+  double a, b;
+
+  static f64x2 make(double a, double b) { return {a, b}; }
+  static f64x2 splat(double a) { return {a, a}; }
+  double lane0() const { return a; }
+  double lane1() const { return b; }
+  friend f64x2 operator+(f64x2 l, f64x2 r) { return {l.a + r.a, l.b + r.b}; }
+  friend f64x2 operator-(f64x2 l, f64x2 r) { return {l.a - r.a, l.b - r.b}; }
+  friend f64x2 operator*(f64x2 l, f64x2 r) { return {l.a * r.a, l.b * r.b}; }
+};
+
+struct f32x4 {
+  float x[4];
+
+  static f32x4 load(const float* p) { return {{p[0], p[1], p[2], p[3]}}; }
+  static f32x4 splat(float a) { return {{a, a, a, a}}; }
+  void store(float* p) const { std::copy(x, x + 4, p); }
+  template <class F>
+  static f32x4 map(f32x4 l, f32x4 r, F f) {
+    return {{f(l.x[0], r.x[0]), f(l.x[1], r.x[1]), f(l.x[2], r.x[2]),
+             f(l.x[3], r.x[3])}};
+  }
+  friend f32x4 min(f32x4 l, f32x4 r) {
+    return map(l, r, [](float a, float b) { return std::min(a, b); });
+  }
+  friend f32x4 max(f32x4 l, f32x4 r) {
+    return map(l, r, [](float a, float b) { return std::max(a, b); });
+  }
+  friend f32x4 operator+(f32x4 l, f32x4 r) {
+    return map(l, r, [](float a, float b) { return a + b; });
+  }
+  friend f32x4 operator*(f32x4 l, f32x4 r) {
+    return map(l, r, [](float a, float b) { return a * b; });
+  }
+};
+
+struct u8x16 {
+  uint8_t x[16];
+
+  static u8x16 load(const uint8_t* p) {
+    u8x16 r;
+    std::memcpy(r.x, p, 16);
+    return r;
+  }
+  static u8x16 splat(uint8_t a) {
+    u8x16 r;
+    std::memset(r.x, a, 16);
+    return r;
+  }
+  uint32_t mask() const {
+    uint32_t r = 0;
+    for (int i = 0; i < 16; i++) {
+      r |= (x[i] ? 1u : 0u) << i;
+    }
+    return r;
+  }
+  friend u8x16 operator==(u8x16 l, u8x16 r) {
+    u8x16 o;
+    for (int i = 0; i < 16; i++) {
+      o.x[i] = l.x[i] == r.x[i] ? 0xff : 0;
+    }
+    return o;
+  }
+  friend u8x16 operator&(u8x16 l, u8x16 r) {
+    u8x16 o;
+    for (int i = 0; i < 16; i++) {
+      o.x[i] = l.x[i] & r.x[i];
+    }
+    return o;
+  }
+};
+
+#endif
+
+//
+// reduction kernels
+//
+
+struct MinMaxSquare {
+  float min;
+  float max;
+  double sum_sq;  // sum of squares
+};
+
+MinMaxSquare reduceMinMaxSquare(const float* x, size_t n) {
+  if (n == 0) {
+    return {0, 0, 0};
+  }
+  f32x4 vmin = f32x4::splat(x[0]);
+  f32x4 vmax = f32x4::splat(x[0]);
+  f32x4 vsq = f32x4::splat(0);
+  size_t i = 0;
+  // partial sums in float are flushed to double every 1024 samples
+  double sum_sq = 0;
+  while (i + 4 <= n) {
+    size_t block_end = std::min(n - n % 4, i + 1024);
+    for (; i < block_end; i += 4) {
+      f32x4 v = f32x4::load(x + i);
+      vmin = min(vmin, v);
+      vmax = max(vmax, v);
+      vsq = vsq + v * v;
+    }
+    float lanes[4];
+    vsq.store(lanes);
+    sum_sq += (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    vsq = f32x4::splat(0);
+  }
+
+  float lanes_min[4], lanes_max[4];
+  vmin.store(lanes_min);
+  vmax.store(lanes_max);
+  MinMaxSquare result{lanes_min[0], lanes_max[0], sum_sq};
+  for (int k = 1; k < 4; k++) {
+    result.min = std::min(result.min, lanes_min[k]);
+    result.max = std::max(result.max, lanes_max[k]);
+  }
+  for (; i < n; i++) {
+    result.min = std::min(result.min, x[i]);
+    result.max = std::max(result.max, x[i]);
+    result.sum_sq += (double)x[i] * x[i];
+  }
+  return result;
+}
+
+//
+// search kernels
+//
+
+// call `f(offset)` for each occurrence of 4 byte `pattern` in increasing
+// order until `f` returns false. candidates are found 16 offsets at a time by
+// matching the first and last pattern bytes, then the middle two bytes are
+// compared only for those candidates.
+template <class F>
+void findPattern4(const uint8_t* data,
+                  size_t size,
+                  const uint8_t pattern[4],
+                  F f) {
+  if (size < 4) {
+    return;
+  }
+  u8x16 first = u8x16::splat(pattern[0]);
+  u8x16 last = u8x16::splat(pattern[3]);
+  size_t i = 0;
+  for (; i + 16 + 3 <= size; i += 16) {
+    uint32_t mask = ((u8x16::load(data + i) == first) &
+                     (u8x16::load(data + i + 3) == last))
+                        .mask();
+    while (mask) {
+      size_t offset = i + __builtin_ctz(mask);
+      mask &= mask - 1;
+      if (data[offset + 1] == pattern[1] && data[offset + 2] == pattern[2]) {
+        if (!f(offset)) {
+          return;
+        }
+      }
+    }
+  }
+  for (; i + 4 <= size; i++) {
+    if (std::memcmp(data + i, pattern, 4) == 0) {
+      if (!f(i)) {
+        return;
+      }
+    }
+  }
+}
+
+}  // namespace utils_simd
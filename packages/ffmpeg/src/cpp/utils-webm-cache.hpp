@@ -0,0 +1,435 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <optional>
+#include <vector>
+#include "utils-memory.hpp"
+#include "utils-webm.hpp"
+#include "utils.hpp"
+
+// compact binary form of SimpleMetadata for persistent cache
+// (directory cache for cli and IndexedDB for browser) so that repeated request
+// on the same source can skip metadata download and parse.
+//
+// layout (little endian, each section is 8 byte aligned so that cue columns
+// can be viewed in place from mmap-ed file or ArrayBuffer)
+//   Header
+//   ebml doc type bytes
+//   TrackHeader + codec_id bytes + codec_private bytes (for each track)
+//   time/track/duration/cluster_position columns (double[num_cues] each)
+
+namespace utils_webm_cache {
+
+using utils_webm::SimpleCuePoint;
+using utils_webm::SimpleMetadata;
+using utils_webm::SimpleTrackEntry;
+
+constexpr char MAGIC[4] = {'W', 'M', 'C', 'H'};
+// bump when layout changes so that stale entries become cache miss
+constexpr uint32_t VERSION = 1;
+constexpr uint32_t MISSING_SIZE = 0xffffffff;
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint64_t timecode_scale;
+  double duration;
+  double segment_body_start;  // NaN if missing
+  uint32_t doc_type_size;     // MISSING_SIZE if missing
+  uint32_t num_tracks;
+  uint64_t num_cues;
+  uint64_t cues_offset;
+  uint64_t total_size;
+};
+
+struct TrackHeader {
+  double track_number;  // NaN if missing
+  double track_type;
+  uint32_t codec_id_size;  // MISSING_SIZE if missing
+  uint32_t codec_private_size;
+};
+
+static_assert(sizeof(Header) == 72 && sizeof(TrackHeader) == 24);
+
+//
+// key
+//
+
+// FNV-1a over metadata prefix bytes combined with whole file size
+uint64_t cacheKey(const uint8_t* data, size_t size, uint64_t file_size) {
+  uint64_t hash = 0xcbf29ce484222325;
+  auto update = [&](uint8_t byte) {
+    hash ^= byte;
+    hash *= 0x100000001b3;
+  };
+  for (size_t i = 0; i < size; i++) {
+    update(data[i]);
+  }
+  for (int i = 0; i < 8; i++) {
+    update((file_size >> (8 * i)) & 0xff);
+  }
+  return hash;
+}
+
+//
+// serialize
+//
+
+double optionalToDouble(const std::optional<uint64_t>& v) {
+  return v ? static_cast<double>(v.value())
+           : std::numeric_limits<double>::quiet_NaN();
+}
+
+// NaN is no value while other value out of uint64_t (e.g. infinity or
+// negative from corrupted entry) fails so that entry is treated as miss
+bool doubleToOptional(double v, std::optional<uint64_t>& result) {
+  if (std::isnan(v)) {
+    result = std::nullopt;
+    return true;
+  }
+  if (!(v >= 0 && v < 0x1p64)) {
+    return false;
+  }
+  result = static_cast<uint64_t>(v);
+  return true;
+}
+
+struct Writer {
+  std::vector<uint8_t> data_;
+
+  void write(const void* src, size_t size) {
+    auto p = reinterpret_cast<const uint8_t*>(src);
+    data_.insert(data_.end(), p, p + size);
+  }
+
+  void align() { data_.resize((data_.size() + 7) / 8 * 8, 0); }
+};
+
+std::vector<uint8_t> serialize(const SimpleMetadata& metadata, uint64_t key) {
+  Writer writer;
+
+  // placeholder until offsets are known
+  Header header{};
+  writer.write(&header, sizeof(Header));
+
+  auto& doc_type = metadata.ebml_doc_type;
+  if (doc_type) {
+    writer.write(doc_type->data(), doc_type->size());
+    writer.align();
+  }
+
+  for (auto& track_entry : metadata.track_entries) {
+    TrackHeader track{};
+    track.track_number = optionalToDouble(track_entry.track_number);
+    track.track_type = optionalToDouble(track_entry.track_type);
+    track.codec_id_size =
+        track_entry.codec_id ? track_entry.codec_id->size() : MISSING_SIZE;
+    track.codec_private_size = track_entry.codec_private
+                                   ? track_entry.codec_private->size()
+                                   : MISSING_SIZE;
+    writer.write(&track, sizeof(TrackHeader));
+    if (track_entry.codec_id) {
+      writer.write(track_entry.codec_id->data(), track_entry.codec_id->size());
+    }
+    if (track_entry.codec_private) {
+      writer.write(track_entry.codec_private->data(),
+                   track_entry.codec_private->size());
+    }
+    writer.align();
+  }
+
+  auto cues = utils_webm::SimpleCueTable::fromCuePoints(metadata.cue_points);
+  size_t cues_offset = writer.data_.size();
+  for (auto column :
+       {&cues.time, &cues.track, &cues.duration, &cues.cluster_position}) {
+    writer.write(column->data(), column->size() * sizeof(double));
+  }
+
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.key = key;
+  header.timecode_scale = metadata.timecode_scale;
+  header.duration = metadata.duration;
+  header.segment_body_start = optionalToDouble(metadata.segment_body_start);
+  header.doc_type_size = doc_type ? doc_type->size() : MISSING_SIZE;
+  header.num_tracks = metadata.track_entries.size();
+  header.num_cues = metadata.cue_points.size();
+  header.cues_offset = cues_offset;
+  header.total_size = writer.data_.size();
+  std::memcpy(writer.data_.data(), &header, sizeof(Header));
+  return std::move(writer.data_);
+}
+
+//
+// deserialize
+//
+
+// bounds checked reader (any failure is treated as cache miss)
+struct Reader {
+  const uint8_t* data_;
+  size_t size_;
+  size_t pos_ = 0;
+
+  bool read(void* dst, size_t size) {
+    if (size > size_ - pos_) {
+      return false;
+    }
+    std::memcpy(dst, data_ + pos_, size);
+    pos_ += size;
+    return true;
+  }
+
+  template <class T>
+  bool readBytes(T& dst, uint32_t size) {
+    if (size > size_ - pos_) {
+      return false;
+    }
+    dst.assign(data_ + pos_, data_ + pos_ + size);
+    pos_ += size;
+    return true;
+  }
+
+  void align() { pos_ = std::min(size_, (pos_ + 7) / 8 * 8); }
+};
+
+// header only validation (e.g. to compare key before reading whole entry)
+std::optional<Header> readHeader(const uint8_t* data, size_t size) {
+  Header header;
+  if (size < sizeof(Header)) {
+    return {};
+  }
+  std::memcpy(&header, data, sizeof(Header));
+  if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header.version != VERSION || header.total_size != size ||
+      header.cues_offset > size ||
+      header.num_cues > (size - header.cues_offset) / (4 * sizeof(double))) {
+    return {};
+  }
+  return header;
+}
+
+std::optional<SimpleMetadata> deserialize(const uint8_t* data, size_t size) {
+  auto header = readHeader(data, size);
+  if (!header) {
+    return {};
+  }
+
+  SimpleMetadata metadata;
+  metadata.timecode_scale = header->timecode_scale;
+  metadata.duration = header->duration;
+  if (!doubleToOptional(header->segment_body_start,
+                        metadata.segment_body_start)) {
+    return {};
+  }
+
+  Reader reader{data, size, sizeof(Header)};
+  if (header->doc_type_size != MISSING_SIZE) {
+    auto& doc_type = metadata.ebml_doc_type.emplace();
+    if (!reader.readBytes(doc_type, header->doc_type_size)) {
+      return {};
+    }
+    reader.align();
+  }
+
+  for (uint32_t i = 0; i < header->num_tracks; i++) {
+    TrackHeader track;
+    if (!reader.read(&track, sizeof(TrackHeader))) {
+      return {};
+    }
+    auto& track_entry = metadata.track_entries.emplace_back();
+    if (!doubleToOptional(track.track_number, track_entry.track_number) ||
+        !doubleToOptional(track.track_type, track_entry.track_type)) {
+      return {};
+    }
+    if (track.codec_id_size != MISSING_SIZE &&
+        !reader.readBytes(track_entry.codec_id.emplace(),
+                          track.codec_id_size)) {
+      return {};
+    }
+    if (track.codec_private_size != MISSING_SIZE &&
+        !reader.readBytes(track_entry.codec_private.emplace(),
+                          track.codec_private_size)) {
+      return {};
+    }
+    reader.align();
+  }
+  if (reader.pos_ != header->cues_offset) {
+    return {};
+  }
+
+  size_t n = header->num_cues;
+  std::vector<double> columns[4];
+  for (auto& column : columns) {
+    column.resize(n);
+    if (!reader.read(column.data(), n * sizeof(double))) {
+      return {};
+    }
+  }
+  for (size_t i = 0; i < n; i++) {
+    auto& cue_point = metadata.cue_points.emplace_back();
+    if (!doubleToOptional(columns[0][i], cue_point.time) ||
+        !doubleToOptional(columns[1][i], cue_point.track) ||
+        !doubleToOptional(columns[2][i], cue_point.duration) ||
+        !doubleToOptional(columns[3][i], cue_point.cluster_position)) {
+      return {};
+    }
+  }
+  return metadata;
+}
+
+//
+// wrappers for embind (cache entry is stored by js e.g. in IndexedDB)
+//
+
+utils::Result<std::vector<uint8_t>> serializeMetadataWrapper(
+    const std::vector<uint8_t>& metadata_buffer,
+    double file_size) {
+  utils_memory::Scope memory_scope;
+  TRY_ASSIGN(auto parsed, utils_webm::parseMetadata(metadata_buffer));
+  ASSERT(parsed.first.ok());
+  auto key = cacheKey(metadata_buffer.data(), metadata_buffer.size(),
+                      static_cast<uint64_t>(file_size));
+  return serialize(parsed.second, key);
+}
+
+utils::Result<utils_webm::ParsedMetadata> deserializeMetadataWrapper(
+    const std::vector<uint8_t>& cache_buffer) {
+  utils_memory::Scope memory_scope;
+  auto metadata = deserialize(cache_buffer.data(), cache_buffer.size());
+  ASSERT(metadata);
+  return utils_webm::ParsedMetadata{std::move(metadata.value())};
+}
+
+utils::Result<std::vector<uint8_t>> remuxCachedWrapper(
+    const std::vector<uint8_t>& cache_buffer,
+    const std::vector<uint8_t>& frame_buffer,
+    bool fix_timestamp,
+    int track_number) {
+  utils_memory::Scope memory_scope;
+  utils_progress::Scope progress_scope;
+  auto track_filter = utils_webm::trackFilter(track_number);
+  auto metadata = deserialize(cache_buffer.data(), cache_buffer.size());
+  ASSERT(metadata);
+  TRY_ASSIGN(auto parsed,
+             utils_webm::parseFramesResync(frame_buffer, track_filter));
+  ASSERT(parsed.first.ok());
+  return utils_webm::remux(metadata.value(), parsed.second, fix_timestamp,
+                           track_filter);
+}
+
+// frames parsed while range chunks were downloaded (cf. RangeFrameParser)
+utils::Result<std::vector<uint8_t>> remuxCachedRange(
+    const std::vector<uint8_t>& cache_buffer,
+    utils_webm::RangeFrameParser& parser,
+    bool fix_timestamp) {
+  utils_memory::Scope memory_scope;
+  utils_progress::Scope progress_scope;
+  auto metadata = deserialize(cache_buffer.data(), cache_buffer.size());
+  ASSERT(metadata);
+  TRY_ASSIGN(auto frames, parser.finish());
+  return utils_webm::remux(metadata.value(), frames, fix_timestamp,
+                           parser.callback_.track_number_);
+}
+
+//
+// directory cache with LRU eviction by total file size
+// (last access is tracked by file modification time)
+//
+
+struct DirectoryCache {
+  std::filesystem::path dir_;
+  uintmax_t max_size_ = 0;
+
+  utils::Result<void> initialize(const std::string& dir, uintmax_t max_size) {
+    dir_ = dir;
+    max_size_ = max_size;
+    std::error_code ec;
+    std::filesystem::create_directories(dir_, ec);
+    ASSERT(!ec);
+    return {};
+  }
+
+  std::filesystem::path pathOf(uint64_t key) {
+    std::string name;
+    for (int i = 7; i >= 0; i--) {
+      name += utils::to_hex((key >> (8 * i)) & 0xff);
+    }
+    return dir_ / (name + ".wmc");
+  }
+
+  // nullopt on any failure (cache miss)
+  std::optional<SimpleMetadata> get(uint64_t key) {
+    auto path = pathOf(key);
+    std::error_code ec;
+    if (!std::filesystem::exists(path, ec)) {
+      return {};
+    }
+    auto data = utils::readFile(path.string());
+    if (!data.ok()) {
+      return {};
+    }
+    auto header = readHeader(data.value().data(), data.value().size());
+    if (!header || header->key != key) {
+      std::filesystem::remove(path, ec);
+      return {};
+    }
+    std::filesystem::last_write_time(
+        path, std::filesystem::file_time_type::clock::now(), ec);
+    return deserialize(data.value().data(), data.value().size());
+  }
+
+  utils::Result<void> put(uint64_t key, const SimpleMetadata& metadata) {
+    // write and rename so that concurrent readers don't see partial file
+    auto path = pathOf(key);
+    auto tmp_path = path;
+    tmp_path += ".tmp";
+    TRY(utils::writeFile(tmp_path.string(), serialize(metadata, key)));
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    ASSERT(!ec);
+    evict();
+    return {};
+  }
+
+  // best effort (entry which cannot be inspected is left as is)
+  void evict() {
+    struct Entry {
+      std::filesystem::path path;
+      uintmax_t size;
+      std::filesystem::file_time_type time;
+    };
+    std::vector<Entry> entries;
+    uintmax_t total = 0;
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it{dir_, ec}, end;
+         !ec && it != end; it.increment(ec)) {
+      if (it->path().extension() != ".wmc") {
+        continue;
+      }
+      std::error_code size_ec, time_ec;
+      auto size = it->file_size(size_ec);
+      auto time = it->last_write_time(time_ec);
+      if (size_ec || time_ec) {
+        continue;
+      }
+      entries.push_back({it->path(), size, time});
+      total += size;
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](auto& l, auto& r) { return l.time < r.time; });
+    for (auto& entry : entries) {
+      if (total <= max_size_) {
+        break;
+      }
+      std::filesystem::remove(entry.path, ec);
+      total -= entry.size;
+    }
+  }
+};
+
+}  // namespace utils_webm_cache
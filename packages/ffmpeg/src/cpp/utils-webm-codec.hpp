@@ -0,0 +1,344 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <memory>
+#include "utils-ffmpeg.hpp"
+#include "utils-peaks.hpp"
+#include "utils-webm.hpp"
+#include "utils.hpp"
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+// decode frames parsed by utils_webm with libavcodec
+
+namespace utils_webm_codec {
+
+using utils_webm::SimpleFrame;
+using utils_webm::SimpleMetadata;
+using utils_webm::SimpleTrackEntry;
+
+// matroska CodecID to libavcodec
+utils::Result<AVCodecID> toAVCodecID(const std::string& codec_id) {
+  static const std::map<std::string, AVCodecID> table = {
+      {"A_OPUS", AV_CODEC_ID_OPUS}, {"A_VORBIS", AV_CODEC_ID_VORBIS},
+      {"V_VP8", AV_CODEC_ID_VP8},   {"V_VP9", AV_CODEC_ID_VP9},
+      {"V_AV1", AV_CODEC_ID_AV1},
+  };
+  auto found = table.find(codec_id);
+  ASSERT(found != table.end());
+  return found->second;
+}
+
+utils::Result<const SimpleTrackEntry*> findTrack(
+    const SimpleMetadata& metadata,
+    webm::TrackType track_type) {
+  auto found = std::find_if(
+      metadata.track_entries.begin(), metadata.track_entries.end(),
+      [&](auto& track_entry) {
+        return track_entry.track_type ==
+               utils_webm::to_underlying_type(track_type);
+      });
+  ASSERT(found != metadata.track_entries.end());
+  return &*found;
+}
+
+struct FrameDecoder {
+  AVCodecParameters* codecpar_ = nullptr;
+  AVPacket* pkt_ = nullptr;
+  std::unique_ptr<utils_ffmpeg::Decoder> decoder_;
+
+  // opened after construction so that destructor releases partially opened
+  // state on failure
+  utils::Result<void> initialize(const SimpleMetadata& metadata,
+                                 const SimpleTrackEntry& track) {
+    ASSERT(track.codec_id);
+    codecpar_ = avcodec_parameters_alloc();
+    ASSERT(codecpar_);
+    TRY_ASSIGN(codecpar_->codec_id, toAVCodecID(track.codec_id.value()));
+    if (track.codec_private) {
+      auto& data = track.codec_private.value();
+      codecpar_->extradata = reinterpret_cast<uint8_t*>(
+          av_mallocz(data.size() + AV_INPUT_BUFFER_PADDING_SIZE));
+      ASSERT(codecpar_->extradata);
+      codecpar_->extradata_size = data.size();
+      std::memcpy(codecpar_->extradata, data.data(), data.size());
+    }
+
+    // frame timecode is in `timecode_scale` nanoseconds
+    AVRational time_base{static_cast<int>(metadata.timecode_scale),
+                         1000000000};
+    decoder_ = std::make_unique<utils_ffmpeg::Decoder>();
+    TRY(decoder_->initialize(codecpar_, time_base));
+
+    pkt_ = av_packet_alloc();
+    ASSERT(pkt_);
+    return {};
+  }
+
+  ~FrameDecoder() {
+    av_packet_free(&pkt_);
+    avcodec_parameters_free(&codecpar_);
+  }
+
+  // call `on_frame(AVFrame*)` (returning `utils::Result<void>`) for each
+  // decoded frame
+  template <class F>
+  utils::Result<void> decode(const SimpleFrame& frame, F on_frame) {
+    ASSERT_AV(av_new_packet(pkt_, frame.data.size()));
+    DEFER {
+      av_packet_unref(pkt_);
+    };
+    std::memcpy(pkt_->data, frame.data.data(), frame.data.size());
+    pkt_->pts = pkt_->dts = frame.timecode;
+    return decoder_->decode(pkt_, on_frame);
+  }
+
+  template <class F>
+  utils::Result<void> flush(F on_frame) {
+    return decoder_->decode(nullptr, on_frame);
+  }
+};
+
+//
+// waveform peaks from clusters fed incrementally
+// (e.g. only the clusters selected from cue points for zoomed-in view)
+//
+
+struct WaveformBuilder {
+  SimpleMetadata metadata_;
+  uint64_t track_number_ = 0;
+  std::unique_ptr<FrameDecoder> decoder_;
+  std::optional<utils_peaks::PeakBuilder> peaks_;
+  std::optional<uint64_t> first_timecode_;
+  // pushed bytes as single stream of unknown size so that push can end
+  // anywhere (e.g. within frame) and its unparsed tail waits for next push
+  std::optional<utils_webm::RangeFrameParser> parser_;
+  uint64_t pushed_ = 0;
+
+  // opened after construction (cf. utils_embind::construct)
+  utils::Result<void> initialize(const std::vector<uint8_t>& metadata_buffer,
+                                 uint32_t samples_per_bucket) {
+    ASSERT(samples_per_bucket > 0);
+    peaks_.emplace(samples_per_bucket);
+    TRY_ASSIGN(auto parsed, utils_webm::parseMetadata(metadata_buffer));
+    ASSERT(parsed.first.ok());
+    metadata_ = std::move(parsed.second);
+    TRY_ASSIGN(auto track, findTrack(metadata_, webm::TrackType::kAudio));
+    ASSERT(track->track_number);
+    track_number_ = track->track_number.value();
+    parser_.emplace(std::numeric_limits<uint64_t>::max(), track_number_);
+    decoder_ = std::make_unique<FrameDecoder>();
+    TRY(decoder_->initialize(metadata_, *track));
+    return {};
+  }
+
+  // bytes from Cluster pushed in order (consecutive pushes don't have to be
+  // contiguous in file as long as each gap is between clusters)
+  utils::Result<void> push(const std::vector<uint8_t>& frame_buffer) {
+    utils_memory::Scope memory_scope;
+    utils_progress::Scope progress_scope;
+    TRY(parser_->push(pushed_, frame_buffer));
+    pushed_ += frame_buffer.size();
+    // parser stops only by error since stream never ends
+    ASSERT(!parser_->done());
+    auto frames = parser_->takeFrames();
+    double bytes = 0;
+    for (auto& frame : frames) {
+      if (!first_timecode_) {
+        first_timecode_ = frame.timecode;
+      }
+      TRY(utils_progress::update(static_cast<double>(frame.timecode -
+                                                     first_timecode_.value()) *
+                                     metadata_.timecode_scale / 1e9,
+                                 bytes));
+      bytes += frame.data.size();
+      TRY(decoder_->decode(
+          frame, [&](AVFrame* av_frame) { return onFrame(av_frame); }));
+    }
+    return {};
+  }
+
+  utils::Result<void> onFrame(AVFrame* frame) {
+    ASSERT(frame->format == AV_SAMPLE_FMT_FLTP);
+    peaks_->process(reinterpret_cast<const float* const*>(frame->data),
+                    frame->ch_layout.nb_channels, frame->nb_samples);
+    return {};
+  }
+
+  utils::Result<std::vector<uint8_t>> finish() {
+    utils_memory::Scope memory_scope;
+    TRY(decoder_->flush(
+        [&](AVFrame* av_frame) { return onFrame(av_frame); }));
+    return peaks_->finish();
+  }
+
+  // timestamp of the first bucket in seconds (-1 if nothing is pushed yet)
+  double startTime() const {
+    if (!first_timecode_) {
+      return -1;
+    }
+    return static_cast<double>(first_timecode_.value()) *
+           metadata_.timecode_scale / 1e9;
+  }
+};
+
+//
+// thumbnail from single cluster
+// (each cue point of video track refers to a cluster starting with key frame
+// so that single cluster download and single frame decode suffice)
+//
+
+// cluster of the last video cue point at or before `time` (in seconds) up
+// to the next video cue point
+utils::Result<utils_webm::ClusterRange> findThumbnailCluster(
+    const SimpleMetadata& metadata,
+    double time) {
+  TRY_ASSIGN(auto track, findTrack(metadata, webm::TrackType::kVideo));
+  return utils_webm::findClusterRange(metadata, time, time,
+                                      track->track_number);
+}
+
+// scale to `width` (0 to keep original size, no upscale) keeping aspect ratio
+// and encode as baseline jpeg
+utils::Result<std::vector<uint8_t>> encodeJpeg(const AVFrame* frame,
+                                               int width) {
+  int out_width = width > 0 ? std::min(width, frame->width) : frame->width;
+  int out_height = static_cast<int>(static_cast<int64_t>(frame->height) *
+                                    out_width / frame->width);
+  // yuv420 needs even dimension
+  out_width = std::max(2, out_width / 2 * 2);
+  out_height = std::max(2, out_height / 2 * 2);
+
+  // scale and convert to full range yuv expected by mjpeg encoder
+  SwsContext* sws_ctx = sws_getContext(
+      frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+      out_width, out_height, AV_PIX_FMT_YUVJ420P, SWS_BICUBIC, nullptr,
+      nullptr, nullptr);
+  ASSERT(sws_ctx);
+  DEFER {
+    sws_freeContext(sws_ctx);
+  };
+  AVFrame* scaled = av_frame_alloc();
+  ASSERT(scaled);
+  DEFER {
+    av_frame_free(&scaled);
+  };
+  scaled->format = AV_PIX_FMT_YUVJ420P;
+  scaled->width = out_width;
+  scaled->height = out_height;
+  ASSERT_AV(av_frame_get_buffer(scaled, 0));
+  ASSERT(sws_scale(sws_ctx, frame->data, frame->linesize, 0, frame->height,
+                   scaled->data, scaled->linesize) == out_height);
+
+  // encode
+  auto codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+  ASSERT(codec);
+  AVCodecContext* codec_ctx = avcodec_alloc_context3(codec);
+  ASSERT(codec_ctx);
+  DEFER {
+    avcodec_free_context(&codec_ctx);
+  };
+  codec_ctx->width = out_width;
+  codec_ctx->height = out_height;
+  codec_ctx->pix_fmt = AV_PIX_FMT_YUVJ420P;
+  codec_ctx->time_base = AVRational{1, 1};
+  ASSERT_AV(avcodec_open2(codec_ctx, codec, nullptr));
+
+  AVPacket* pkt = av_packet_alloc();
+  ASSERT(pkt);
+  DEFER {
+    av_packet_free(&pkt);
+  };
+  ASSERT_AV(avcodec_send_frame(codec_ctx, scaled));
+  ASSERT_AV(avcodec_send_frame(codec_ctx, nullptr));
+  std::vector<uint8_t> output;
+  while (true) {
+    int ret = avcodec_receive_packet(codec_ctx, pkt);
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+      break;
+    }
+    ASSERT_AV(ret);
+    output.insert(output.end(), pkt->data, pkt->data + pkt->size);
+    av_packet_unref(pkt);
+  }
+  return output;
+}
+
+// decode only the last video key frame at or before `time` (or the first key
+// frame if cluster starts later) from frames of single cluster
+utils::Result<std::vector<uint8_t>> extractThumbnail(
+    const SimpleMetadata& metadata,
+    const std::vector<SimpleFrame>& frames,
+    double time,
+    int width) {
+  TRY_ASSIGN(auto track_entry, findTrack(metadata, webm::TrackType::kVideo));
+  auto& track = *track_entry;
+  ASSERT(track.track_number);
+  auto timecode = time * 1e9 / metadata.timecode_scale;
+
+  const SimpleFrame* selected = nullptr;
+  for (auto& frame : frames) {
+    if (frame.track_number != track.track_number.value() ||
+        !frame.is_key_frame) {
+      continue;
+    }
+    if (!selected || frame.timecode <= timecode) {
+      selected = &frame;
+    }
+  }
+  ASSERT(selected);
+
+  AVFrame* decoded = av_frame_alloc();
+  ASSERT(decoded);
+  DEFER {
+    av_frame_free(&decoded);
+  };
+  auto on_frame = [&](AVFrame* frame) -> utils::Result<void> {
+    if (!decoded->data[0]) {
+      ASSERT_AV(av_frame_ref(decoded, frame));
+    }
+    return {};
+  };
+  FrameDecoder decoder;
+  TRY(decoder.initialize(metadata, track));
+  TRY(decoder.decode(*selected, on_frame));
+  TRY(decoder.flush(on_frame));
+  ASSERT(decoded->data[0]);
+  return encodeJpeg(decoded, width);
+}
+
+// wrappers for embind
+
+utils::Result<utils_webm::ClusterRange> findThumbnailClusterWrapper(
+    const std::vector<uint8_t>& metadata_buffer,
+    double time) {
+  utils_memory::Scope memory_scope;
+  TRY_ASSIGN(auto parsed, utils_webm::parseMetadata(metadata_buffer));
+  ASSERT(parsed.first.ok());
+  return findThumbnailCluster(parsed.second, time);
+}
+
+utils::Result<std::vector<uint8_t>> extractThumbnailWrapper(
+    const std::vector<uint8_t>& metadata_buffer,
+    const std::vector<uint8_t>& cluster_buffer,
+    double time,
+    int width) {
+  utils_memory::Scope memory_scope;
+  utils_progress::Scope progress_scope;
+  TRY_ASSIGN(auto parsed_metadata,
+             utils_webm::parseMetadata(metadata_buffer));
+  ASSERT(parsed_metadata.first.ok());
+  auto& metadata = parsed_metadata.second;
+  // skip audio payload interleaved in the cluster
+  TRY_ASSIGN(auto track, findTrack(metadata, webm::TrackType::kVideo));
+  TRY_ASSIGN(auto parsed_frames,
+             utils_webm::parseFrames(cluster_buffer, track->track_number));
+  ASSERT(parsed_frames.first.ok());
+  return extractThumbnail(metadata, parsed_frames.second, time, width);
+}
+
+}  // namespace utils_webm_codec
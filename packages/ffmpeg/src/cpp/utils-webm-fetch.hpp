@@ -0,0 +1,340 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+#include "utils-http.hpp"
+#include "utils-memory.hpp"
+#include "utils-progress.hpp"
+#include "utils-ring.hpp"
+#include "utils-webm.hpp"
+#include "utils.hpp"
+
+// clip of remote webm by http range requests (native counterpart of
+// downloadFastSeek in app/src/utils/download.ts)
+//
+//   1. fetch metadata prefix (Cues are expected near the beginning)
+//   2. plan clusters covering time range from cue points
+//   3. fetch chunks of the range over `concurrency` connections. each worker
+//      streams its chunks into own SpscRing and main thread moves them into
+//      RangeFrameParser as they arrive, so that parsing overlaps download.
+//      server ignoring range gets single sequential request instead.
+//   4. remux parsed frames
+
+namespace utils_webm_fetch {
+
+struct FetchClipOptions {
+  double start_time = -1;  // -1 to indicate no value
+  double end_time = -1;
+  std::optional<uint64_t> track_number;  // only this track is muxed if given
+  bool fix_timestamp = true;
+  int concurrency = 4;
+  size_t chunk_size = 1 << 20;
+  size_t metadata_size = 64 << 10;  // doubled until Cues are parsed
+  size_t ring_size = 1 << 20;       // per worker
+};
+
+constexpr size_t MAX_METADATA_SIZE = 16 << 20;
+
+// worker `w` fetches chunks w, w + n, w + 2n, ... in order so that main
+// thread knows where each byte of the ring belongs without framing
+struct FetchWorker {
+  utils_ring::SpscRing ring_;
+  std::optional<utils::Error> error_;  // set before ring is closed
+  size_t chunk_;                       // chunk being consumed
+  uint64_t position_;                  // of next byte to consume
+
+  FetchWorker(size_t chunk) : chunk_{chunk} {}
+};
+
+// wait of producer and consumer (ring is lock free and nothing to wake up)
+void backoff() {
+  std::this_thread::sleep_for(std::chrono::microseconds(200));
+}
+
+// byte range of clusters covering time range of `options`
+utils::Result<std::pair<uint64_t, uint64_t>> planClip(
+    const utils_webm::SimpleMetadata& metadata,
+    const FetchClipOptions& options,
+    uint64_t file_size) {
+  auto start_time = options.start_time >= 0 ? std::optional(options.start_time)
+                                            : std::nullopt;
+  auto end_time =
+      options.end_time >= 0 ? std::optional(options.end_time) : std::nullopt;
+  TRY_ASSIGN(auto range,
+             utils_webm::findClusterRange(metadata, start_time, end_time));
+  uint64_t begin = range.start;
+  uint64_t end = range.end.value_or(file_size);
+  ASSERT(begin < end && end <= file_size);
+  return std::make_pair(begin, end);
+}
+
+utils::Error metadataError(const std::string& url, size_t size) {
+  return utils::Error{"webm", "metadata not found within " +
+                                  std::to_string(size) + " bytes (" + url +
+                                  ")"};
+}
+
+// single request from the beginning for server ignoring range (each range
+// request would download the whole prefix again). metadata is parsed as the
+// prefix arrives and the body is abandoned after the clip range.
+utils::Result<std::vector<uint8_t>> fetchSequential(
+    const std::string& url,
+    const FetchClipOptions& options,
+    uint64_t file_size) {
+  std::vector<uint8_t> metadata_buffer;
+  utils_webm::SimpleMetadata metadata;
+  size_t next_parse = options.metadata_size;
+  std::optional<utils_webm::RangeFrameParser> parser;
+  uint64_t begin = 0;
+  uint64_t end = 0;
+  uint64_t position = 0;  // of next byte
+
+  // false when the rest of body is not needed
+  auto consume = [&](const uint8_t* data,
+                     size_t size) -> utils::Result<bool> {
+    if (!parser) {
+      metadata_buffer.insert(metadata_buffer.end(), data, data + size);
+      position += size;
+      if (metadata_buffer.size() < next_parse && position < file_size) {
+        return true;
+      }
+      next_parse = metadata_buffer.size() * 2;
+      TRY_ASSIGN(auto parsed, utils_webm::parseMetadata(metadata_buffer));
+      if (!parsed.first.ok()) {
+        if (position >= file_size ||
+            metadata_buffer.size() >= MAX_METADATA_SIZE) {
+          return metadataError(url, metadata_buffer.size());
+        }
+        return true;
+      }
+      metadata = std::move(parsed.second);
+      if (metadata.cue_points.empty()) {
+        return utils::Error{"webm", "no Cues before Cluster (" + url + ")"};
+      }
+      TRY_ASSIGN(auto range, planClip(metadata, options, file_size));
+      begin = range.first;
+      end = range.second;
+      parser.emplace(end - begin, options.track_number);
+      utils_progress::setTotal(0, end - begin);
+      if (begin < position) {
+        TRY(parser->push(
+            0, std::vector(metadata_buffer.begin() + begin,
+                           metadata_buffer.begin() + std::min(end, position))));
+      }
+      metadata_buffer = {};
+    } else {
+      uint64_t from = std::max(position, begin);
+      uint64_t to = std::min(position + size, end);
+      if (from < to) {
+        TRY(parser->push(from - begin, std::vector(data + (from - position),
+                                                   data + (to - position))));
+      }
+      position += size;
+    }
+    TRY(utils_progress::update(0, std::min(position, end) -
+                                      std::min(position, begin)));
+    return !parser->done() && position < end;
+  };
+
+  utils::Result<void> status;
+  bool abandoned = false;
+  auto response = utils_http::fetchRange(
+      url, 0, file_size, [&](const uint8_t* data, size_t size) {
+        auto result = consume(data, size);
+        if (!result.ok()) {
+          status = result.error();
+          return false;
+        }
+        abandoned = !result.value();
+        return result.value();
+      });
+  TRY(status);
+  if (!abandoned) {
+    TRY(response);
+  }
+  ASSERT(parser);
+  TRY_ASSIGN(auto frames, parser->finish());
+  return utils_webm::remux(metadata, frames, options.fix_timestamp,
+                           options.track_number);
+}
+
+utils::Result<std::vector<uint8_t>> fetchClip(
+    const std::string& url,
+    const FetchClipOptions& options) {
+  utils_memory::Scope memory_scope;
+  utils_progress::Scope progress_scope;
+  ASSERT(options.concurrency > 0 && options.chunk_size > 0);
+
+  ASSERT(options.metadata_size > 0);
+
+  // metadata (prefix grows while it ends before the first Cluster)
+  std::vector<uint8_t> metadata_buffer;
+  utils_webm::SimpleMetadata metadata;
+  uint64_t file_size = 0;
+  for (size_t prefix = options.metadata_size;; prefix *= 2) {
+    auto head = utils_http::fetchRange(
+        url, metadata_buffer.size(), prefix,
+        [&](const uint8_t* data, size_t size) {
+          metadata_buffer.insert(metadata_buffer.end(), data, data + size);
+          return true;
+        });
+    TRY(head);
+    if (!head.value().total_size) {
+      return utils::Error{"http", "unknown content size (" + url + ")"};
+    }
+    file_size = head.value().total_size.value();
+    if (head.value().status == 200) {
+      return fetchSequential(url, options, file_size);
+    }
+    TRY_ASSIGN(auto parsed, utils_webm::parseMetadata(metadata_buffer));
+    if (parsed.first.ok()) {
+      metadata = std::move(parsed.second);
+      break;
+    }
+    if (metadata_buffer.size() >= file_size || prefix >= MAX_METADATA_SIZE) {
+      return metadataError(url, metadata_buffer.size());
+    }
+  }
+  if (metadata.cue_points.empty()) {
+    return utils::Error{"webm", "no Cues before Cluster (" + url + ")"};
+  }
+
+  // plan
+  TRY_ASSIGN(auto range, planClip(metadata, options, file_size));
+  uint64_t begin = range.first;
+  uint64_t end = range.second;
+  utils_webm::RangeFrameParser parser{end - begin, options.track_number};
+  utils_progress::setTotal(0, end - begin);
+
+  // bytes already in metadata prefix
+  uint64_t fetch_begin = std::min<uint64_t>(
+      std::max<uint64_t>(begin, metadata_buffer.size()), end);
+  if (begin < fetch_begin) {
+    TRY(parser.push(0, std::vector(metadata_buffer.begin() + begin,
+                                   metadata_buffer.begin() + fetch_begin)));
+  }
+  metadata_buffer = {};
+
+  // fetch
+  size_t num_chunks =
+      (end - fetch_begin + options.chunk_size - 1) / options.chunk_size;
+  size_t num_workers =
+      std::min<size_t>(options.concurrency, num_chunks);
+  auto chunkRange = [&](size_t chunk) {
+    uint64_t chunk_begin = fetch_begin + chunk * options.chunk_size;
+    return std::make_pair(
+        chunk_begin, std::min<uint64_t>(chunk_begin + options.chunk_size, end));
+  };
+  std::vector<std::unique_ptr<FetchWorker>> workers;
+  for (size_t w = 0; w < num_workers; w++) {
+    workers.push_back(std::make_unique<FetchWorker>(w));
+    TRY(workers.back()->ring_.initialize(options.ring_size));
+    workers.back()->position_ = chunkRange(w).first;
+  }
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> threads;
+  DEFER {
+    stop = true;
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  };
+  for (size_t w = 0; w < num_workers; w++) {
+    threads.emplace_back([&, w]() {
+      auto& worker = *workers[w];
+      auto run = [&]() -> utils::Result<void> {
+        for (size_t chunk = w; chunk < num_chunks; chunk += num_workers) {
+          auto [chunk_begin, chunk_end] = chunkRange(chunk);
+          TRY(utils_http::fetchRange(
+              url, chunk_begin, chunk_end,
+              [&](const uint8_t* data, size_t size) {
+                while (size > 0) {
+                  if (stop.load()) {
+                    return false;
+                  }
+                  size_t n = worker.ring_.tryWrite(data, size);
+                  data += n;
+                  size -= n;
+                  if (n == 0) {
+                    backoff();
+                  }
+                }
+                return true;
+              },
+              &stop));
+        }
+        return {};
+      };
+#ifdef UTILS_HAS_EXCEPTIONS
+      // e.g. std::bad_alloc must not escape thread (ring is closed anyway
+      // so that main thread doesn't wait forever)
+      auto result = [&]() -> utils::Result<void> {
+        try {
+          return run();
+        } catch (const std::exception& e) {
+          return utils::toError(e);
+        }
+      }();
+#else
+      auto result = run();
+#endif
+      if (!result.ok()) {
+        worker.error_ = result.error();
+      }
+      worker.ring_.close();
+    });
+  }
+
+  // parse as chunks arrive (bytes of ring can span consecutive chunks of
+  // the worker, which are not contiguous in file)
+  uint64_t received = fetch_begin - begin;
+  while (!parser.done()) {
+    bool progressed = false;
+    bool drained = true;
+    for (auto& worker_ptr : workers) {
+      auto& worker = *worker_ptr;
+      auto [data, size] = worker.ring_.peek();
+      if (size == 0) {
+        if (worker.ring_.drained()) {
+          if (worker.error_) {
+            return worker.error_.value();
+          }
+          continue;
+        }
+        drained = false;
+        continue;
+      }
+      drained = false;
+      auto chunk_end = chunkRange(worker.chunk_).second;
+      size = std::min<uint64_t>(size, chunk_end - worker.position_);
+      TRY(parser.push(worker.position_ - begin,
+                      std::vector(data, data + size)));
+      worker.ring_.consume(size);
+      worker.position_ += size;
+      if (worker.position_ == chunk_end) {
+        worker.chunk_ += num_workers;
+        worker.position_ = chunkRange(worker.chunk_).first;
+      }
+      received += size;
+      progressed = true;
+    }
+    TRY(utils_progress::update(0, received));
+    if (drained) {
+      break;
+    }
+    if (!progressed) {
+      backoff();
+    }
+  }
+
+  TRY_ASSIGN(auto frames, parser.finish());
+  return utils_webm::remux(metadata, frames, options.fix_timestamp,
+                           options.track_number);
+}
+
+}  // namespace utils_webm_fetch
@@ -1,10 +1,20 @@
+#pragma once
+
 #include <mkvmuxer/mkvmuxer.h>
 #include <mkvmuxer/mkvwriter.h>
 #include <webm/buffer_reader.h>
 #include <webm/webm_parser.h>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <map>
 #include <optional>
+#include <utility>
 #include <vector>
 #include "nlohmann-json-optional.hpp"
+#include "utils-memory.hpp"
+#include "utils-progress.hpp"
+#include "utils-simd.hpp"
 #include "utils.hpp"
 
 // cf.
@@ -112,10 +122,36 @@ struct SimpleMetadata {
                                  cue_points);
 };
 
+// cue points as columns (NaN for missing value) so that js can view each
+// column as Float64Array without per-cue objects
+struct SimpleCueTable {
+  std::vector<double> time;
+  std::vector<double> track;
+  std::vector<double> duration;
+  std::vector<double> cluster_position;
+
+  static SimpleCueTable fromCuePoints(
+      const std::vector<SimpleCuePoint>& cue_points) {
+    auto to_double = [](const std::optional<uint64_t>& v) {
+      return v ? static_cast<double>(v.value())
+               : std::numeric_limits<double>::quiet_NaN();
+    };
+    SimpleCueTable res;
+    for (auto& cue_point : cue_points) {
+      res.time.push_back(to_double(cue_point.time));
+      res.track.push_back(to_double(cue_point.track));
+      res.duration.push_back(to_double(cue_point.duration));
+      res.cluster_position.push_back(to_double(cue_point.cluster_position));
+    }
+    return res;
+  }
+};
+
 struct SimpleFrame {
   uint64_t track_number;
   uint64_t timecode;
   std::vector<uint8_t> data;
+  bool is_key_frame;
 };
 
 //
@@ -153,37 +189,223 @@ struct MkvBufferWriter : mkvmuxer::IMkvWriter {
   void ElementStartNotify(mkvmuxer::uint64, mkvmuxer::int64) override {}
 };
 
+//
+// webm::Reader without copy (webm::BufferReader copies given vector)
+//
+
+struct SpanReader : webm::Reader {
+  const uint8_t* data_;
+  size_t size_;
+  size_t position_ = 0;
+
+  SpanReader(const uint8_t* data, size_t size) : data_{data}, size_{size} {}
+
+  webm::Status Read(std::size_t num_to_read,
+                    std::uint8_t* buffer,
+                    std::uint64_t* num_actually_read) override {
+    size_t n = std::min(num_to_read, size_ - position_);
+    std::memcpy(buffer, data_ + position_, n);
+    position_ += n;
+    *num_actually_read = n;
+    return status(n, num_to_read);
+  }
+
+  webm::Status Skip(std::uint64_t num_to_skip,
+                    std::uint64_t* num_actually_skipped) override {
+    size_t n = std::min<uint64_t>(num_to_skip, size_ - position_);
+    position_ += n;
+    *num_actually_skipped = n;
+    return status(n, num_to_skip);
+  }
+
+  std::uint64_t Position() const override { return position_; }
+
+  // same as webm::BufferReader
+  static webm::Status status(uint64_t actual, uint64_t requested) {
+    if (actual == requested) {
+      return webm::Status(webm::Status::kOkCompleted);
+    }
+    if (actual > 0) {
+      return webm::Status(webm::Status::kOkPartial);
+    }
+    return webm::Status(webm::Status::kEndOfFile);
+  }
+};
+
+//
+// webm::Reader over sparse chunks received out of order (e.g. concurrent range
+// requests). chunks are moved in without copy and released once consumed.
+// reading at a gap returns kWouldBlock so that WebmParser::Feed can be resumed
+// after the missing range arrives.
+//
+
+struct RangeReader : webm::Reader {
+  std::map<uint64_t, std::vector<uint8_t>> chunks_;  // keyed by offset
+  uint64_t size_;
+  uint64_t position_ = 0;
+
+  RangeReader(uint64_t size) : size_{size} {}
+
+  utils::Result<void> push(uint64_t offset, std::vector<uint8_t> chunk) {
+    uint64_t end = offset + chunk.size();
+    ASSERT(end <= size_);
+    // already consumed (or skipped without data)
+    if (end <= position_) {
+      return {};
+    }
+    auto next = chunks_.lower_bound(offset);
+    ASSERT(next == chunks_.end() || end <= next->first);
+    if (next != chunks_.begin()) {
+      auto prev = std::prev(next);
+      ASSERT(prev->first + prev->second.size() <= offset);
+    }
+    chunks_.emplace_hint(next, offset, std::move(chunk));
+    return {};
+  }
+
+  // [begin, end) ranges not received yet after current position
+  std::vector<std::pair<uint64_t, uint64_t>> missing() const {
+    std::vector<std::pair<uint64_t, uint64_t>> result;
+    uint64_t p = position_;
+    for (auto& [offset, data] : chunks_) {
+      if (p < offset) {
+        result.emplace_back(p, offset);
+      }
+      p = std::max<uint64_t>(p, offset + data.size());
+    }
+    if (p < size_) {
+      result.emplace_back(p, size_);
+    }
+    return result;
+  }
+
+  //
+  // override
+  //
+
+  webm::Status Read(std::size_t num_to_read,
+                    std::uint8_t* buffer,
+                    std::uint64_t* num_actually_read) override {
+    *num_actually_read = 0;
+    while (*num_actually_read < num_to_read) {
+      auto chunk = find(position_);
+      if (chunk == chunks_.end()) {
+        break;
+      }
+      auto& [offset, data] = *chunk;
+      size_t begin = position_ - offset;
+      size_t n = std::min<uint64_t>(num_to_read - *num_actually_read,
+                                    data.size() - begin);
+      std::memcpy(buffer + *num_actually_read, data.data() + begin, n);
+      *num_actually_read += n;
+      position_ += n;
+      release();
+    }
+    return status(*num_actually_read, num_to_read);
+  }
+
+  // skipped bytes don't have to be received
+  webm::Status Skip(std::uint64_t num_to_skip,
+                    std::uint64_t* num_actually_skipped) override {
+    uint64_t n = std::min<uint64_t>(num_to_skip, size_ - position_);
+    position_ += n;
+    release();
+    *num_actually_skipped = n;
+    return status(n, num_to_skip);
+  }
+
+  std::uint64_t Position() const override { return position_; }
+
+  //
+  // private
+  //
+
+  // chunk containing `position`
+  std::map<uint64_t, std::vector<uint8_t>>::iterator find(uint64_t position) {
+    auto it = chunks_.upper_bound(position);
+    if (it == chunks_.begin()) {
+      return chunks_.end();
+    }
+    it--;
+    if (it->first + it->second.size() <= position) {
+      return chunks_.end();
+    }
+    return it;
+  }
+
+  // webm::Reader only moves forward
+  void release() {
+    while (!chunks_.empty() &&
+           chunks_.begin()->first + chunks_.begin()->second.size() <=
+               position_) {
+      chunks_.erase(chunks_.begin());
+    }
+  }
+
+  webm::Status status(uint64_t actual, uint64_t requested) const {
+    if (actual == 0 && requested > 0 && position_ < size_) {
+      return webm::Status(webm::Status::kWouldBlock);
+    }
+    return SpanReader::status(actual, requested);
+  }
+};
+
 //
 // custom webm::Callback
 //
 
+// user defined status (libwebm's own codes are not positive)
+constexpr std::int32_t CALLBACK_FAILED = 1;
+
+// callback cannot return utils::Error through the parser, so that the first
+// error is kept here and the parser is stopped by non-ok status
+struct CallbackError {
+  std::optional<utils::Error> error_;
+
+  webm::Status check(utils::Result<webm::Status> result) {
+    if (result.ok()) {
+      return result.value();
+    }
+    if (!error_) {
+      error_ = result.error();
+    }
+    return webm::Status(CALLBACK_FAILED);
+  }
+};
+
 // collect everything except Cluster
-struct MetadataParserCallback : webm::Callback {
+struct MetadataParserCallback : webm::Callback, CallbackError {
   SimpleMetadata metadata_;
 
   webm::Status OnEbml(const webm::ElementMetadata&,
                       const webm::Ebml& ebml) override {
-    ASSERT(ebml.doc_type.is_present());
-    ASSERT(!metadata_.ebml_doc_type.has_value());
-    metadata_.ebml_doc_type = ebml.doc_type.value();
-    return webm::Status(webm::Status::kOkCompleted);
+    return check([&]() -> utils::Result<webm::Status> {
+      ASSERT(ebml.doc_type.is_present());
+      ASSERT(!metadata_.ebml_doc_type.has_value());
+      metadata_.ebml_doc_type = ebml.doc_type.value();
+      return webm::Status(webm::Status::kOkCompleted);
+    }());
   }
 
   webm::Status OnSegmentBegin(const webm::ElementMetadata& metadata,
                               webm::Action* action) override {
-    ASSERT(!metadata_.segment_body_start.has_value());
-    metadata_.segment_body_start = metadata.position + metadata.header_size;
-    *action = webm::Action::kRead;
-    return webm::Status(webm::Status::kOkCompleted);
+    return check([&]() -> utils::Result<webm::Status> {
+      ASSERT(!metadata_.segment_body_start.has_value());
+      metadata_.segment_body_start = metadata.position + metadata.header_size;
+      *action = webm::Action::kRead;
+      return webm::Status(webm::Status::kOkCompleted);
+    }());
   }
 
   webm::Status OnInfo(const webm::ElementMetadata&,
                       const webm::Info& info) override {
-    ASSERT(info.timecode_scale.is_present());
-    ASSERT(info.duration.is_present());
-    metadata_.timecode_scale = info.timecode_scale.value();
-    metadata_.duration = info.duration.value();
-    return webm::Status(webm::Status::kOkCompleted);
+    return check([&]() -> utils::Result<webm::Status> {
+      ASSERT(info.timecode_scale.is_present());
+      ASSERT(info.duration.is_present());
+      metadata_.timecode_scale = info.timecode_scale.value();
+      metadata_.duration = info.duration.value();
+      return webm::Status(webm::Status::kOkCompleted);
+    }());
   }
 
   webm::Status OnTrackEntry(const webm::ElementMetadata&,
@@ -211,42 +433,57 @@ struct MetadataParserCallback : webm::Callback {
 };
 
 // collect frames
-struct FrameParserCallback : webm::Callback {
+struct FrameParserCallback : webm::Callback, CallbackError {
   std::vector<SimpleFrame> frames_;
+  // payload of other tracks is skipped without being read
+  std::optional<uint64_t> track_number_;
   // track current ancestor cluster/block of current frame
   std::optional<webm::Cluster> cluster_;
-  std::optional<webm::Block> block_;
+  std::optional<webm::SimpleBlock> block_;
 
   webm::Status OnClusterBegin(const webm::ElementMetadata&,
                               const webm::Cluster& cluster,
                               webm::Action* action) override {
-    ASSERT(!cluster_);
-    cluster_ = cluster;
-    *action = webm::Action::kRead;
-    return webm::Status(webm::Status::kOkCompleted);
+    return check([&]() -> utils::Result<webm::Status> {
+      ASSERT(!cluster_);
+      cluster_ = cluster;
+      *action = webm::Action::kRead;
+      return webm::Status(webm::Status::kOkCompleted);
+    }());
   }
 
   webm::Status OnClusterEnd(const webm::ElementMetadata&,
                             const webm::Cluster&) override {
-    ASSERT(cluster_);
-    cluster_ = std::nullopt;
-    return webm::Status(webm::Status::kOkCompleted);
+    return check([&]() -> utils::Result<webm::Status> {
+      ASSERT(cluster_);
+      cluster_ = std::nullopt;
+      return webm::Status(webm::Status::kOkCompleted);
+    }());
   }
 
   webm::Status OnSimpleBlockBegin(const webm::ElementMetadata&,
                                   const webm::SimpleBlock& simple_block,
                                   webm::Action* action) override {
-    ASSERT(!block_);
-    block_ = simple_block;
-    *action = webm::Action::kRead;
-    return webm::Status(webm::Status::kOkCompleted);
+    return check([&]() -> utils::Result<webm::Status> {
+      ASSERT(!block_);
+      if (track_number_ &&
+          simple_block.track_number != track_number_.value()) {
+        *action = webm::Action::kSkip;
+        return webm::Status(webm::Status::kOkCompleted);
+      }
+      block_ = simple_block;
+      *action = webm::Action::kRead;
+      return webm::Status(webm::Status::kOkCompleted);
+    }());
   }
 
   webm::Status OnSimpleBlockEnd(const webm::ElementMetadata&,
                                 const webm::SimpleBlock&) override {
-    ASSERT(block_);
-    block_ = std::nullopt;
-    return webm::Status(webm::Status::kOkCompleted);
+    return check([&]() -> utils::Result<webm::Status> {
+      ASSERT(block_);
+      block_ = std::nullopt;
+      return webm::Status(webm::Status::kOkCompleted);
+    }());
   }
 
   // taking only SimpleBlock seems fine
@@ -257,9 +494,20 @@ struct FrameParserCallback : webm::Callback {
     return webm::Status(webm::Status::kOkCompleted);
   }
 
+  // frame data read so far (OnFrame is called again with the same frame when
+  // parsing is resumed after kWouldBlock, cf. RangeReader)
+  std::vector<uint8_t> pending_;
+
   webm::Status OnFrame(const webm::FrameMetadata& metadata,
                        webm::Reader* reader,
                        uint64_t* bytes_remaining) override {
+    return check(readFrame(metadata, reader, bytes_remaining));
+  }
+
+  utils::Result<webm::Status> readFrame(const webm::FrameMetadata& metadata,
+                                        webm::Reader* reader,
+                                        uint64_t* bytes_remaining) {
+    TRY(utils_progress::check());
     ASSERT(cluster_);
     ASSERT(block_);
     ASSERT(cluster_.value().timecode.is_present());
@@ -267,24 +515,30 @@ struct FrameParserCallback : webm::Callback {
     ASSERT(block_.value().timecode >= 0);
     auto timecode = cluster_.value().timecode.value() + block_.value().timecode;
     auto track_number = block_.value().track_number;
+    auto is_key_frame = block_.value().is_key_frame;
 
-    std::vector<uint8_t> data;
-    data.resize((size_t)metadata.size);
-
-    // assume single Read suffices (which should be the case for
-    // BufferReader)
-    uint64_t num_actually_read = 0;
-    auto status =
-        reader->Read((size_t)metadata.size, data.data(), &num_actually_read);
-
-    // abort if not success
-    if (!status.completed_ok()) {
-      return webm::Status(webm::Status::kEndOfFile);
+    if (*bytes_remaining == metadata.size) {
+      pending_.resize((size_t)metadata.size);
+    }
+    while (*bytes_remaining > 0) {
+      uint64_t num_actually_read = 0;
+      auto status = reader->Read(
+          (size_t)*bytes_remaining,
+          pending_.data() + (metadata.size - *bytes_remaining),
+          &num_actually_read);
+      *bytes_remaining -= num_actually_read;
+      if (status.code == webm::Status::kWouldBlock) {
+        return status;
+      }
+      // abort if not success
+      if (!status.ok()) {
+        return webm::Status(webm::Status::kEndOfFile);
+      }
     }
 
-    ASSERT(num_actually_read == metadata.size);
-    frames_.push_back(SimpleFrame{track_number, timecode, data});
-    *bytes_remaining = 0;
+    frames_.push_back(
+        SimpleFrame{track_number, timecode, std::move(pending_), is_key_frame});
+    pending_ = {};
     return webm::Status(webm::Status::kOkCompleted);
   }
 };
@@ -293,42 +547,311 @@ struct FrameParserCallback : webm::Callback {
 // main API
 //
 
-std::pair<webm::Status, SimpleMetadata> parseMetadata(
+// error of callback (e.g. missing Info) is returned as is while parse error
+// is left to caller as non-ok status
+utils::Result<std::pair<webm::Status, SimpleMetadata>> parseMetadata(
     const std::vector<uint8_t>& buffer) {
   MetadataParserCallback callback;
   webm::WebmParser parser;
-  webm::BufferReader reader(buffer);
+  SpanReader reader(buffer.data(), buffer.size());
   auto status = parser.Feed(&callback, &reader);
-  return std::make_pair(status, callback.metadata_);
+  if (callback.error_) {
+    return callback.error_.value();
+  }
+  return std::make_pair(status, std::move(callback.metadata_));
 }
 
-std::string parseMetadataWrapper(const std::vector<uint8_t>& buffer) {
-  auto [status, metadata] = parseMetadata(buffer);
-  ASSERT(status.ok());
-  return nlohmann::json(metadata).dump(2);
-}
+// parse result kept alive on wasm heap for embind
+// (cf. embind_ParsedMetadata in ex01-emscripten.cpp)
+struct ParsedMetadata {
+  SimpleMetadata metadata_;
+  SimpleCueTable cues_;
 
-std::pair<webm::Status, std::vector<SimpleFrame>> parseFrames(
-    const std::vector<uint8_t>& buffer) {
+  ParsedMetadata() = default;
+
+  utils::Result<void> initialize(const std::vector<uint8_t>& buffer) {
+    utils_memory::Scope memory_scope;
+    TRY_ASSIGN(auto parsed, parseMetadata(buffer));
+    ASSERT(parsed.first.ok());
+    metadata_ = std::move(parsed.second);
+    cues_ = SimpleCueTable::fromCuePoints(metadata_.cue_points);
+    return {};
+  }
+
+  // e.g. from cache (cf. utils-webm-cache.hpp)
+  ParsedMetadata(SimpleMetadata metadata) : metadata_{std::move(metadata)} {
+    cues_ = SimpleCueTable::fromCuePoints(metadata_.cue_points);
+  }
+};
+
+// `buffer` has to start at Cluster (cf. parseFramesResync)
+utils::Result<std::pair<webm::Status, std::vector<SimpleFrame>>> parseFrames(
+    const std::vector<uint8_t>& buffer,
+    std::optional<uint64_t> track_number = std::nullopt) {
   FrameParserCallback callback;
+  callback.track_number_ = track_number;
   webm::WebmParser parser;
-  webm::BufferReader reader(buffer);
+  SpanReader reader(buffer.data(), buffer.size());
   parser.DidSeek();
   auto status = parser.Feed(&callback, &reader);
-  return std::make_pair(status, callback.frames_);  // TODO: avoid copy
+  if (callback.error_) {
+    return callback.error_.value();
+  }
+  return std::make_pair(status, std::move(callback.frames_));
+}
+
+// frames of range starting at Cluster (cf. parseFrames) parsed as far as
+// contiguous data is available while chunks arrive in any order
+struct RangeFrameParser {
+  RangeReader reader_;
+  FrameParserCallback callback_;
+  webm::WebmParser parser_;
+  webm::Status status_{webm::Status::kWouldBlock};
+
+  RangeFrameParser(uint64_t size,
+                   std::optional<uint64_t> track_number = std::nullopt)
+      : reader_{size} {
+    callback_.track_number_ = track_number;
+    parser_.DidSeek();
+  }
+
+  utils::Result<void> push(uint64_t offset, std::vector<uint8_t> chunk) {
+    utils_memory::Scope memory_scope;
+    utils_progress::Scope progress_scope;
+    TRY(reader_.push(offset, std::move(chunk)));
+    if (status_.code == webm::Status::kWouldBlock) {
+      status_ = parser_.Feed(&callback_, &reader_);
+    }
+    if (callback_.error_) {
+      return callback_.error_.value();
+    }
+    return {};
+  }
+
+  // false while waiting for missing range
+  bool done() const { return status_.code != webm::Status::kWouldBlock; }
+
+  // frames parsed so far (for consumer of frames as they arrive)
+  std::vector<SimpleFrame> takeFrames() {
+    return std::exchange(callback_.frames_, {});
+  }
+
+  utils::Result<std::vector<SimpleFrame>> finish() {
+    ASSERT(status_.ok());
+    return std::move(callback_.frames_);
+  }
+};
+
+//
+// Cluster resynchronization
+//
+
+// cf. https://www.rfc-editor.org/rfc/rfc8794 and
+//     https://www.matroska.org/technical/elements.html
+constexpr uint8_t CLUSTER_ID[4] = {0x1F, 0x43, 0xB6, 0x75};
+constexpr uint8_t TIMECODE_ID = 0xE7;
+constexpr uint8_t CRC32_ID = 0xBF;
+
+// top level elements which can follow Cluster
+constexpr uint32_t LEVEL1_IDS[] = {
+    0x1F43B675,  // Cluster
+    0x1C53BB6B,  // Cues
+    0x1254C367,  // Tags
+    0x1043A770,  // Chapters
+    0x1941A469,  // Attachments
+    0x114D9B74,  // SeekHead
+    0x1A45DFA3,  // EBML (next segment)
+    0xEC,        // Void
+};
+
+struct Vint {
+  uint64_t value;  // without length marker
+  size_t length;
+  bool unknown;  // all value bits set (i.e. unknown element size)
+};
+
+// EBML variable size integer (nullopt if invalid or truncated)
+std::optional<Vint> readVint(const uint8_t* data, size_t size) {
+  if (size == 0 || data[0] == 0) {
+    return {};
+  }
+  size_t length = __builtin_clz(data[0]) - 24 + 1;
+  if (size < length) {
+    return {};
+  }
+  uint64_t value = data[0] & (0xff >> length);
+  uint64_t all_ones = 0xff >> length;
+  for (size_t i = 1; i < length; i++) {
+    value = (value << 8) | data[i];
+    all_ones = (all_ones << 8) | 0xff;
+  }
+  return Vint{value, length, value == all_ones};
 }
 
-std::vector<uint8_t> remux(const SimpleMetadata& metadata,
-                           const std::vector<SimpleFrame>& frames,
-                           bool fix_timestamp) {
+// element ID keeps its length marker
+std::optional<uint32_t> readElementId(const uint8_t* data, size_t size) {
+  auto vint = readVint(data, size);
+  if (!vint || vint->length > 4) {
+    return {};
+  }
+  uint32_t id = 0;
+  for (size_t i = 0; i < vint->length; i++) {
+    id = (id << 8) | data[i];
+  }
+  return id;
+}
+
+// Cluster found by scanning raw bytes
+struct ClusterHeader {
+  size_t offset;    // of Cluster ID
+  int64_t end;      // -1 if size is unknown
+  uint64_t timecode;
+  bool end_verified;  // next top level element found at `end`
+};
+
+// validate Cluster candidate at `offset` by its size and Timecode child
+// (which muxers write first, possibly after CRC-32)
+std::optional<ClusterHeader> readClusterHeader(const uint8_t* data,
+                                               size_t size,
+                                               size_t offset) {
+  size_t p = offset + 4;
+  auto cluster_size = readVint(data + p, size - p);
+  if (!cluster_size) {
+    return {};
+  }
+  p += cluster_size->length;
+  size_t body = p;
+
+  if (p < size && data[p] == CRC32_ID) {
+    auto crc_size = readVint(data + p + 1, size - p - 1);
+    if (!crc_size || crc_size->value != 4) {
+      return {};
+    }
+    p += 1 + crc_size->length + 4;
+  }
+
+  if (p >= size || data[p] != TIMECODE_ID) {
+    return {};
+  }
+  p++;
+  auto timecode_size = readVint(data + p, size - p);
+  if (!timecode_size || timecode_size->value == 0 ||
+      timecode_size->value > 8 ||
+      p + timecode_size->length + timecode_size->value > size) {
+    return {};
+  }
+  p += timecode_size->length;
+  uint64_t timecode = 0;
+  for (size_t i = 0; i < timecode_size->value; i++) {
+    timecode = (timecode << 8) | data[p++];
+  }
+
+  ClusterHeader header{offset, -1, timecode, false};
+  if (cluster_size->unknown) {
+    return header;
+  }
+  if (body + cluster_size->value < p) {
+    return {};
+  }
+  header.end = body + cluster_size->value;
+
+  // size is trusted only when top level element follows (otherwise next
+  // bytes may be damaged or the size itself may be bogus). compared in
+  // uint64 before forming pointer since size_t is 32 bit on wasm.
+  if (cluster_size->value <= size - body &&
+      size - (body + cluster_size->value) >= 4) {
+    size_t next = body + cluster_size->value;
+    auto next_id = readElementId(data + next, size - next);
+    header.end_verified =
+        next_id && std::find(std::begin(LEVEL1_IDS), std::end(LEVEL1_IDS),
+                             next_id.value()) != std::end(LEVEL1_IDS);
+  }
+  return header;
+}
+
+// verified Clusters in `data` starting at arbitrary byte offset. candidates
+// of Cluster ID are searched by SIMD and ones inside verified Cluster are
+// skipped.
+std::vector<ClusterHeader> findClusters(const uint8_t* data, size_t size) {
+  std::vector<ClusterHeader> result;
+  size_t skip_end = 0;
+  utils_simd::findPattern4(data, size, CLUSTER_ID, [&](size_t offset) {
+    if (offset < skip_end) {
+      return true;
+    }
+    auto header = readClusterHeader(data, size, offset);
+    if (header) {
+      result.push_back(header.value());
+      if (header->end_verified) {
+        skip_end = header->end;
+      }
+    }
+    return true;
+  });
+  return result;
+}
+
+// parse frames of buffer starting at arbitrary byte offset (e.g. fixed size
+// download chunk or damaged file). each Cluster from `findClusters` is parsed
+// independently up to the next one so that broken Cluster only loses its own
+// remaining frames. returned status is of the last Cluster where hitting the
+// end of truncated buffer counts as kOkPartial.
+utils::Result<std::pair<webm::Status, std::vector<SimpleFrame>>>
+parseFramesResync(const std::vector<uint8_t>& buffer,
+                  std::optional<uint64_t> track_number = std::nullopt) {
+  auto clusters = findClusters(buffer.data(), buffer.size());
+  FrameParserCallback callback;
+  callback.track_number_ = track_number;
+  webm::Status status(webm::Status::kOkCompleted);
+  for (size_t i = 0; i < clusters.size(); i++) {
+    size_t begin = clusters[i].offset;
+    size_t end =
+        i + 1 < clusters.size() ? clusters[i + 1].offset : buffer.size();
+    callback.cluster_ = std::nullopt;
+    callback.block_ = std::nullopt;
+    webm::WebmParser parser;
+    SpanReader reader(buffer.data() + begin, end - begin);
+    parser.DidSeek();
+    status = parser.Feed(&callback, &reader);
+    if (callback.error_) {
+      return callback.error_.value();
+    }
+    if (status.code == webm::Status::kEndOfFile &&
+        (clusters[i].end < 0 || static_cast<size_t>(clusters[i].end) > end)) {
+      status = webm::Status(webm::Status::kOkPartial);
+    }
+  }
+  return std::make_pair(status, std::move(callback.frames_));
+}
+
+// seconds between cue points (i.e. clusters) of remuxed audio
+constexpr double DEFAULT_CUE_INTERVAL = 5;
+
+// only `track_number` is muxed if given. cue points of the first muxed track
+// are written at the start of each cluster of `cue_interval` seconds.
+utils::Result<std::vector<uint8_t>> remux(
+    const SimpleMetadata& metadata,
+    const std::vector<SimpleFrame>& frames,
+    bool fix_timestamp,
+    std::optional<uint64_t> track_number = std::nullopt,
+    double cue_interval = DEFAULT_CUE_INTERVAL) {
+  utils_progress::Scope progress_scope;
   MkvBufferWriter writer;
 
   mkvmuxer::Segment muxer_segment;
   ASSERT(muxer_segment.Init(&writer));
+  ASSERT(cue_interval > 0);
+  muxer_segment.set_max_cluster_duration(
+      static_cast<uint64_t>(cue_interval * 1e9));
+  muxer_segment.OutputCues(true);
+  std::optional<uint64_t> cues_track;
 
   // add tracks
   for (auto& track_entry : metadata.track_entries) {
     ASSERT(track_entry.track_number);
+    if (track_number && track_entry.track_number != track_number) {
+      continue;
+    }
     // TODO: parse sampleRate/channels
     ASSERT(muxer_segment.AddAudioTrack(
         48000, 2, (int32_t)track_entry.track_number.value()));
@@ -340,18 +863,35 @@ std::vector<uint8_t> remux(const SimpleMetadata& metadata,
       auto& data = track_entry.codec_private.value();
       track->SetCodecPrivate(data.data(), data.size());
     }
+    if (!cues_track) {
+      cues_track = track_entry.track_number;
+      ASSERT(muxer_segment.CuesTrack(cues_track.value()));
+    }
   }
 
   // add frames
+  double scale = static_cast<double>(metadata.timecode_scale) / 1e9;
+  double total_bytes = 0;
   for (auto& frame : frames) {
+    total_bytes += frame.data.size();
+  }
+  if (!frames.empty()) {
+    utils_progress::setTotal(
+        (frames.back().timecode - frames[0].timecode) * scale, total_bytes);
+  }
+  double bytes = 0;
+  for (auto& frame : frames) {
+    TRY(utils_progress::update((frame.timecode - frames[0].timecode) * scale,
+                               bytes));
+    bytes += frame.data.size();
     auto timecode = frame.timecode;
     if (fix_timestamp) {
       timecode -= frames[0].timecode;
     }
     auto timecode_ns = timecode * metadata.timecode_scale;
-    // TODO: does "key frame" matter?
     ASSERT(muxer_segment.AddFrame(frame.data.data(), frame.data.size(),
-                                  frame.track_number, timecode_ns, true));
+                                  frame.track_number, timecode_ns,
+                                  frame.is_key_frame));
   }
 
   // by not fixing timestamp to start from zero, we can use "startTime/endTime"
@@ -360,17 +900,75 @@ std::vector<uint8_t> remux(const SimpleMetadata& metadata,
     muxer_segment.set_duration(metadata.duration);
   }
   ASSERT(muxer_segment.Finalize());
-  return writer.data_;
+  return std::move(writer.data_);
+}
+
+// bytes of clusters covering time range by cue points
+// (cf. findContainingRange in ex01-emscripten-cli.ts)
+struct ClusterRange {
+  uint64_t start;
+  std::optional<uint64_t> end;  // nullopt to read until end of file
+  double start_time;            // of the starting cue point in seconds
+};
+
+// from the last cue point at or before `start_time` (or the first one) to
+// the first one after `end_time`. only cue points of `track_number` are
+// used if given.
+utils::Result<ClusterRange> findClusterRange(
+    const SimpleMetadata& metadata,
+    std::optional<double> start_time,
+    std::optional<double> end_time,
+    std::optional<uint64_t> track_number = {}) {
+  ASSERT(metadata.segment_body_start);
+  double scale = static_cast<double>(metadata.timecode_scale) / 1e9;
+  const SimpleCuePoint* start = nullptr;
+  const SimpleCuePoint* end = nullptr;
+  for (auto& cue_point : metadata.cue_points) {
+    if (!cue_point.time || !cue_point.cluster_position ||
+        (track_number && cue_point.track &&
+         cue_point.track != track_number)) {
+      continue;
+    }
+    double time = cue_point.time.value() * scale;
+    if (!start || (start_time && time <= start_time.value())) {
+      start = &cue_point;
+    }
+    if (end_time && !end && time > end_time.value()) {
+      end = &cue_point;
+    }
+  }
+  ASSERT(start);
+  auto base = metadata.segment_body_start.value();
+  ClusterRange result;
+  result.start = base + start->cluster_position.value();
+  if (end) {
+    result.end = base + end->cluster_position.value();
+  }
+  result.start_time = start->time.value() * scale;
+  return result;
+}
+
+// -1 for all tracks (js number)
+std::optional<uint64_t> trackFilter(int track_number) {
+  if (track_number < 0) {
+    return std::nullopt;
+  }
+  return static_cast<uint64_t>(track_number);
 }
 
-std::vector<uint8_t> remuxWrapper(const std::vector<uint8_t>& metadata_buffer,
-                                  const std::vector<uint8_t>& frame_buffer,
-                                  bool fix_timestamp) {
-  auto [metadata_status, metadata] = parseMetadata(metadata_buffer);
-  auto [frame_status, frames] = parseFrames(frame_buffer);
-  ASSERT(metadata_status.ok());
-  ASSERT(frame_status.ok());
-  return remux(metadata, frames, fix_timestamp);
+utils::Result<std::vector<uint8_t>> remuxWrapper(
+    const std::vector<uint8_t>& metadata_buffer,
+    const std::vector<uint8_t>& frame_buffer,
+    bool fix_timestamp,
+    int track_number) {
+  utils_memory::Scope memory_scope;
+  utils_progress::Scope progress_scope;
+  auto track_filter = trackFilter(track_number);
+  TRY_ASSIGN(auto metadata, parseMetadata(metadata_buffer));
+  TRY_ASSIGN(auto frames, parseFramesResync(frame_buffer, track_filter));
+  ASSERT(metadata.first.ok());
+  ASSERT(frames.first.ok());
+  return remux(metadata.second, frames.second, fix_timestamp, track_filter);
 }
 
 }  // namespace utils_webm
@@ -1,31 +1,135 @@
 #pragma once
 
+#include <atomic>
 #include <cstdio>
+#include <cstdlib>
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <tuple>
+#include <type_traits>
+#include <variant>
 #include <vector>
 
 //
-// assertion
+// error
 //
 
+// fallible functions return `Result` and propagate failure by `ASSERT`/`TRY`
+// as early return, so that the same code path works with -fno-exceptions
+// (meson default, cf. meson_options.txt) and destructors (incl. DEFER)
+// release partially built state before error reaches js.
+// with exceptions (-Dcpp_exceptions=true), std exceptions thrown by stdlib
+// or third party code are additionally caught at boundary (cf. utils_embind).
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+#define UTILS_HAS_EXCEPTIONS 1
+#endif
+
+namespace utils {
+
+// structured error readable from js (cf. utils_embind::guard)
+struct Error {
+  std::string code;  // e.g. assert, av, cancelled, deadline, memory_budget
+  std::string message;
+};
+
+std::string formatError(const Error& error) {
+  return "[" + error.code + "] " + error.message;
+}
+
+// formatted without std::ostringstream to keep ASSERT call site small
+Error assertionError(const char* file, int line, const char* expr) {
+  char message[512];
+  std::snprintf(message, sizeof(message), "[%s:line %d] %s", file, line, expr);
+  return Error{"assert", message};
+}
+
+#ifdef UTILS_HAS_EXCEPTIONS
+// for exception types which have to derive other std exception
+// (e.g. utils_memory::BudgetExceeded as std::bad_alloc)
+struct ErrorCode {
+  virtual ~ErrorCode() = default;
+  virtual const char* code() const = 0;
+};
+
+Error toError(const std::exception& e) {
+  if (auto coded = dynamic_cast<const ErrorCode*>(&e)) {
+    return Error{coded->code(), e.what()};
+  }
+  if (dynamic_cast<const std::bad_alloc*>(&e)) {
+    return Error{"out_of_memory", e.what()};
+  }
+  return Error{"unknown", e.what()};
+}
+#endif
+
+// value or error (cf. std::expected)
+template <class T>
+struct [[nodiscard]] Result {
+  std::variant<T, Error> value_;
+
+  Result(const T& value) : value_{std::in_place_index<0>, value} {}
+  Result(T&& value) : value_{std::in_place_index<0>, std::move(value)} {}
+  Result(Error error) : value_{std::in_place_index<1>, std::move(error)} {}
+
+  bool ok() const { return value_.index() == 0; }
+  T& value() { return std::get<0>(value_); }
+  const T& value() const { return std::get<0>(value_); }
+  const Error& error() const { return std::get<1>(value_); }
+};
+
+template <>
+struct [[nodiscard]] Result<void> {
+  std::optional<Error> error_;
+
+  Result() = default;
+  Result(Error error) : error_{std::move(error)} {}
+
+  bool ok() const { return !error_; }
+  const Error& error() const { return error_.value(); }
+};
+
+}  // namespace utils
+
+//
+// assertion and propagation
+//
+
+// return `utils::Error` from enclosing function (which returns `Result`).
 // format file/line compatible to vscode link
 // https://github.com/microsoft/vscode/blob/78397428676e15782e253261358b0398c2a1149e/src/vs/workbench/contrib/terminal/browser/links/terminalLocalLinkDetector.ts#L51
-#define ASSERT(EXPR)                                                        \
-  do {                                                                      \
-    if (!static_cast<bool>(EXPR)) {                                         \
-      std::ostringstream __ostr__##__LINE__;                                \
-      __ostr__##__LINE__ << "[" << __FILE__ << ":line " << __LINE__ << "] " \
-                         << #EXPR;                                          \
-      throw std::runtime_error{__ostr__##__LINE__.str()};                   \
-    }                                                                       \
+#define ASSERT(EXPR)                                             \
+  do {                                                           \
+    if (!static_cast<bool>(EXPR)) {                              \
+      return ::utils::assertionError(__FILE__, __LINE__, #EXPR); \
+    }                                                            \
+  } while (0)
+
+// return error of `Result` expression from enclosing function
+#define TRY(...)                        \
+  do {                                  \
+    auto&& _try_result = (__VA_ARGS__); \
+    if (!_try_result.ok()) {            \
+      return _try_result.error();       \
+    }                                   \
   } while (0)
 
+// `TRY` and assign value (e.g. TRY_ASSIGN(auto data, readFile(filename)))
+#define _TRY_VAR2(x) _try_var_##x
+#define _TRY_VAR1(x) _TRY_VAR2(x)
+#define TRY_ASSIGN(LHS, ...) _TRY_ASSIGN(_TRY_VAR1(__LINE__), LHS, __VA_ARGS__)
+#define _TRY_ASSIGN(VAR, LHS, ...) \
+  auto VAR = (__VA_ARGS__);        \
+  if (!VAR.ok()) {                 \
+    return VAR.error();            \
+  }                                \
+  LHS = std::move(VAR.value())
+
 //
 // debug print
 //
@@ -88,7 +192,7 @@ namespace utils {
 // file io
 //
 
-std::vector<uint8_t> readFile(const std::string& filename) {
+Result<std::vector<uint8_t>> readFile(const std::string& filename) {
   std::ifstream istr(filename, std::ios::binary);
   ASSERT(istr.is_open());
   std::vector<uint8_t> data((std::istreambuf_iterator<char>(istr)),
@@ -96,10 +200,13 @@ std::vector<uint8_t> readFile(const std::string& filename) {
   return data;
 }
 
-void writeFile(const std::string& filename, const std::vector<uint8_t>& data) {
+Result<void> writeFile(const std::string& filename,
+                       const std::vector<uint8_t>& data) {
   std::ofstream ostr(filename, std::ios::binary);
   ASSERT(ostr.is_open());
   ostr.write(reinterpret_cast<const char*>(data.data()), data.size());
+  ASSERT(ostr.good());
+  return {};
 }
 
 //
@@ -131,13 +238,25 @@ struct Cli {
     }
     return {};
   }
+
+  // every value of repeated flag (e.g. --in a --in b)
+  template <typename T = std::string>
+  std::vector<T> arguments(const std::string& flag) {
+    std::vector<T> result;
+    for (auto i = 1; i + 1 < argc; i++) {
+      if (argv[i] == flag) {
+        result.push_back(parse<T>(argv[++i]));
+      }
+    }
+    return result;
+  }
 };
 
 //
 // subprocess
 //
 
-std::vector<uint8_t> readFileDescriptor(std::FILE* fp) {
+Result<std::vector<uint8_t>> readFileDescriptor(std::FILE* fp) {
   std::vector<std::vector<uint8_t>> chunks;
   constexpr size_t CHUNK_SIZE = 1 << 10;
   while (true) {
@@ -161,7 +280,7 @@ std::vector<uint8_t> readFileDescriptor(std::FILE* fp) {
 struct Subprocess {
   // https://docs.python.org/3/library/subprocess.html#subprocess.check_output
   // https://pubs.opengroup.org/onlinepubs/009696799/functions/popen.html
-  static std::vector<uint8_t> checkOutput(const std::string& command) {
+  static Result<std::vector<uint8_t>> checkOutput(const std::string& command) {
     std::FILE* fp = popen(command.c_str(), "r");
     ASSERT(fp);
     auto output = readFileDescriptor(fp);
@@ -192,6 +311,81 @@ struct defer_helper {
 #define _DEFER_VAR1(x) _DEFER_VAR2(x)
 #define DEFER auto _DEFER_VAR1(__LINE__) = ::utils::defer_helper{} *= [&]()
 
+//
+// parallel for
+//
+
+// threads are not available on emscripten build without pthreads
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#define UTILS_HAS_THREADS 1
+#endif
+
+// 0 to indicate "all available cores"
+size_t resolveNumThreads(int num_threads) {
+#ifdef UTILS_HAS_THREADS
+  if (num_threads <= 0) {
+    return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  }
+  return static_cast<size_t>(num_threads);
+#else
+  return 1;
+#endif
+}
+
+// run `f(i)` (returning `Result<void>`) for each i in [0, n) over
+// `num_threads` threads. the first error stops remaining iterations and is
+// returned after all threads finish.
+template <class F>
+Result<void> parallelFor(size_t n, int num_threads, F f) {
+  size_t num_workers = std::min(resolveNumThreads(num_threads), n);
+  if (num_workers <= 1) {
+    for (size_t i = 0; i < n; i++) {
+      TRY(f(i));
+    }
+    return {};
+  }
+#ifdef UTILS_HAS_THREADS
+  std::atomic<size_t> next{0};
+  std::vector<std::optional<Error>> errors(num_workers);
+  std::vector<std::thread> workers;
+  for (size_t w = 0; w < num_workers; w++) {
+    workers.emplace_back([&, w]() {
+      auto run = [&]() -> Result<void> {
+        for (size_t i; (i = next++) < n;) {
+          TRY(f(i));
+        }
+        return {};
+      };
+#ifdef UTILS_HAS_EXCEPTIONS
+      // e.g. std::bad_alloc from stdlib must not escape thread
+      auto result = [&]() -> Result<void> {
+        try {
+          return run();
+        } catch (const std::exception& e) {
+          return toError(e);
+        }
+      }();
+#else
+      auto result = run();
+#endif
+      if (!result.ok()) {
+        errors[w] = result.error();
+        next = n;
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  for (auto& error : errors) {
+    if (error) {
+      return *error;
+    }
+  }
+#endif
+  return {};
+}
+
 //
 // hex print
 //